@@ -0,0 +1,460 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+// Benchmark of pdal_wrench commands on synthetic point clouds.
+//
+// The tool generates deterministic synthetic datasets (a single LAS, LAZ and COPC file
+// and a VPC made of LAS tiles), then runs selected pdal_wrench commands on them with
+// different numbers of threads and reports wall time, throughput and peak memory use
+// of each run as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#ifdef _WIN32
+#include <cstdlib>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <pdal/PipelineManager.hpp>
+#include <pdal/Reader.hpp>
+#include <pdal/Streamable.hpp>
+#include <pdal/util/ProgramArgs.hpp>
+
+#include "nlohmann/json.hpp"
+
+namespace fs = std::filesystem;
+using namespace pdal;
+
+#define SYNTHETIC_CRS "EPSG:32633"
+#define SYNTHETIC_ORIGIN_X 500000.0
+#define SYNTHETIC_ORIGIN_Y 5000000.0
+
+
+// Reader generating random points with a smooth terrain and some vegetation above it.
+// For the same parameters it always generates exactly the same points.
+class SyntheticReader : public Reader, public Streamable
+{
+public:
+    SyntheticReader(const BOX2D &box, point_count_t numPoints, uint32_t seed)
+      : m_box(box), m_numPoints(numPoints), m_seed(seed) {}
+
+    std::string getName() const override { return "readers.wrench_synthetic"; }
+
+private:
+    virtual void initialize() override
+    {
+        setSpatialReference(SpatialReference(SYNTHETIC_CRS));
+    }
+
+    virtual void addDimensions(PointLayoutPtr layout) override
+    {
+        layout->registerDims({ Dimension::Id::X, Dimension::Id::Y, Dimension::Id::Z,
+                               Dimension::Id::Intensity, Dimension::Id::ReturnNumber,
+                               Dimension::Id::NumberOfReturns, Dimension::Id::Classification,
+                               Dimension::Id::GpsTime });
+    }
+
+    virtual void ready(PointTableRef table) override
+    {
+        (void)table;
+        m_rng.seed(m_seed);
+        m_index = 0;
+    }
+
+    virtual point_count_t read(PointViewPtr view, point_count_t count) override
+    {
+        PointId idx = view->size();
+        point_count_t numRead = 0;
+        PointRef point(*view, idx);
+        while (numRead < count)
+        {
+            point.setPointId(idx);
+            if (!processOne(point))
+                break;
+            ++idx;
+            ++numRead;
+        }
+        return numRead;
+    }
+
+    virtual bool processOne(PointRef& point) override
+    {
+        if (m_index >= m_numPoints)
+            return false;
+
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        double x = m_box.minx + unit(m_rng) * (m_box.maxx - m_box.minx);
+        double y = m_box.miny + unit(m_rng) * (m_box.maxy - m_box.miny);
+        double ground = 200 + 20 * std::sin(x / 150) * std::cos(y / 170) + 0.1 * unit(m_rng);
+
+        // every fourth point or so is vegetation with a second return below it
+        bool vegetation = unit(m_rng) < 0.25;
+        double z = vegetation ? ground + 2 + 15 * unit(m_rng) : ground;
+
+        point.setField(Dimension::Id::X, x);
+        point.setField(Dimension::Id::Y, y);
+        point.setField(Dimension::Id::Z, z);
+        point.setField(Dimension::Id::Intensity, (uint16_t)(unit(m_rng) * 1000));
+        point.setField(Dimension::Id::ReturnNumber, 1);
+        point.setField(Dimension::Id::NumberOfReturns, vegetation ? 2 : 1);
+        point.setField(Dimension::Id::Classification, vegetation ? 5 : 2);
+        point.setField(Dimension::Id::GpsTime, 1e6 + m_index * 1e-5);
+        ++m_index;
+        return true;
+    }
+
+    BOX2D m_box;
+    point_count_t m_numPoints;
+    uint32_t m_seed;
+    std::mt19937 m_rng;
+    point_count_t m_index = 0;
+};
+
+
+static void writeSyntheticLas(const std::string &filename, const BOX2D &box, point_count_t numPoints, uint32_t seed)
+{
+    SyntheticReader reader(box, numPoints, seed);
+    LogPtr log(Log::makeLog("bench", "stderr"));
+    reader.setLog(log);
+
+    PipelineManager manager;
+    pdal::Options writerOpts;
+    writerOpts.add("minor_version", 4);
+    writerOpts.add("dataformat_id", 6);
+    writerOpts.add("scale_x", 0.01);
+    writerOpts.add("scale_y", 0.01);
+    writerOpts.add("scale_z", 0.01);
+    writerOpts.add("offset_x", "auto");
+    writerOpts.add("offset_y", "auto");
+    writerOpts.add("offset_z", "auto");
+    if (filename.size() > 4 && filename.substr(filename.size() - 4) == ".laz")
+        writerOpts.add("compression", "laszip");
+    manager.makeWriter(filename, "writers.las", reader, writerOpts);
+
+    FixedPointTable table(100000);
+    manager.executeStream(table);
+}
+
+
+struct RunResult
+{
+    double seconds = 0;
+    double peakRssMB = -1;  // negative if not available
+    int exitCode = -1;
+};
+
+// runs the executable with the given arguments, discarding its standard output
+static RunResult runCommand(const std::vector<std::string> &args)
+{
+    RunResult res;
+    auto start = std::chrono::steady_clock::now();
+
+#ifdef _WIN32
+    std::string cmd;
+    for (const std::string &a : args)
+        cmd += "\"" + a + "\" ";
+    cmd += "> NUL";
+    res.exitCode = std::system(cmd.c_str());
+#else
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0)
+            dup2(devNull, STDOUT_FILENO);
+
+        std::vector<char*> argv;
+        for (const std::string &a : args)
+            argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (pid > 0 && wait4(pid, &status, 0, &usage) == pid)
+    {
+        res.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#ifdef __APPLE__
+        res.peakRssMB = usage.ru_maxrss / (1024. * 1024.);  // bytes
+#else
+        res.peakRssMB = usage.ru_maxrss / 1024.;  // kilobytes
+#endif
+    }
+#endif
+
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return res;
+}
+
+
+// a command to benchmark - the arguments get extended by "--threads=N"
+struct Benchmark
+{
+    std::string name;
+    std::string dataset;      // which input is used (for the report)
+    std::vector<std::string> args;
+};
+
+
+int main(int argc, char* argv[])
+{
+    std::string wrenchPath;
+#ifdef WRENCH_EXECUTABLE
+    wrenchPath = WRENCH_EXECUTABLE;
+#endif
+    std::string workDir = (fs::temp_directory_path() / "wrench-bench").string();
+    std::string outputFile;
+    point_count_t numPoints = 5'000'000;
+    double density = 10;
+    uint32_t seed = 1234;
+    std::vector<int> threads;
+    std::vector<std::string> commands;
+    int repeat = 1;
+    bool help = false;
+
+    ProgramArgs programArgs;
+    programArgs.add("help,h", "Output command help.", help);
+    programArgs.add("wrench", "Path to pdal_wrench executable", wrenchPath, wrenchPath);
+    programArgs.add("work-dir", "Directory for generated data and outputs", workDir, workDir);
+    programArgs.add("output,o", "Write results to a JSON file (instead of standard output)", outputFile);
+    programArgs.add("points", "Number of points of the synthetic dataset", numPoints, numPoints);
+    programArgs.add("density", "Number of points per square unit of the synthetic dataset", density, density);
+    programArgs.add("seed", "Seed of the random generator of the synthetic dataset", seed, seed);
+    programArgs.add("threads", "Numbers of threads to benchmark with (default: 1, 2, 4, ... up to number of cores)", threads);
+    programArgs.add("commands", "Commands to benchmark (default: all of density, to_raster, tile, thin, clip, merge, build_vpc)", commands);
+    programArgs.add("repeat", "Number of runs of each benchmark (the fastest one is reported)", repeat, repeat);
+
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i)
+        args.push_back(argv[i]);
+
+    try
+    {
+        programArgs.parseSimple(args);
+    }
+    catch(pdal::arg_error err)
+    {
+        std::cerr << "failed to parse arguments: " << err.what() << std::endl;
+        return 1;
+    }
+
+    if (help)
+    {
+        std::cout << "usage: pdal_wrench_bench [<args>]" << std::endl;
+        programArgs.dump(std::cerr, 2, Utils::screenWidth());
+        return 0;
+    }
+
+    if (wrenchPath.empty() || !fs::exists(wrenchPath))
+    {
+        std::cerr << "pdal_wrench executable not found - use --wrench argument" << std::endl;
+        return 1;
+    }
+
+    if (threads.empty())
+    {
+        int maxThreads = (std::max)(1, (int)std::thread::hardware_concurrency());
+        for (int t = 1; t < maxThreads; t *= 2)
+            threads.push_back(t);
+        threads.push_back(maxThreads);
+    }
+
+    if (commands.empty())
+        commands = { "density", "to_raster", "tile", "thin", "clip", "merge", "build_vpc" };
+
+    // generate input data (only once for the given parameters)
+
+    const double side = std::sqrt(numPoints / density);
+    const BOX2D box(SYNTHETIC_ORIGIN_X, SYNTHETIC_ORIGIN_Y, SYNTHETIC_ORIGIN_X + side, SYNTHETIC_ORIGIN_Y + side);
+
+    const fs::path dataDir = fs::path(workDir) / ("data_" + std::to_string(numPoints) + "_" + std::to_string(density) + "_" + std::to_string(seed));
+    const fs::path outputDir = fs::path(workDir) / "output";
+    fs::create_directories(dataDir);
+
+    const std::string lasFile = (dataDir / "synthetic.las").string();
+    const std::string lazFile = (dataDir / "synthetic.laz").string();
+    const std::string copcFile = (dataDir / "synthetic.copc.laz").string();
+    const std::string vpcFile = (dataDir / "tiles.vpc").string();
+    const std::string polygonFile = (dataDir / "clip.geojson").string();
+
+    const int numTilesPerSide = 4;
+    std::vector<std::string> tileFiles;
+    for (int iy = 0; iy < numTilesPerSide; ++iy)
+        for (int ix = 0; ix < numTilesPerSide; ++ix)
+            tileFiles.push_back((dataDir / ("tile_" + std::to_string(ix) + "_" + std::to_string(iy) + ".las")).string());
+
+    if (!fs::exists(lasFile))
+    {
+        std::cerr << "generating " << lasFile << std::endl;
+        writeSyntheticLas(lasFile, box, numPoints, seed);
+    }
+    if (!fs::exists(lazFile))
+    {
+        std::cerr << "generating " << lazFile << std::endl;
+        writeSyntheticLas(lazFile, box, numPoints, seed);
+    }
+    if (!fs::exists(copcFile))
+    {
+        std::cerr << "generating " << copcFile << std::endl;
+        runCommand({ wrenchPath, "translate", "--input=" + lasFile, "--output=" + copcFile });
+    }
+    for (int iy = 0; iy < numTilesPerSide; ++iy)
+    {
+        for (int ix = 0; ix < numTilesPerSide; ++ix)
+        {
+            const std::string &tileFile = tileFiles[iy * numTilesPerSide + ix];
+            if (fs::exists(tileFile))
+                continue;
+            std::cerr << "generating " << tileFile << std::endl;
+            double tileSide = side / numTilesPerSide;
+            BOX2D tileBox(box.minx + ix * tileSide, box.miny + iy * tileSide,
+                          box.minx + (ix + 1) * tileSide, box.miny + (iy + 1) * tileSide);
+            writeSyntheticLas(tileFile, tileBox, numPoints / (numTilesPerSide * numTilesPerSide), seed + 1 + iy * numTilesPerSide + ix);
+        }
+    }
+    if (!fs::exists(vpcFile))
+    {
+        std::vector<std::string> buildArgs = { wrenchPath, "build_vpc", "--output=" + vpcFile };
+        buildArgs.insert(buildArgs.end(), tileFiles.begin(), tileFiles.end());
+        runCommand(buildArgs);
+    }
+    if (!fs::exists(polygonFile))
+    {
+        // a rectangle in the middle of the dataset covering about quarter of its area
+        double x0 = box.minx + side / 4, y0 = box.miny + side / 4, x1 = box.maxx - side / 4, y1 = box.maxy - side / 4;
+        nlohmann::json polygon = {
+            { "type", "FeatureCollection" },
+            { "crs", { { "type", "name" }, { "properties", { { "name", "urn:ogc:def:crs:EPSG::32633" } } } } },
+            { "features", { {
+                { "type", "Feature" },
+                { "properties", nlohmann::json::object() },
+                { "geometry", {
+                    { "type", "Polygon" },
+                    { "coordinates", { { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y1 }, { x0, y0 } } } },
+                } },
+            } } },
+        };
+        std::ofstream(polygonFile) << polygon.dump(2) << std::endl;
+    }
+
+    // list of benchmarks
+
+    const std::string out = outputDir.string() + "/";
+    std::vector<Benchmark> benchmarks;
+    auto add = [&](const std::string &name, const std::string &dataset, const std::vector<std::string> &cmdArgs)
+    {
+        if (std::find(commands.begin(), commands.end(), name) == commands.end())
+            return;
+        Benchmark b;
+        b.name = name;
+        b.dataset = dataset;
+        b.args = { wrenchPath, name };
+        b.args.insert(b.args.end(), cmdArgs.begin(), cmdArgs.end());
+        benchmarks.push_back(b);
+    };
+
+    add("density", "las", { "--input=" + lasFile, "--output=" + out + "density.tif", "--resolution=1" });
+    add("density", "copc", { "--input=" + copcFile, "--output=" + out + "density.tif", "--resolution=1" });
+    add("density", "vpc", { "--input=" + vpcFile, "--output=" + out + "density.tif", "--resolution=1" });
+    add("to_raster", "copc", { "--input=" + copcFile, "--output=" + out + "raster.tif", "--resolution=1", "--attribute=Z" });
+    add("to_raster", "vpc", { "--input=" + vpcFile, "--output=" + out + "raster.tif", "--resolution=1", "--attribute=Z" });
+    add("tile", "laz", { "--length=" + std::to_string(side / 4), "--output=" + out + "tiles", lazFile });
+    add("thin", "laz", { "--input=" + lazFile, "--output=" + out + "thin.las", "--mode=every-nth", "--step-every-nth=10" });
+    add("clip", "vpc", { "--input=" + vpcFile, "--polygon=" + polygonFile, "--output=" + out + "clip.vpc", "--vpc-output-format=las" });
+    {
+        std::vector<std::string> mergeArgs = { "--output=" + out + "merged.las" };
+        mergeArgs.insert(mergeArgs.end(), tileFiles.begin(), tileFiles.end());
+        add("merge", "tiles", mergeArgs);
+        std::vector<std::string> buildArgs = { "--output=" + out + "built.vpc" };
+        buildArgs.insert(buildArgs.end(), tileFiles.begin(), tileFiles.end());
+        add("build_vpc", "tiles", buildArgs);
+    }
+
+    // run them
+
+    nlohmann::ordered_json results = nlohmann::json::array();
+    for (const Benchmark &b : benchmarks)
+    {
+        for (int numThreads : threads)
+        {
+            std::vector<std::string> runArgs = b.args;
+            runArgs.push_back("--threads=" + std::to_string(numThreads));
+
+            RunResult best;
+            for (int i = 0; i < repeat; ++i)
+            {
+                fs::remove_all(outputDir);
+                fs::create_directories(outputDir);
+
+                RunResult res = runCommand(runArgs);
+                if (i == 0 || (res.exitCode == 0 && res.seconds < best.seconds))
+                    best = res;
+            }
+
+            std::cerr << b.name << " (" << b.dataset << ") threads " << numThreads << ": "
+                      << best.seconds << " s" << (best.exitCode != 0 ? " - FAILED" : "") << std::endl;
+
+            nlohmann::ordered_json r = {
+                { "command", b.name },
+                { "dataset", b.dataset },
+                { "threads", numThreads },
+                { "exit_code", best.exitCode },
+                { "seconds", best.seconds },
+                { "points_per_second", best.seconds > 0 ? numPoints / best.seconds : 0 },
+            };
+            if (best.peakRssMB >= 0)
+                r["peak_rss_mb"] = best.peakRssMB;
+            else
+                r["peak_rss_mb"] = nullptr;
+            results.push_back(r);
+        }
+    }
+
+    fs::remove_all(outputDir);
+
+    nlohmann::ordered_json report = {
+        { "points", numPoints },
+        { "density", density },
+        { "seed", seed },
+        { "results", results },
+    };
+
+    if (outputFile.empty())
+    {
+        std::cout << report.dump(2) << std::endl;
+    }
+    else
+    {
+        std::ofstream f(outputFile);
+        if (!f.good())
+        {
+            std::cerr << "Failed to write results: " << outputFile << std::endl;
+            return 1;
+        }
+        f << report.dump(2) << std::endl;
+    }
+
+    return 0;
+}
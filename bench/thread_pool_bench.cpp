@@ -0,0 +1,234 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+// Microbenchmark of the thread pool used by the tile command (src/tile/ThreadPool.hpp).
+//
+// Many short tasks are added to the pool from one or more producer threads and the time
+// until all of them are finished is measured. For comparison, the same is done with
+// the previous implementation of the pool, which kept the tasks in std::queue guarded
+// by a single mutex and woke up all threads whenever a task was added or finished.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tile/ThreadPool.hpp"
+
+
+// The previous implementation of untwine::ThreadPool (reduced to what the benchmark needs)
+class MutexThreadPool
+{
+public:
+    MutexThreadPool(size_t numThreads, int64_t queueSize = -1) : m_queueSize(queueSize)
+    {
+        m_running = true;
+        for (size_t i = 0; i < numThreads; ++i)
+            m_threads.emplace_back([this]() { work(); });
+    }
+
+    ~MutexThreadPool()
+    { join(); }
+
+    void join()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_running) return;
+        m_running = false;
+        lock.unlock();
+
+        m_consumeCv.notify_all();
+        for (auto& t : m_threads) t.join();
+        m_threads.clear();
+    }
+
+    void await()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_produceCv.wait(lock, [this]() { return !m_outstanding && m_tasks.empty(); });
+    }
+
+    bool add(std::function<void()> task)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_running)
+            return false;
+
+        m_produceCv.wait(lock, [this]()
+        {
+            return m_queueSize < 0 || m_tasks.size() < (size_t)m_queueSize;
+        });
+
+        m_tasks.emplace(task);
+        lock.unlock();
+        m_consumeCv.notify_all();
+        return true;
+    }
+
+private:
+    void work()
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_consumeCv.wait(lock, [this]() { return m_tasks.size() || !m_running; });
+
+            if (m_tasks.size())
+            {
+                ++m_outstanding;
+                auto task(std::move(m_tasks.front()));
+                m_tasks.pop();
+                lock.unlock();
+                m_produceCv.notify_all();
+
+                task();
+
+                lock.lock();
+                --m_outstanding;
+                lock.unlock();
+                m_produceCv.notify_all();
+            }
+            else if (!m_running)
+                return;
+        }
+    }
+
+    int64_t m_queueSize;
+    std::vector<std::thread> m_threads;
+    std::queue<std::function<void()>> m_tasks;
+    size_t m_outstanding = 0;
+    bool m_running = false;
+    std::mutex m_mutex;
+    std::condition_variable m_produceCv;
+    std::condition_variable m_consumeCv;
+};
+
+
+// Short task: a bit of arithmetic, so that the overhead of the pool dominates
+static void shortTask(std::atomic<uint64_t> &sink, uint64_t seed, int work)
+{
+    uint64_t x = seed;
+    for (int i = 0; i < work; ++i)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    sink += x & 1;
+}
+
+template <typename Pool>
+static double runBenchmark(int threads, int producers, int64_t queueSize, size_t tasks, int work)
+{
+    std::atomic<uint64_t> sink {0};
+    Pool pool(threads, queueSize);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> producerThreads;
+    for (int p = 0; p < producers; ++p)
+    {
+        producerThreads.emplace_back([&pool, &sink, p, producers, tasks, work]()
+        {
+            for (size_t i = p; i < tasks; i += producers)
+                pool.add([&sink, i, work]() { shortTask(sink, i, work); });
+        });
+    }
+    for (std::thread &t : producerThreads)
+        t.join();
+    pool.await();
+
+    auto end = std::chrono::steady_clock::now();
+    pool.join();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+
+static void printUsage()
+{
+    std::cout << "usage: pdal_wrench_thread_pool_bench [<number of tasks> [<work per task>]]" << std::endl;
+    std::cout << "  number of tasks - tasks added to the pool in each run (default: 200000)" << std::endl;
+    std::cout << "  work per task   - iterations of arithmetic done by each task (default: 100)" << std::endl;
+}
+
+// parses a positive integer argument, returns false if it is not a valid number
+template <typename T>
+static bool parseCount(const std::string &arg, T &value)
+{
+    try
+    {
+        size_t pos = 0;
+        long long v = std::stoll(arg, &pos);
+        if (pos != arg.size() || v <= 0 || (unsigned long long)v > (unsigned long long)(std::numeric_limits<T>::max)())
+            return false;
+        value = (T)v;
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    size_t tasks = 200000;
+    int work = 100;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+    }
+    if (argc > 3 || (argc > 1 && !parseCount(argv[1], tasks)) || (argc > 2 && !parseCount(argv[2], work)))
+    {
+        std::cerr << "invalid arguments" << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    int maxThreads = (std::max)(2u, std::thread::hardware_concurrency());
+
+    std::cout << "tasks " << tasks << ", work per task " << work << std::endl;
+    std::cout << "threads producers queue      mutex pool [tasks/s]   lock-free pool [tasks/s]" << std::endl;
+
+    std::vector<int> threadCounts;
+    for (int threads : { 2, 4, 8, maxThreads })
+    {
+        if (threads <= maxThreads && std::find(threadCounts.begin(), threadCounts.end(), threads) == threadCounts.end())
+            threadCounts.push_back(threads);
+    }
+
+    for (int threads : threadCounts)
+    {
+        for (int producers : { 1, 4 })
+        {
+            for (int64_t queueSize : { (int64_t)-1, (int64_t)64 })
+            {
+                double tMutex = runBenchmark<MutexThreadPool>(threads, producers, queueSize, tasks, work);
+                double tLockFree = runBenchmark<untwine::ThreadPool>(threads, producers, queueSize, tasks, work);
+                std::cout << threads << "\t" << producers << "\t  " << (queueSize < 0 ? std::string("unbounded") : std::to_string(queueSize))
+                          << "\t" << (size_t)(tasks / tMutex) << "\t\t\t" << (size_t)(tasks / tLockFree) << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -14,15 +14,44 @@
 
 #include "utils.hpp"
 #include "vpc.hpp"
+#include "profile.hpp"
 
 #include <thread>
 
+#include <pdal/PointLayout.hpp>
 #include <pdal/QuickInfo.hpp>
 #include <pdal/util/Bounds.hpp>
 
 using namespace pdal;
 
 
+// Memory used by non-streaming pipelines for each point on top of the point data itself:
+// point IDs in point views and structures built by filters (e.g. KD-trees or rasters).
+static const uint64_t JOB_MEMORY_OVERHEAD_PER_POINT = 64;
+
+// Estimates how much memory a non-streaming pipeline needs per point read from the given file
+// (point size in the point table is based on the dimensions the reader provides)
+static uint64_t estimateMemoryPerPoint(const std::string &inputFile)
+{
+    QuickInfo qi = getQuickInfo(inputFile);
+    if (!qi.valid())
+        return 0;
+
+    PointLayout layout;
+    uint64_t extraDimsSize = 0;
+    for (const std::string &dimName : qi.m_dimNames)
+    {
+        Dimension::Id id = Dimension::id(dimName);
+        if (id == Dimension::Id::Unknown)
+            extraDimsSize += sizeof(double);  // extra bytes dimensions - we do not know their type here
+        else
+            layout.registerDim(id);
+    }
+    layout.finalize();
+    return layout.pointSize() + extraDimsSize + JOB_MEMORY_OVERHEAD_PER_POINT;
+}
+
+
 bool runAlg(std::vector<std::string> args, Alg &alg)
 {
 
@@ -37,13 +66,16 @@ bool runAlg(std::vector<std::string> args, Alg &alg)
         return false;
     }
 
+    std::string sampleInputFile;  // file used to estimate memory needed per point
     if (alg.hasSingleInput)
     {
+        sampleInputFile = alg.inputFile;
         if (isVpcFilename(alg.inputFile))
         {
             VirtualPointCloud vpc;
             if (!vpc.read(alg.inputFile))
                 return false;
+            sampleInputFile = vpc.files.empty() ? std::string() : vpc.files[0].filename;
             alg.totalPoints = vpc.totalPoints();
             alg.bounds = vpc.box3d();
             if (!alg.needsSingleCrs)
@@ -64,18 +96,54 @@ bool runAlg(std::vector<std::string> args, Alg &alg)
         }
     }
 
+    // runAlg() may be nested (e.g. merge falls back to running another algorithm in finalize()),
+    // the profile gets started and written only by the outermost run
+    static int sRunDepth = 0;
+    struct RunDepth
+    {
+        RunDepth() { ++sRunDepth; }
+        ~RunDepth() { --sRunDepth; }
+    } runDepth;
+    bool outermostRun = sRunDepth == 1;
+
+    if (outermostRun && !alg.profileFile.empty())
+        profileInit(alg.profileFile);
+
     std::vector<std::unique_ptr<PipelineManager>> pipelines;
 
-    alg.preparePipelines(pipelines);
+    {
+        ProfileScope profileScope("preparePipelines");
+        alg.preparePipelines(pipelines);
+    }
 
-    if (pipelines.empty())
+    if (pipelines.empty() && !alg.outputWithoutPipelines)
         return false;
 
-    runPipelineParallel(alg.totalPoints, alg.isStreaming, pipelines, alg.max_threads, alg.verbose);
+    for (size_t i = 0; i < pipelines.size(); ++i)
+        profileAttach(pipelines[i].get(), "job " + std::to_string(i));
 
-    alg.finalize(pipelines);
+    if (!pipelines.empty())
+    {
+        uint64_t memoryPerPoint = 0;
+        if (alg.memoryLimitBytes && !alg.isStreaming && !sampleInputFile.empty())
+            memoryPerPoint = estimateMemoryPerPoint(sampleInputFile);
 
-    return true;
+        runPipelineParallel(alg.totalPoints, alg.isStreaming, pipelines, alg.max_threads, alg.verbose, alg.pipelineCosts, alg.progressJson,
+                            [&alg](size_t i) { alg.jobFinished(i); }, alg.memoryLimitBytes, memoryPerPoint);
+    }
+
+    {
+        ProfileScope profileScope("finalize");
+        alg.finalize(pipelines);
+    }
+
+    for (size_t i = 0; i < pipelines.size(); ++i)
+        profileDetach(pipelines[i].get());
+
+    if (outermostRun && !profileWrite())
+        return false;
+
+    return !alg.finalizeFailed;
 }
 
 
@@ -96,6 +164,9 @@ bool Alg::parseArgs(std::vector<std::string> args)
     pdal::Arg& argThreads = programArgs.add("threads", "Max number of concurrent threads for parallel runs", max_threads);
 
     programArgs.add("verbose", "Print extra debugging output", verbose);
+    programArgs.add("progress-json", "Write progress of parallel jobs as JSON lines to stderr", progressJson);
+    programArgs.add("profile", "Write timing profile of pipeline stages and other steps to a JSON file (Chrome trace format)", profileFile);
+    programArgs.add("memory-limit", "Limit of memory for jobs running at once in non-streaming mode (e.g. 512M or 16G)", memoryLimit);
 
     try
     {
@@ -127,6 +198,12 @@ bool Alg::parseArgs(std::vector<std::string> args)
         }
     }
 
+    if (!memoryLimit.empty() && !parseMemorySize(memoryLimit, memoryLimitBytes))
+    {
+        std::cerr << "invalid memory limit: " << memoryLimit << std::endl;
+        return false;
+    }
+
     if (!checkArgs())  // impl in derived class
         return false;
 
@@ -18,6 +18,7 @@
 #include <pdal/util/ProgramArgs.hpp>
 
 #include "utils.hpp"
+#include "raster_grid.hpp"
 
 using namespace pdal;
 
@@ -52,7 +53,19 @@ struct Alg
 
     bool verbose = false;        // write extra debugging output from the algorithm
 
+    bool progressJson = false;   // write progress of jobs as JSON lines to stderr
+
+    std::string profileFile;     // if set, timing profile of the run gets written to this file (see profile.hpp)
+
+    std::string memoryLimit;        // optional limit of memory for non-streaming jobs running at once (e.g. "16G")
+    uint64_t memoryLimitBytes = 0;  // parsed memoryLimit (zero if not set)
+
     point_count_t totalPoints = 0;   // calculated number of points from the input data
+    std::vector<point_count_t> pipelineCosts;  // optional estimated cost (number of points) of each pipeline
+                                               // from preparePipelines() - most expensive pipelines are run first
+    bool outputWithoutPipelines = false;  // set by preparePipelines() if there are no pipelines to run
+                                          // and finalize() writes the output directly
+    bool finalizeFailed = false;  // set by finalize() if the output could not be written
     BOX3D bounds;                    // calculated 3D bounding box from the input data
     SpatialReference crs;            // CRS of the input data (only valid when needsSingleCrs==true)
 
@@ -87,6 +100,12 @@ struct Alg
      * Runs and post-processing code when pipelines are done executing.
      */
     virtual void finalize(std::vector<std::unique_ptr<PipelineManager>>& pipelines) { ( void )pipelines; };
+    /**
+     * Called from a worker thread when a pipeline has finished executing, while other pipelines
+     * may be still running. Algorithms can use it to start processing of outputs of jobs early
+     * (e.g. feed them to an OutputConsumer), so that less work is left for finalize().
+     */
+    virtual void jobFinished(size_t pipelineIndex) { ( void )pipelineIndex; };
 };
 
 bool runAlg(std::vector<std::string> args, Alg &alg);
@@ -148,7 +167,8 @@ struct Density : public Alg
     pdal::Arg* argTileOriginX = nullptr;
     pdal::Arg* argTileOriginY = nullptr;
 
-    std::vector<std::string> tileOutputFiles;
+    // output raster that jobs write to
+    std::unique_ptr<RasterMosaic> mosaic;
 
     // impl
     virtual void addArgs() override;
@@ -158,6 +178,7 @@ struct Density : public Alg
 
     // new
     std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile = nullptr) const;
+    bool openMosaic(const BOX2D &gridBounds, bool sumValues);
 };
 
 
@@ -218,12 +239,21 @@ struct Merge : public Alg
     // args - initialized in addArgs()
     pdal::Arg* argOutput = nullptr;
 
+    std::vector<std::string> tileOutputFiles;  // inputs converted by their own jobs, put together in finalize()
+
+    // whether inputs may be put together without a merge pipeline (disabled by buildOutput() when that failed already)
+    bool directOutput = true;
+
+    // set by preparePipelines() if the output gets written directly from the inputs in finalize()
+    bool concatenateInputs = false;
+
     Merge() { hasSingleInput = false; }
 
     // impl
     virtual void addArgs() override;
     virtual bool checkArgs() override;
     virtual void preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipelines) override;
+    virtual void finalize(std::vector<std::unique_ptr<PipelineManager>>& pipelines) override;
 
 };
 
@@ -275,13 +305,17 @@ struct ToRaster : public Alg
     pdal::Arg* argTileOriginX = nullptr;
     pdal::Arg* argTileOriginY = nullptr;
 
-    std::vector<std::string> tileOutputFiles;
+    // output raster that jobs write to
+    std::unique_ptr<RasterMosaic> mosaic;
 
     // impl
     virtual void addArgs() override;
     virtual bool checkArgs() override;
     virtual void preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipelines) override;
     virtual void finalize(std::vector<std::unique_ptr<PipelineManager>>& pipelines) override;
+
+    // new
+    bool openMosaic(const BOX2D &gridBounds);
 };
 
 
@@ -328,11 +362,20 @@ struct ToVector : public Alg
 
     std::vector<std::string> tileOutputFiles;
 
+    // appends outputs of finished jobs to the output file
+    std::unique_ptr<OutputConsumer> outputAppender;
+    GDALDatasetH outputDs = nullptr;   // output file (once the first job output is appended)
+    std::string outputLayerName;       // layer of the output file that job outputs get appended to
+
     // impl
     virtual void addArgs() override;
     virtual bool checkArgs() override;
     virtual void preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipelines) override;
     virtual void finalize(std::vector<std::unique_ptr<PipelineManager>>& pipelines) override;
+    virtual void jobFinished(size_t pipelineIndex) override;
+
+    // new
+    bool appendToOutput(const std::string &tileOutputFile);
 };
 
 
@@ -350,6 +393,9 @@ struct ClassifyGround : public Alg
     double threshold = 0.5;
     double windowSize = 18.0;
 
+    // tiling setup for parallel runs (only used if tile size is set)
+    CollarTiling tiling;
+
     // args - initialized in addArgs()
     pdal::Arg* argOutput = nullptr;
     pdal::Arg* argOutputFormatVpc = nullptr;
@@ -391,6 +437,9 @@ struct FilterNoise: public Alg
     int statisticalMeanK = 8;
     double statisticalMultiplier = 2.0;
 
+    // tiling setup for parallel runs (only used if tile size is set)
+    CollarTiling tiling;
+
     // args - initialized in addArgs()
     pdal::Arg* argOutput = nullptr;
     pdal::Arg* argOutputFormatVpc = nullptr;
@@ -425,6 +474,9 @@ struct HeightAboveGround : public Alg
     
     // Delaunay parameters
     int delaunayCount = 10;
+
+    // tiling setup for parallel runs (only used if tile size is set)
+    CollarTiling tiling;
     
     // args - initialized in addArgs()
     pdal::Arg* argOutput = nullptr;
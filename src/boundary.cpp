@@ -84,14 +84,14 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double r
         else
         {
             // Reader can't do the filtering - do it with a filter
-            last = &manager->makeFilter( "filters.crop", *last, filter_opts);
+            last = &makeFilter(manager.get(), "filters.crop", *last, filter_opts);
         }
     }
     if (!tile->filterExpression.empty())
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", tile->filterExpression));
-        last = &manager->makeFilter( "filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
     // TODO: what edge size? (by default samples 5000 points if not specified
@@ -104,7 +104,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double r
        hexbin_opts.add(pdal::Option("edge_size", resolution));
     }
     hexbin_opts.add(pdal::Option("threshold", pointsThreshold));
-    (void)manager->makeFilter( "filters.hexbin", *last, hexbin_opts );
+    (void)makeFilter(manager.get(), "filters.hexbin", *last, hexbin_opts );
 
     return manager;
 }
@@ -122,6 +122,7 @@ void Boundary::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
         {
             ParallelJobInfo tile(ParallelJobInfo::FileBased, BOX2D(), filterExpression, filterBounds);
             tile.inputFilenames.push_back(f.filename);
+            pipelineCosts.push_back(f.count);
             pipelines.push_back(pipeline(&tile, resolution, pointsThreshold));
         }
     }
@@ -42,6 +42,7 @@ void ClassifyGround::addArgs()
     argSlope = &programArgs.add("slope", "Controls how much terrain slope is tolerated as ground. Increase for steep terrain.", slope, 0.15);
     argThreshold = &programArgs.add("threshold", " Elevation threshold for separating ground from objects. Higher values allow larger deviations from ground.", threshold, 0.5);
     argWindowSize = &programArgs.add("window-size", "The maximum filter window size. Increase to better identify large buildings or objects, decrease to protect smaller features.", windowSize, 18.0);
+    tiling.addArgs(programArgs);
 }
 
 bool ClassifyGround::checkArgs()
@@ -61,6 +62,9 @@ bool ClassifyGround::checkArgs()
         }
     }
     
+    if (!tiling.checkArgs())
+        return false;
+
     if ( isVpcFilename(outputFile) && outputFormatVpc == "copc" )
     {
         isStreaming = false;
@@ -69,29 +73,37 @@ bool ClassifyGround::checkArgs()
     return true;
 }
 
-static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, pdal::Options &filterOptions)
+static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, pdal::Options &filterOptions, double collarSize)
 {
     std::unique_ptr<PipelineManager> manager( new PipelineManager );
 
-    Stage& r = makeReader(manager.get(), tile->inputFilenames[0]);
-
-    Stage *last = &r;
-
-    // filtering
-    if (!tile->filterBounds.empty())
+    Stage *last = nullptr;
+    if (tile->mode == ParallelJobInfo::Spatial)
     {
-        Options filter_opts;
-        filter_opts.add(pdal::Option("bounds", tile->filterBounds));
+        last = &makeTileReaders(manager.get(), *tile, collarSize);
+    }
+    else
+    {
+        Stage& r = makeReader(manager.get(), tile->inputFilenames[0]);
 
-        if (readerSupportsBounds(r))
-        {
-            // Reader of the format can do the filtering - use that whenever possible!
-            r.addOptions(filter_opts);
-        }
-        else
+        last = &r;
+
+        // filtering
+        if (!tile->filterBounds.empty())
         {
-            // Reader can't do the filtering - do it with a filter
-            last = &manager->makeFilter( "filters.crop", *last, filter_opts);
+            Options filter_opts;
+            filter_opts.add(pdal::Option("bounds", tile->filterBounds));
+
+            if (readerSupportsBounds(r))
+            {
+                // Reader of the format can do the filtering - use that whenever possible!
+                r.addOptions(filter_opts);
+            }
+            else
+            {
+                // Reader can't do the filtering - do it with a filter
+                last = &makeFilter(manager.get(), "filters.crop", *last, filter_opts);
+            }
         }
     }
 
@@ -99,11 +111,19 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, pdal::Op
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", tile->filterExpression));
-        last = &manager->makeFilter( "filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
-    last = &manager->makeFilter( "filters.smrf", *last, filterOptions);
+    last = &makeFilter(manager.get(), "filters.smrf", *last, filterOptions);
  
+    if (!tile->tileCoreExpression.empty())
+    {
+        // only write points of the tile, not of its collar
+        Options filter_opts;
+        filter_opts.add(pdal::Option("expression", tile->tileCoreExpression));
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
+    }
+
     makeWriter(manager.get(), tile->outputFilename, last);
 
     return manager;
@@ -120,7 +140,14 @@ void ClassifyGround::preparePipelines(std::vector<std::unique_ptr<PipelineManage
     filterOptions.add(pdal::Option("window", windowSize));
     
 
-    if (isVpcFilename(inputFile))
+    if (tiling.isUsed(inputFile))
+    {
+        // spatial processing in tiles: each job also reads points in a collar around its tile
+        // to avoid edge effects, but it only writes points of the tile itself
+        for (ParallelJobInfo &tile : tiling.jobs(*this, outputFile, outputFormatVpc, tileOutputFiles))
+            pipelines.push_back(pipeline(&tile, filterOptions, tiling.collarSize));
+    }
+    else if (isVpcFilename(inputFile))
     {
         // for /tmp/hello.vpc we will use /tmp/hello dir for all results
         fs::path outputParentDir = fs::path(outputFile).parent_path();
@@ -141,7 +168,8 @@ void ClassifyGround::preparePipelines(std::vector<std::unique_ptr<PipelineManage
 
             tileOutputFiles.push_back(tile.outputFilename);
 
-            pipelines.push_back(pipeline(&tile, filterOptions));
+            pipelineCosts.push_back(f.count);
+            pipelines.push_back(pipeline(&tile, filterOptions, tiling.collarSize));
         }
     }
     else
@@ -150,7 +178,7 @@ void ClassifyGround::preparePipelines(std::vector<std::unique_ptr<PipelineManage
         tile.inputFilenames.push_back(inputFile);
         tile.outputFilename = outputFile;
 
-        pipelines.push_back(pipeline(&tile, filterOptions));
+        pipelines.push_back(pipeline(&tile, filterOptions, tiling.collarSize));
     }
 }
 
@@ -159,5 +187,5 @@ void ClassifyGround::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
     if (tileOutputFiles.empty())
         return;
 
-    buildOutput(outputFile, tileOutputFiles);
+    buildOutput(outputFile, tileOutputFiles, max_threads);
 }
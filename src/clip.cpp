@@ -119,7 +119,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, const pd
 
     std::unique_ptr<PipelineManager> manager( new PipelineManager );
 
-    Stage& r = makeReader(manager.get(), tile->inputFilenames[0]);
+    Stage& r = makeReader(manager.get(), tile->inputFilenames[0], pointRangeReaderOptions(*tile));
 
     Stage *last = &r;
 
@@ -137,17 +137,17 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, const pd
         else
         {
             // Reader can't do the filtering - do it with a filter
-            last = &manager->makeFilter( "filters.crop", *last, filter_opts);
+            last = &makeFilter(manager.get(), "filters.crop", *last, filter_opts);
         }
     }
     if (!tile->filterExpression.empty())
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", tile->filterExpression));
-        last = &manager->makeFilter( "filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
-    last = &manager->makeFilter( "filters.crop", *last, crop_opts );
+    last = &makeFilter(manager.get(), "filters.crop", *last, crop_opts );
 
     makeWriter(manager.get(), tile->outputFilename, last);
 
@@ -194,11 +194,40 @@ void Clip::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipel
 
             tileOutputFiles.push_back(tile.outputFilename);
 
+            pipelineCosts.push_back(f.count);
             pipelines.push_back(pipeline(&tile, crop_opts));
         }
     }
     else
     {
+        std::vector<std::pair<point_count_t, point_count_t>> ranges = pointRanges(inputFile, totalPoints, max_threads);
+        if (!ranges.empty())
+        {
+            // single input LAS/LAZ split into ranges of points processed in parallel,
+            // the outputs get merged at the end the same way as with VPC input
+
+            // for /tmp/hello.laz we will use /tmp/hello dir for all results
+            fs::path outputParentDir = fs::path(outputFile).parent_path();
+            fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
+            fs::create_directories(outputSubdir);
+
+            for (size_t i = 0; i < ranges.size(); ++i)
+            {
+                ParallelJobInfo tile(ParallelJobInfo::PointRange, BOX2D(), filterExpression, filterBounds);
+                tile.inputFilenames.push_back(inputFile);
+                tile.pointStart = ranges[i].first;
+                tile.pointCount = ranges[i].second;
+
+                std::string rangeName = fileStem(inputFile).string() + "_" + std::to_string(i);
+                tile.outputFilename = tileOutputFileName(outputFile, outputFormatVpc, outputSubdir, rangeName);
+
+                tileOutputFiles.push_back(tile.outputFilename);
+
+                pipelines.push_back(pipeline(&tile, crop_opts));
+            }
+            return;
+        }
+
         if (ends_with(outputFile, ".copc.laz"))
         {
             isStreaming = false;
@@ -215,5 +244,5 @@ void Clip::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
     if (tileOutputFiles.empty())
         return;
 
-    buildOutput(outputFile, tileOutputFiles);
+    buildOutput(outputFile, tileOutputFiles, max_threads);
 }
@@ -0,0 +1,1133 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include "copc_builder.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <pdal/PipelineManager.hpp>
+#include <pdal/PointTable.hpp>
+#include <pdal/util/ThreadPool.hpp>
+
+#include "las_header.hpp"
+#include "laz_chunk_table.hpp"
+#include "profile.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+#define COPC_CELL_BITS              7       // nodes are sampled on a grid of 128x128x128 cells
+#define COPC_MAX_DEPTH              20      // max depth of buckets and of octree nodes that are not too dense
+#define COPC_KEY_DEPTH              30      // depth of cells computed for each point (max depth of octree nodes)
+#define COPC_MAX_NODE_POINTS        50000   // a node must fit into a single LAZ chunk written by writers.las
+#define COPC_MAX_BUCKET_POINTS      2000000 // max number of points of a bucket that get loaded in memory at once
+#define COPC_MAX_BUCKET_DEPTH       5       // max depth of initial buckets (larger buckets are split later)
+#define COPC_READ_POINTS            1000000 // inputs are read in parts of this many points
+
+#define COPC_BUFFER_SIZE            (1024 * 1024)       // records of a single cell are buffered up to this size
+#define COPC_MAX_BUFFERED           (64 * 1024 * 1024)  // max size of buffered records of all cells (per thread)
+#define COPC_READ_BLOCK_POINTS      65536               // records are read from files in blocks of this many points
+#define COPC_MAX_OPEN_FILES         256                 // max number of cell files kept open (per set of cells)
+
+#define COPC_VLR_SIZE               160
+#define VLR_HEADER_SIZE             54
+#define EVLR_HEADER_SIZE            60
+#define LAS_GLOBAL_ENCODING_WKT     0x10
+
+
+namespace
+{
+
+/**
+ * Key of an octree node (or of a cell of the grid at a given depth).
+ */
+struct VoxelKey
+{
+    int32_t d = 0, x = 0, y = 0, z = 0;
+
+    VoxelKey() = default;
+    VoxelKey(int32_t d_, int32_t x_, int32_t y_, int32_t z_) : d(d_), x(x_), y(y_), z(z_) {}
+
+    // returns key of the cell at a lower depth that contains this cell
+    VoxelKey atDepth(int32_t depth) const
+    {
+        int32_t shift = d - depth;
+        return VoxelKey(depth, x >> shift, y >> shift, z >> shift);
+    }
+
+    std::string name() const
+    {
+        return std::to_string(d) + "-" + std::to_string(x) + "-" + std::to_string(y) + "-" + std::to_string(z);
+    }
+
+    bool operator==(const VoxelKey &other) const
+    {
+        return d == other.d && x == other.x && y == other.y && z == other.z;
+    }
+
+    bool operator<(const VoxelKey &other) const
+    {
+        return std::tie(d, x, y, z) < std::tie(other.d, other.x, other.y, other.z);
+    }
+};
+
+struct VoxelKeyHash
+{
+    size_t operator()(const VoxelKey &k) const
+    {
+        uint64_t h = ((uint64_t)(uint32_t)k.x << 32) | (uint32_t)k.y;
+        h ^= (((uint64_t)(uint32_t)k.z << 8) | (uint32_t)k.d) * 0x9E3779B97F4A7C15ULL;
+        return std::hash<uint64_t>()(h);
+    }
+};
+
+
+/**
+ * Point records of cells of the octree stored in files in a temporary directory.
+ * Appending to the files is thread-safe: each cell has its own lock, so that different
+ * cells can be written in parallel, and files stay open between appends (up to a limit).
+ */
+class CellFiles
+{
+public:
+    CellFiles(const fs::path &dir, const std::string &prefix) : m_dir(dir), m_prefix(prefix) {}
+
+    std::string filename(const VoxelKey &key) const
+    {
+        return (m_dir / (m_prefix + key.name() + ".bin")).string();
+    }
+
+    bool append(const VoxelKey &key, const char *data, size_t size)
+    {
+        Cell &c = cell(key);
+        std::lock_guard<std::mutex> lock(c.mutex);
+        if (!c.file.is_open())
+        {
+            // do not run out of file handles with many cells - only the recently used ones are kept open
+            if (!closeIdleFiles())
+                return false;
+
+            c.file.open(filename(key), std::ios::binary | std::ios::app);
+            if (!c.file.is_open())
+            {
+                std::cerr << "Failed to open " << filename(key) << std::endl;
+                return false;
+            }
+            std::lock_guard<std::mutex> lruLock(m_lruMutex);
+            m_lru.push_front({ key, &c });
+            c.lruPos = m_lru.begin();
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lruLock(m_lruMutex);
+            m_lru.splice(m_lru.begin(), m_lru, c.lruPos);
+        }
+
+        if (!c.file.write(data, size))
+        {
+            std::cerr << "Failed to write " << filename(key) << std::endl;
+            return false;
+        }
+        c.size += size;
+        return true;
+    }
+
+    bool read(const VoxelKey &key, std::vector<char> &data)
+    {
+        Cell *c = find(key);
+        if (!c)
+        {
+            data.clear();
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(c->mutex);
+        if (!closeFile(*c))
+        {
+            std::cerr << "Failed to write " << filename(key) << std::endl;
+            return false;
+        }
+        data.resize(c->size);
+        if (data.empty())
+            return true;
+        std::ifstream f(filename(key), std::ios::binary);
+        if (!f.read(data.data(), data.size()))
+        {
+            std::cerr << "Failed to read " << filename(key) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool replace(const VoxelKey &key, const std::vector<char> &data)
+    {
+        Cell &c = cell(key);
+        std::lock_guard<std::mutex> lock(c.mutex);
+        closeFile(c);
+        std::ofstream f(filename(key), std::ios::binary | std::ios::trunc);
+        if (!f.write(data.data(), data.size()))
+        {
+            std::cerr << "Failed to write " << filename(key) << std::endl;
+            return false;
+        }
+        c.size = data.size();
+        return true;
+    }
+
+    // must not be called while other threads use the cell
+    void remove(const VoxelKey &key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_cells.find(key);
+        if (it != m_cells.end())
+        {
+            {
+                std::lock_guard<std::mutex> cellLock(it->second->mutex);
+                closeFile(*it->second);
+            }
+            m_cells.erase(it);
+        }
+        std::error_code ec;
+        fs::remove(filename(key), ec);
+    }
+
+    // closes all files, so that they can be read directly or removed, returns false if the pending writes failed
+    bool close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool ok = true;
+        for (auto &c : m_cells)
+        {
+            std::lock_guard<std::mutex> cellLock(c.second->mutex);
+            if (!closeFile(*c.second))
+            {
+                std::cerr << "Failed to write " << filename(c.first) << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    bool contains(const VoxelKey &key) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_cells.count(key) != 0;
+    }
+
+    uint64_t size(const VoxelKey &key)
+    {
+        Cell *c = find(key);
+        if (!c)
+            return 0;
+        std::lock_guard<std::mutex> lock(c->mutex);
+        return c->size;
+    }
+
+    // sizes of all cells (should not be called while the files are being written)
+    std::map<VoxelKey, uint64_t> sizes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::map<VoxelKey, uint64_t> res;
+        for (const auto &c : m_cells)
+            res[c.first] = c.second->size;
+        return res;
+    }
+
+private:
+    struct Cell
+    {
+        std::mutex mutex;
+        std::ofstream file;    // open while records are being appended
+        uint64_t size = 0;
+        std::list<std::pair<VoxelKey, Cell*>>::iterator lruPos;  // position in m_lru while the file is open
+    };
+
+    Cell &cell(const VoxelKey &key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::unique_ptr<Cell> &c = m_cells[key];
+        if (!c)
+            c.reset(new Cell);
+        return *c;
+    }
+
+    Cell *find(const VoxelKey &key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_cells.find(key);
+        return it == m_cells.end() ? nullptr : it->second.get();
+    }
+
+    // closes file of the cell if it is open (the mutex of the cell needs to be locked),
+    // returns false if the pending writes failed
+    bool closeFile(Cell &c)
+    {
+        if (!c.file.is_open())
+            return true;
+        c.file.close();
+        {
+            std::lock_guard<std::mutex> lruLock(m_lruMutex);
+            m_lru.erase(c.lruPos);
+        }
+        return !c.file.fail();
+    }
+
+    // Closes the least recently used files of cells that are not being used by other threads
+    // until there is room for another open file. Returns false if the pending writes failed.
+    // Cells are locked with try_lock, so this can be called with the mutex of another cell locked.
+    bool closeIdleFiles()
+    {
+        std::lock_guard<std::mutex> lruLock(m_lruMutex);
+        bool ok = true;
+        auto it = m_lru.end();
+        while (m_lru.size() >= COPC_MAX_OPEN_FILES && it != m_lru.begin())
+        {
+            --it;
+            Cell &idle = *it->second;
+            std::unique_lock<std::mutex> cellLock(idle.mutex, std::try_to_lock);
+            if (!cellLock.owns_lock())
+                continue;  // the cell is being used right now
+            idle.file.close();
+            if (idle.file.fail())
+            {
+                std::cerr << "Failed to write " << filename(it->first) << std::endl;
+                ok = false;
+            }
+            it = m_lru.erase(it);
+        }
+        return ok;
+    }
+
+    fs::path m_dir;
+    std::string m_prefix;
+    mutable std::mutex m_mutex;    // guards the map of cells (not the cells themselves)
+    std::map<VoxelKey, std::unique_ptr<Cell>> m_cells;
+
+    // cells with open files, the most recently used at the front. Locked after the mutex of a cell
+    // when a file gets opened or closed.
+    std::mutex m_lruMutex;
+    std::list<std::pair<VoxelKey, Cell*>> m_lru;
+};
+
+
+/**
+ * Buffers point records of cells before they are appended to cell files,
+ * so that the files are written in larger blocks. Used by a single thread.
+ */
+class CellBuffers
+{
+public:
+    explicit CellBuffers(CellFiles &files) : m_files(files) {}
+
+    bool add(const VoxelKey &key, const char *record, size_t size)
+    {
+        std::vector<char> &buffer = m_buffers[key];
+        buffer.insert(buffer.end(), record, record + size);
+        m_total += size;
+        if (buffer.size() >= COPC_BUFFER_SIZE)
+        {
+            m_total -= buffer.size();
+            bool ok = m_files.append(key, buffer.data(), buffer.size());
+            m_buffers.erase(key);
+            return ok;
+        }
+        if (m_total >= COPC_MAX_BUFFERED)
+            return flush();
+        return true;
+    }
+
+    bool flush()
+    {
+        bool ok = true;
+        for (auto &b : m_buffers)
+            ok = m_files.append(b.first, b.second.data(), b.second.size()) && ok;
+        m_buffers.clear();
+        m_total = 0;
+        return ok;
+    }
+
+private:
+    CellFiles &m_files;
+    std::unordered_map<VoxelKey, std::vector<char>, VoxelKeyHash> m_buffers;
+    size_t m_total = 0;
+};
+
+
+/**
+ * Runs tasks (returning false on error) in a thread pool, returns false if any of them failed.
+ */
+template<typename F>
+bool runTasks(size_t count, int numThreads, F task)
+{
+    std::atomic<bool> ok(true);
+    pdal::ThreadPool pool((std::max)(1, (std::min)(numThreads, (int)count)));
+    for (size_t i = 0; i < count; ++i)
+    {
+        pool.add([&ok, &task, i]()
+        {
+            if (ok && !task(i))
+                ok = false;
+        });
+    }
+    pool.join();
+    return ok;
+}
+
+template<typename T>
+void appendValue(std::vector<char> &data, T value)
+{
+    const char *ptr = (const char*)&value;
+    data.insert(data.end(), ptr, ptr + sizeof(T));
+}
+
+void appendString(std::vector<char> &data, const std::string &str, size_t size)
+{
+    std::vector<char> padded(size, 0);
+    std::memcpy(padded.data(), str.data(), (std::min)(size, str.size()));
+    data.insert(data.end(), padded.begin(), padded.end());
+}
+
+
+class CopcBuilder
+{
+public:
+    CopcBuilder(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads)
+        : m_inputFiles(inputFiles), m_outputFile(outputFile), m_numThreads(numThreads),
+          m_tempDir(outputFile + ".tmp"), m_buckets(m_tempDir, "b-"), m_candidates(m_tempDir, "a-")
+    {
+    }
+
+    bool build()
+    {
+        if (!init())
+            return false;
+
+        std::error_code ec;
+        fs::create_directories(m_tempDir, ec);
+        if (ec)
+        {
+            std::cerr << "Failed to create directory " << m_tempDir << ": " << ec.message() << std::endl;
+            return false;
+        }
+
+        bool ok = bucketInputs() && splitLargeBuckets() && sampleAncestors() && buildAncestors() && buildBuckets() && writeOutput();
+
+        m_buckets.close();
+        m_candidates.close();
+        fs::remove_all(m_tempDir, ec);
+        return ok;
+    }
+
+private:
+    bool init();
+    bool bucketInputs();
+    bool splitLargeBuckets();
+    bool sampleAncestors();
+    bool buildAncestors();
+    bool buildBuckets();
+    bool writeOutput();
+
+    VoxelKey pointKey(const char *record) const;
+    void sampleNode(const VoxelKey &key, const std::vector<char> &records, std::vector<char> &selected, std::vector<char> &rest) const;
+    bool buildSubtree(const VoxelKey &key, std::vector<char> &records);
+    bool writeNode(const VoxelKey &key, const std::vector<char> &records);
+    bool compressNode(const std::string &lasFile, const std::string &lazFile) const;
+
+    struct Node
+    {
+        std::string filename;   // compressed LAZ file with the points of the node
+        uint64_t pointCount;
+    };
+
+    std::vector<std::string> m_inputFiles;
+    std::string m_outputFile;
+    int m_numThreads;
+    fs::path m_tempDir;
+
+    std::vector<LasHeader> m_inputHeaders;
+    LasHeader m_header;            // merged header of inputs
+    size_t m_recordLength = 0;
+    int m_copcFormat = 0;          // point format of the output (6, 7 or 8)
+    int m_gpsTimeOffset = -1;      // offset of GPS time in point records (-1 if there's no GPS time)
+
+    double m_center[3];
+    double m_halfSize = 0;
+    double m_cubeMin[3];
+    double m_cubeSize = 0;
+
+    std::mutex m_mutex;
+    double m_gpsTimeMin = std::numeric_limits<double>::max();
+    double m_gpsTimeMax = std::numeric_limits<double>::lowest();
+    std::map<VoxelKey, Node> m_nodes;
+
+    CellFiles m_buckets;           // points of cells whose subtrees get built independently
+    CellFiles m_candidates;        // points sampled for nodes above the buckets
+    std::set<VoxelKey> m_ancestors;
+};
+
+
+bool CopcBuilder::init()
+{
+    if (!canConcatenateLasFiles(m_inputFiles, false))
+        return false;
+
+    m_inputHeaders.resize(m_inputFiles.size());
+    for (size_t i = 0; i < m_inputFiles.size(); ++i)
+    {
+        if (!m_inputHeaders[i].read(m_inputFiles[i]))
+            return false;
+    }
+    m_header = mergeLasHeaders(m_inputHeaders);
+    m_recordLength = m_header.pointRecordLength;
+    if (m_header.pointCount == 0 || m_recordLength < 12)
+        return false;
+
+    // COPC only supports point formats 6, 7 and 8 - older formats get converted by writers.las
+    int format = m_header.pointFormat & 0x3f;
+    if (format == 0 || format == 1 || format == 6)
+        m_copcFormat = 6;
+    else if (format == 2 || format == 3 || format == 7)
+        m_copcFormat = 7;
+    else if (format == 8)
+        m_copcFormat = 8;
+    else
+        return false;   // formats with waveforms
+
+    if (format == 1 || format == 3)
+        m_gpsTimeOffset = 20;
+    else if (format >= 6)
+        m_gpsTimeOffset = 22;
+
+    // the octree is a cube around the bounds of points
+    for (int i = 0; i < 3; ++i)
+    {
+        m_center[i] = (m_header.minimum[i] + m_header.maximum[i]) / 2;
+        m_halfSize = (std::max)(m_halfSize, (m_header.maximum[i] - m_header.minimum[i]) / 2);
+    }
+    m_halfSize = (std::max)(m_halfSize, *std::max_element(m_header.scale, m_header.scale + 3));
+    for (int i = 0; i < 3; ++i)
+        m_cubeMin[i] = m_center[i] - m_halfSize;
+    m_cubeSize = m_halfSize * 2;
+
+    return true;
+}
+
+
+VoxelKey CopcBuilder::pointKey(const char *record) const
+{
+    const double cells = (double)(1 << COPC_KEY_DEPTH);
+    int32_t coords[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        int32_t raw;
+        std::memcpy(&raw, record + 4 * i, 4);
+        double v = raw * m_header.scale[i] + m_header.offset[i];
+        double c = std::floor((v - m_cubeMin[i]) / m_cubeSize * cells);
+        coords[i] = (int32_t)(std::min)((std::max)(c, 0.0), cells - 1);
+    }
+    return VoxelKey(COPC_KEY_DEPTH, coords[0], coords[1], coords[2]);
+}
+
+
+bool CopcBuilder::bucketInputs()
+{
+    ProfileScope profileScope("copc: bucketing");
+
+    // depth of buckets such that they would not be too large for a surface-like point cloud
+    int depth = 0;
+    while (depth < COPC_MAX_BUCKET_DEPTH && (m_header.pointCount >> (2 * depth)) > COPC_MAX_BUCKET_POINTS / 4)
+        ++depth;
+
+    // inputs are read in parts in parallel
+    struct Part
+    {
+        size_t file;
+        uint64_t start, count;
+    };
+    std::vector<Part> parts;
+    for (size_t i = 0; i < m_inputHeaders.size(); ++i)
+    {
+        for (uint64_t start = 0; start < m_inputHeaders[i].pointCount; start += COPC_READ_POINTS)
+            parts.push_back({i, start, (std::min)((uint64_t)COPC_READ_POINTS, m_inputHeaders[i].pointCount - start)});
+    }
+
+    return runTasks(parts.size(), m_numThreads, [this, &parts, depth](size_t i)
+    {
+        const Part &part = parts[i];
+        std::ifstream f(m_inputFiles[part.file], std::ios::binary);
+        if (!f.seekg(m_inputHeaders[part.file].pointOffset + part.start * m_recordLength))
+            return false;
+
+        CellBuffers buffers(m_buckets);
+        double gpsTimeMin = std::numeric_limits<double>::max();
+        double gpsTimeMax = std::numeric_limits<double>::lowest();
+        std::vector<char> block;
+        for (uint64_t done = 0; done < part.count; )
+        {
+            size_t count = (size_t)(std::min)((uint64_t)COPC_READ_BLOCK_POINTS, part.count - done);
+            block.resize(count * m_recordLength);
+            if (!f.read(block.data(), block.size()))
+            {
+                std::cerr << "Failed to read " << m_inputFiles[part.file] << std::endl;
+                return false;
+            }
+            for (size_t j = 0; j < count; ++j)
+            {
+                const char *record = block.data() + j * m_recordLength;
+                if (!buffers.add(pointKey(record).atDepth(depth), record, m_recordLength))
+                    return false;
+                if (m_gpsTimeOffset >= 0)
+                {
+                    double t;
+                    std::memcpy(&t, record + m_gpsTimeOffset, 8);
+                    gpsTimeMin = (std::min)(gpsTimeMin, t);
+                    gpsTimeMax = (std::max)(gpsTimeMax, t);
+                }
+            }
+            done += count;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_gpsTimeMin = (std::min)(m_gpsTimeMin, gpsTimeMin);
+            m_gpsTimeMax = (std::max)(m_gpsTimeMax, gpsTimeMax);
+        }
+        return buffers.flush();
+    });
+}
+
+
+bool CopcBuilder::splitLargeBuckets()
+{
+    ProfileScope profileScope("copc: splitting buckets");
+
+    // buckets that would not fit in memory get split into their child cells until they are small enough
+    // (unless they are at the max. depth already - e.g. when there are many points at the same location)
+    for (;;)
+    {
+        std::vector<VoxelKey> largeBuckets;
+        for (const auto &b : m_buckets.sizes())
+        {
+            if (b.second / m_recordLength > COPC_MAX_BUCKET_POINTS && b.first.d < COPC_MAX_DEPTH)
+                largeBuckets.push_back(b.first);
+        }
+        if (largeBuckets.empty())
+            return true;
+        if (!m_buckets.close())
+            return false;
+
+        bool ok = runTasks(largeBuckets.size(), m_numThreads, [this, &largeBuckets](size_t i)
+        {
+            const VoxelKey &key = largeBuckets[i];
+            std::ifstream f(m_buckets.filename(key), std::ios::binary);
+            uint64_t count = m_buckets.size(key) / m_recordLength;
+
+            CellBuffers buffers(m_buckets);
+            std::vector<char> block;
+            for (uint64_t done = 0; done < count; )
+            {
+                size_t blockCount = (size_t)(std::min)((uint64_t)COPC_READ_BLOCK_POINTS, count - done);
+                block.resize(blockCount * m_recordLength);
+                if (!f.read(block.data(), block.size()))
+                {
+                    std::cerr << "Failed to read " << m_buckets.filename(key) << std::endl;
+                    return false;
+                }
+                for (size_t j = 0; j < blockCount; ++j)
+                {
+                    const char *record = block.data() + j * m_recordLength;
+                    if (!buffers.add(pointKey(record).atDepth(key.d + 1), record, m_recordLength))
+                        return false;
+                }
+                done += blockCount;
+            }
+            f.close();
+
+            if (!buffers.flush())
+                return false;
+            m_buckets.remove(key);
+            return true;
+        });
+        if (!ok)
+            return false;
+    }
+}
+
+
+bool CopcBuilder::sampleAncestors()
+{
+    ProfileScope profileScope("copc: sampling");
+
+    std::vector<VoxelKey> buckets;
+    for (const auto &b : m_buckets.sizes())
+    {
+        buckets.push_back(b.first);
+        for (int32_t d = 0; d < b.first.d; ++d)
+            m_ancestors.insert(b.first.atDepth(d));
+    }
+
+    // each bucket contributes points to nodes above it: one point for each cell of the sampling grid
+    // of those nodes, starting from the root node - remaining points stay in the bucket
+    return runTasks(buckets.size(), m_numThreads, [this, &buckets](size_t i)
+    {
+        const VoxelKey &bucket = buckets[i];
+        if (bucket.d == 0)
+            return true;
+
+        std::vector<char> records, remaining;
+        if (!m_buckets.read(bucket, records))
+            return false;
+
+        CellBuffers buffers(m_candidates);
+        std::unordered_set<VoxelKey, VoxelKeyHash> usedCells;
+        size_t count = records.size() / m_recordLength;
+        for (size_t j = 0; j < count; ++j)
+        {
+            const char *record = records.data() + j * m_recordLength;
+            VoxelKey key = pointKey(record);
+            bool used = false;
+            for (int32_t d = 0; d < bucket.d && !used; ++d)
+            {
+                if (usedCells.insert(key.atDepth(d + COPC_CELL_BITS)).second)
+                {
+                    if (!buffers.add(key.atDepth(d), record, m_recordLength))
+                        return false;
+                    used = true;
+                }
+            }
+            if (!used)
+                remaining.insert(remaining.end(), record, record + m_recordLength);
+        }
+
+        return buffers.flush() && m_buckets.replace(bucket, remaining);
+    });
+}
+
+
+void CopcBuilder::sampleNode(const VoxelKey &key, const std::vector<char> &records, std::vector<char> &selected, std::vector<char> &rest) const
+{
+    // pick the first point in each cell of the sampling grid of the node
+    int32_t gridDepth = (std::min)(key.d + COPC_CELL_BITS, COPC_KEY_DEPTH);
+    size_t count = records.size() / m_recordLength;
+    std::unordered_set<VoxelKey, VoxelKeyHash> usedCells;
+    std::vector<size_t> picked;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (usedCells.insert(pointKey(records.data() + i * m_recordLength).atDepth(gridDepth)).second)
+            picked.push_back(i);
+    }
+
+    // if there are too many of them, keep an evenly spread subset
+    if (picked.size() > COPC_MAX_NODE_POINTS)
+    {
+        std::vector<size_t> subset(COPC_MAX_NODE_POINTS);
+        for (size_t i = 0; i < subset.size(); ++i)
+            subset[i] = picked[i * picked.size() / COPC_MAX_NODE_POINTS];
+        picked.swap(subset);
+    }
+
+    std::vector<bool> isPicked(count, false);
+    for (size_t i : picked)
+        isPicked[i] = true;
+
+    // nodes this deep only get points of dense clusters (e.g. many points at the same location) that
+    // the grid would not thin out, so they are filled up to the limit to keep the clusters in fewer levels
+    if (key.d >= COPC_MAX_DEPTH)
+    {
+        for (size_t i = 0; i < count && picked.size() < COPC_MAX_NODE_POINTS; ++i)
+        {
+            if (!isPicked[i])
+            {
+                isPicked[i] = true;
+                picked.push_back(i);
+            }
+        }
+    }
+
+    selected.clear();
+    rest.clear();
+    selected.reserve(picked.size() * m_recordLength);
+    rest.reserve(records.size() - picked.size() * m_recordLength);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char *record = records.data() + i * m_recordLength;
+        std::vector<char> &target = isPicked[i] ? selected : rest;
+        target.insert(target.end(), record, record + m_recordLength);
+    }
+}
+
+
+bool CopcBuilder::buildAncestors()
+{
+    ProfileScope profileScope("copc: building upper levels");
+
+    std::map<int32_t, std::vector<VoxelKey>> levels;
+    for (const VoxelKey &key : m_ancestors)
+        levels[key.d].push_back(key);
+
+    // nodes are built from the top: points that were not used by a node go to its child
+    // (which is either another node above the buckets, or a bucket)
+    for (const auto &level : levels)
+    {
+        const std::vector<VoxelKey> &keys = level.second;
+        bool ok = runTasks(keys.size(), m_numThreads, [this, &keys](size_t i)
+        {
+            const VoxelKey &key = keys[i];
+            std::vector<char> records, selected, rest;
+            if (!m_candidates.read(key, records))
+                return false;
+            sampleNode(key, records, selected, rest);
+            records.clear();
+            m_candidates.remove(key);
+
+            if (!writeNode(key, selected))
+                return false;
+
+            CellBuffers candidateBuffers(m_candidates), bucketBuffers(m_buckets);
+            size_t count = rest.size() / m_recordLength;
+            for (size_t j = 0; j < count; ++j)
+            {
+                const char *record = rest.data() + j * m_recordLength;
+                VoxelKey child = pointKey(record).atDepth(key.d + 1);
+                bool added;
+                if (m_ancestors.count(child))
+                    added = candidateBuffers.add(child, record, m_recordLength);
+                else if (m_buckets.contains(child))
+                    added = bucketBuffers.add(child, record, m_recordLength);
+                else
+                {
+                    std::cerr << "No bucket for cell " << child.name() << std::endl;
+                    added = false;
+                }
+                if (!added)
+                    return false;
+            }
+            return candidateBuffers.flush() && bucketBuffers.flush();
+        });
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+
+bool CopcBuilder::buildBuckets()
+{
+    ProfileScope profileScope("copc: building buckets");
+
+    std::vector<VoxelKey> buckets;
+    for (const auto &b : m_buckets.sizes())
+        buckets.push_back(b.first);
+
+    return runTasks(buckets.size(), m_numThreads, [this, &buckets](size_t i)
+    {
+        std::vector<char> records;
+        if (!m_buckets.read(buckets[i], records))
+            return false;
+        m_buckets.remove(buckets[i]);
+        return buildSubtree(buckets[i], records);
+    });
+}
+
+
+bool CopcBuilder::buildSubtree(const VoxelKey &key, std::vector<char> &records)
+{
+    // nodes get split until they are small enough: usually that happens above COPC_MAX_DEPTH,
+    // but dense clusters of points go deeper, so that each node still fits into a single chunk
+    if (records.size() / m_recordLength <= COPC_MAX_NODE_POINTS || key.d >= COPC_KEY_DEPTH)
+        return writeNode(key, records);
+
+    std::vector<char> selected, rest;
+    sampleNode(key, records, selected, rest);
+    std::vector<char>().swap(records);
+
+    if (!writeNode(key, selected))
+        return false;
+    std::vector<char>().swap(selected);
+
+    std::map<VoxelKey, std::vector<char>> children;
+    size_t count = rest.size() / m_recordLength;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char *record = rest.data() + i * m_recordLength;
+        std::vector<char> &child = children[pointKey(record).atDepth(key.d + 1)];
+        child.insert(child.end(), record, record + m_recordLength);
+    }
+    std::vector<char>().swap(rest);
+
+    for (auto &child : children)
+    {
+        if (!buildSubtree(child.first, child.second))
+            return false;
+        std::vector<char>().swap(child.second);
+    }
+    return true;
+}
+
+
+bool CopcBuilder::writeNode(const VoxelKey &key, const std::vector<char> &records)
+{
+    uint64_t count = records.size() / m_recordLength;
+    if (count == 0)
+        return true;
+    if (count > COPC_MAX_NODE_POINTS)
+    {
+        std::cerr << "Too many points at the same location in octree node " << key.name() << std::endl;
+        return false;
+    }
+
+    // write the points as a LAS file with the same header as the inputs
+    LasHeader header = m_header;
+    header.pointCount = count;
+    std::fill(header.pointsByReturn, header.pointsByReturn + 15, 0);
+    for (int i = 0; i < 3; ++i)
+    {
+        header.minimum[i] = std::numeric_limits<double>::max();
+        header.maximum[i] = std::numeric_limits<double>::lowest();
+    }
+    for (size_t j = 0; j < count; ++j)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            int32_t raw;
+            std::memcpy(&raw, records.data() + j * m_recordLength + 4 * i, 4);
+            double v = raw * header.scale[i] + header.offset[i];
+            header.minimum[i] = (std::min)(header.minimum[i], v);
+            header.maximum[i] = (std::max)(header.maximum[i], v);
+        }
+    }
+
+    std::string lasFile = (m_tempDir / ("n-" + key.name() + ".las")).string();
+    std::string lazFile = (m_tempDir / ("n-" + key.name() + ".laz")).string();
+    {
+        std::ofstream f(lasFile, std::ios::binary | std::ios::trunc);
+        std::vector<char> rawHeader = header.updatedRawHeader();
+        if (!f.write(rawHeader.data(), rawHeader.size()) || !f.write(header.rawVlrs.data(), header.rawVlrs.size()) ||
+            !f.write(records.data(), records.size()))
+        {
+            std::cerr << "Failed to write " << lasFile << std::endl;
+            return false;
+        }
+    }
+
+    bool ok = compressNode(lasFile, lazFile);
+    std::error_code ec;
+    fs::remove(lasFile, ec);
+    if (!ok)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_nodes[key] = Node{ lazFile, count };
+    return true;
+}
+
+
+bool CopcBuilder::compressNode(const std::string &lasFile, const std::string &lazFile) const
+{
+    // writers.las does the compression and the conversion to COPC point format (and to WKT for CRS)
+    std::unique_ptr<PipelineManager> manager( new PipelineManager );
+    {
+        // stages are created one at a time, only the execution runs in parallel
+        std::lock_guard<std::mutex> lock(stageCreationMutex());
+
+        Stage &reader = makeReader(manager.get(), lasFile);
+
+        // not using makeWriter() - there is a pipeline for each node, these should not be profiled
+        pdal::Options writer_opts;
+        writer_opts.add(pdal::Option("forward", "all"));
+        writer_opts.add(pdal::Option("extra_dims", "all"));
+        writer_opts.add(pdal::Option("minor_version", 4));
+        writer_opts.add(pdal::Option("dataformat_id", m_copcFormat));
+        manager->makeWriter(lazFile, "writers.las", reader, writer_opts);
+    }
+
+    try
+    {
+        pdal::FixedPointTable table(10000);
+        manager->executeStream(table);
+    }
+    catch (const pdal::pdal_error &e)
+    {
+        std::cerr << "Failed to compress " << lasFile << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool CopcBuilder::writeOutput()
+{
+    ProfileScope profileScope("copc: writing output");
+
+    // compressed nodes are put together like in concatenateLazFiles(), but each node must be a single chunk
+    std::vector<std::string> nodeFiles;
+    for (const auto &n : m_nodes)
+        nodeFiles.push_back(n.second.filename);
+    if (nodeFiles.empty() || !canConcatenateLasFiles(nodeFiles, true))
+        return false;
+
+    std::vector<LasHeader> headers(nodeFiles.size());
+    std::vector<LazChunk> chunks;
+    for (size_t i = 0; i < nodeFiles.size(); ++i)
+    {
+        std::vector<LazChunk> nodeChunks;
+        if (!headers[i].read(nodeFiles[i]) || !readLazChunks(nodeFiles[i], headers[i], nodeChunks) || nodeChunks.size() != 1)
+        {
+            std::cerr << "Unexpected chunks in compressed node " << nodeFiles[i] << std::endl;
+            return false;
+        }
+        chunks.push_back(nodeChunks[0]);
+    }
+
+    LasHeader output = mergeLasHeaders(headers);
+    if (output.versionMinor != 4 || output.headerSize != 375 || !output.setVariableChunkSize())
+        return false;
+
+    // layout of the file: header, COPC info VLR (must be the first one), other VLRs, offset of chunk table,
+    // chunks, chunk table, EVLR with COPC hierarchy
+    output.vlrCount += 1;
+    output.pointOffset += VLR_HEADER_SIZE + COPC_VLR_SIZE;
+    output.globalEncoding |= LAS_GLOBAL_ENCODING_WKT;
+
+    std::vector<uint64_t> chunkOffsets(chunks.size());
+    uint64_t offset = output.pointOffset + 8;
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        chunkOffsets[i] = offset;
+        offset += chunks[i].byteSize;
+    }
+    std::vector<char> table = encodeLazChunkTable(chunks);
+    uint64_t tableOffset = offset;
+    output.evlrOffset = tableOffset + table.size();
+    output.evlrCount = 1;
+
+    // hierarchy has entries for all nodes with points and also for empty nodes above them
+    struct Entry
+    {
+        uint64_t offset = 0;
+        int32_t byteSize = 0;
+        int32_t pointCount = 0;
+    };
+    std::map<VoxelKey, Entry> entries;
+    size_t index = 0;
+    for (const auto &n : m_nodes)
+    {
+        Entry &e = entries[n.first];
+        e.offset = chunkOffsets[index];
+        e.byteSize = (int32_t)chunks[index].byteSize;
+        e.pointCount = (int32_t)n.second.pointCount;
+        for (int32_t d = 0; d < n.first.d; ++d)
+            entries[n.first.atDepth(d)];
+        ++index;
+    }
+    std::vector<char> hierarchy;
+    for (const auto &e : entries)
+    {
+        appendValue<int32_t>(hierarchy, e.first.d);
+        appendValue<int32_t>(hierarchy, e.first.x);
+        appendValue<int32_t>(hierarchy, e.first.y);
+        appendValue<int32_t>(hierarchy, e.first.z);
+        appendValue<uint64_t>(hierarchy, e.second.offset);
+        appendValue<int32_t>(hierarchy, e.second.byteSize);
+        appendValue<int32_t>(hierarchy, e.second.pointCount);
+    }
+
+    std::vector<char> evlr;
+    appendValue<uint16_t>(evlr, 0);
+    appendString(evlr, "copc", 16);
+    appendValue<uint16_t>(evlr, 1000);
+    appendValue<uint64_t>(evlr, hierarchy.size());
+    appendString(evlr, "EPT hierarchy", 32);
+    evlr.insert(evlr.end(), hierarchy.begin(), hierarchy.end());
+
+    std::vector<char> copcVlr;
+    appendValue<uint16_t>(copcVlr, 0);
+    appendString(copcVlr, "copc", 16);
+    appendValue<uint16_t>(copcVlr, 1);
+    appendValue<uint16_t>(copcVlr, COPC_VLR_SIZE);
+    appendString(copcVlr, "COPC info", 32);
+    for (int i = 0; i < 3; ++i)
+        appendValue<double>(copcVlr, m_center[i]);
+    appendValue<double>(copcVlr, m_halfSize);
+    appendValue<double>(copcVlr, m_cubeSize / (1 << COPC_CELL_BITS));     // spacing of points in the root node
+    appendValue<uint64_t>(copcVlr, output.evlrOffset + EVLR_HEADER_SIZE);  // root hierarchy page
+    appendValue<uint64_t>(copcVlr, hierarchy.size());
+    appendValue<double>(copcVlr, m_gpsTimeOffset >= 0 ? m_gpsTimeMin : 0);
+    appendValue<double>(copcVlr, m_gpsTimeOffset >= 0 ? m_gpsTimeMax : 0);
+    copcVlr.resize(VLR_HEADER_SIZE + COPC_VLR_SIZE, 0);   // reserved
+    output.rawVlrs.insert(output.rawVlrs.begin(), copcVlr.begin(), copcVlr.end());
+
+    {
+        std::ofstream out(m_outputFile, std::ios::binary | std::ios::trunc);
+        std::vector<char> rawHeader = output.updatedRawHeader();
+        int64_t tableOffsetValue = (int64_t)tableOffset;
+        out.write(rawHeader.data(), rawHeader.size());
+        out.write(output.rawVlrs.data(), output.rawVlrs.size());
+        out.write((const char*)&tableOffsetValue, 8);
+        if (!out.flush())
+        {
+            std::cerr << "Failed to write " << m_outputFile << std::endl;
+            return false;
+        }
+    }
+
+    // space for the chunks is allocated, then chunk table and hierarchy get appended
+    std::error_code ec;
+    fs::resize_file(m_outputFile, tableOffset, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to write " << m_outputFile << ": " << ec.message() << std::endl;
+        return false;
+    }
+    {
+        std::ofstream out(m_outputFile, std::ios::binary | std::ios::app);
+        out.write(table.data(), table.size());
+        out.write(evlr.data(), evlr.size());
+        if (!out.flush())
+        {
+            std::cerr << "Failed to write " << m_outputFile << std::endl;
+            return false;
+        }
+    }
+
+    // compressed chunks are copied to their place in the output file in parallel
+    return runTasks(nodeFiles.size(), m_numThreads, [&](size_t i)
+    {
+        return copyFileRange(nodeFiles[i], headers[i].pointOffset + 8, m_outputFile, chunkOffsets[i], chunks[i].byteSize);
+    });
+}
+
+}  // namespace
+
+
+bool buildCopcFromLasFiles(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads)
+{
+    ProfileScope profileScope("buildCopcFromLasFiles");
+
+    CopcBuilder builder(inputFiles, outputFile, numThreads);
+    return builder.build();
+}
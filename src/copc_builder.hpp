@@ -0,0 +1,36 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * Builds a COPC file from uncompressed LAS files that have the same point format, scale, offset
+ * and VLRs (e.g. outputs of parallel jobs), without loading the whole point cloud into memory
+ * like writers.copc does:
+ *
+ * 1. point records are distributed to bucket files on disk by their octree cell - buckets that are
+ *    too large to be loaded in memory get split into their child cells
+ * 2. points for octree nodes above the buckets are sampled from the buckets (in parallel),
+ *    then those nodes are built from top to bottom, pushing unused points down to their children
+ * 3. octree under each bucket is built in parallel, with each node sampled on a grid of cells
+ *    and the rest of the points going to its children, until nodes are small enough
+ * 4. each node gets compressed to a single LAZ chunk by writers.las as soon as it is built,
+ *    and at the end the chunks are put together into the output file with COPC hierarchy
+ *
+ * Only a limited number of points is kept in memory by each thread. Temporary files are written
+ * to a directory next to the output file. Returns false if the inputs are not suitable
+ * (then nothing is written) or if there was an error.
+ */
+bool buildCopcFromLasFiles(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads);
@@ -21,6 +21,7 @@
 #include "utils.hpp"
 #include "alg.hpp"
 #include "vpc.hpp"
+#include "raster_grid.hpp"
 
 using namespace pdal;
 
@@ -70,7 +71,9 @@ std::unique_ptr<PipelineManager> Density::pipeline(ParallelJobInfo *tile) const
     std::vector<Stage*> readers;
     for (const std::string &f : tile->inputFilenames)
     {
-        readers.push_back(&manager->makeReader(f, ""));
+        Stage *reader = &manager->makeReader(f, "");
+        reader->addOptions(pointRangeReaderOptions(*tile));
+        readers.push_back(reader);
     }
 
     std::vector<Stage*> last = readers;
@@ -92,7 +95,7 @@ std::unique_ptr<PipelineManager> Density::pipeline(ParallelJobInfo *tile) const
             {
                 // add "bounds" option to reader
                 pdal::Options copc_opts;
-                copc_opts.add(pdal::Option("threads", 1));
+                copc_opts.add(pdal::Option("threads", tile->readerThreads));
                 copc_opts.add(pdal::Option("bounds", box_to_pdal_bounds(box)));
                 reader->addOptions(copc_opts);
             }
@@ -122,31 +125,8 @@ std::unique_ptr<PipelineManager> Density::pipeline(ParallelJobInfo *tile) const
         last.push_back(filterExpr);
     }
 
-    pdal::Options writer_opts;
-    writer_opts.add(pdal::Option("binmode", true));
-    writer_opts.add(pdal::Option("output_type", "count"));
-    writer_opts.add(pdal::Option("resolution", resolution));
-
-    writer_opts.add(pdal::Option("data_type", "int16"));  // 16k points in a cell should be enough? :)
-    writer_opts.add(pdal::Option("gdalopts", "TILED=YES"));
-    writer_opts.add(pdal::Option("gdalopts", "COMPRESS=DEFLATE"));
-
-    if (box.valid())
-    {
-        BOX2D box2 = box;
-        // fix tile size - PDAL's writers.gdal adds one pixel (see GDALWriter::createGrid()),
-        // because it probably expects that that the bounds and resolution do not perfectly match
-        box2.maxx -= resolution;
-        box2.maxy -= resolution;
-
-        writer_opts.add(pdal::Option("bounds", box_to_pdal_bounds(box2)));
-    }
-
-    // TODO: "writers.gdal: Requested driver 'COG' does not support file creation.""
-    //   writer_opts.add(pdal::Option("gdaldriver", "COG"));
-
-    pdal::StageCreationOptions opts{ tile->outputFilename, "", nullptr, writer_opts, "" };
-    Stage& w = manager->makeWriter( opts );
+    // bin points directly into our part of the output raster
+    Stage& w = makeGridWriter(manager.get(), mosaic.get(), box, GridOutputType::Count);
     for (Stage *stage : last)
         w.setInput(*stage);
 
@@ -156,6 +136,18 @@ std::unique_ptr<PipelineManager> Density::pipeline(ParallelJobInfo *tile) const
 
 void Density::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipelines)
 {
+    // tile jobs - their pipelines get created at the end, once we know how many jobs there are
+    std::vector<ParallelJobInfo> tiles;
+
+    // points are binned by the jobs directly into the output raster (see raster_grid.hpp),
+    // with the raster grid aligned to the tile origin
+
+    // TODO: optionally adjust origin to have nicer numbers for bounds?
+    if (tileAlignment.originX == -1)
+        tileAlignment.originX = bounds.minx;
+    if (tileAlignment.originY == -1)
+        tileAlignment.originY = bounds.miny;
+
     if (isVpcFilename(inputFile))
     {
         // using spatial processing
@@ -164,19 +156,8 @@ void Density::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pi
         if (!vpc.read(inputFile))
             return;
 
-        // for /tmp/hello.tif we will use /tmp/hello dir for all results
-        fs::path outputParentDir = fs::path(outputFile).parent_path();
-        fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
-        fs::create_directories(outputSubdir);
-
         bool unalignedFiles = false;
 
-        // TODO: optionally adjust origin to have nicer numbers for bounds?
-        if (tileAlignment.originX == -1)
-            tileAlignment.originX = bounds.minx;
-        if (tileAlignment.originY == -1)
-            tileAlignment.originY = bounds.miny;
-
         // align bounding box of data to the grid
         TileAlignment gridAlignment = tileAlignment;
         gridAlignment.tileSize = resolution;
@@ -184,6 +165,9 @@ void Density::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pi
         std::cout << "grid " << gridTiling.tileCountX << "x" << gridTiling.tileCountY << std::endl;
         BOX2D gridBounds = gridTiling.fullBox();
 
+        if (!openMosaic(gridBounds, false))
+            return;
+
         Tiling t = tileAlignment.coverBounds(gridBounds);
         std::cout << "tiles " << t.tileCountX << " " << t.tileCountY << std::endl;
 
@@ -192,11 +176,12 @@ void Density::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pi
         {
             for (int ix = 0; ix < t.tileCountX; ++ix)
             {
-                BOX2D tileBox = t.boxAt(ix, iy);
-
                 // for tiles that are smaller than full box - only use intersection
-                // to avoid empty areas in resulting rasters
-                tileBox.clip(gridBounds);
+                // to avoid empty areas in resulting rasters (tiles also need to be aligned
+                // to cells of the raster in case tile size is not a multiple of resolution)
+                BOX2D tileBox = mosaic->snapToGrid(t.boxAt(ix, iy));
+                if (tileBox.minx >= tileBox.maxx || tileBox.miny >= tileBox.maxy)
+                    continue;
 
                 if (!filterBounds.empty() && !intersectionBox2D(tileBox, parseBounds(filterBounds).to2d()).valid())
                 {
@@ -206,8 +191,9 @@ void Density::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pi
                 }
 
                 ParallelJobInfo tile(ParallelJobInfo::Spatial, tileBox, filterExpression, filterBounds);
-                for (const VirtualPointCloud::File & f: vpc.overlappingBox2D(tileBox))
+                for (size_t fileIndex : vpc.overlappingBox2D(tileBox))
                 {
+                    const VirtualPointCloud::File &f = vpc.files[fileIndex];
                     tile.inputFilenames.push_back(f.filename);
                     totalPoints += f.count;
                 }
@@ -217,15 +203,8 @@ void Density::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pi
                 if (tile.inputFilenames.size() > 1)
                     unalignedFiles = true;
 
-                // create temp output file names
-                // for tile (x=2,y=3) that goes to /tmp/hello.tif,
-                // individual output file will be called /tmp/hello/2_3.tif
-                fs::path inputBasename = std::to_string(ix) + "_" + std::to_string(iy);
-                tile.outputFilename = (outputSubdir / inputBasename).string() + ".tif";
-
-                tileOutputFiles.push_back(tile.outputFilename);
-
-                pipelines.push_back(pipeline(&tile));
+                pipelineCosts.push_back(vpc.estimatedPointCount(tileBox));
+                tiles.push_back(tile);
             }
         }
 
@@ -241,23 +220,18 @@ void Density::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pi
     {
         // using square tiles for single COPC
 
-        // for /tmp/hello.tif we will use /tmp/hello dir for all results
-        fs::path outputParentDir = fs::path(outputFile).parent_path();
-        fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
-        fs::create_directories(outputSubdir);
-
-        if (tileAlignment.originX == -1)
-            tileAlignment.originX = bounds.minx;
-        if (tileAlignment.originY == -1)
-            tileAlignment.originY = bounds.miny;
-
         Tiling t = tileAlignment.coverBounds(bounds.to2d());
 
+        if (!openMosaic(t.fullBox(), false))
+            return;
+
         for (int iy = 0; iy < t.tileCountY; ++iy)
         {
             for (int ix = 0; ix < t.tileCountX; ++ix)
             {
-                BOX2D tileBox = t.boxAt(ix, iy);
+                BOX2D tileBox = mosaic->snapToGrid(t.boxAt(ix, iy));
+                if (tileBox.minx >= tileBox.maxx || tileBox.miny >= tileBox.maxy)
+                    continue;
 
                 if (!filterBounds.empty() && !intersectionBox2D(tileBox, parseBounds(filterBounds).to2d()).valid())
                 {
@@ -269,40 +243,80 @@ void Density::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pi
                 ParallelJobInfo tile(ParallelJobInfo::Spatial, tileBox, filterExpression, filterBounds);
                 tile.inputFilenames.push_back(inputFile);
 
-                // create temp output file names
-                // for tile (x=2,y=3) that goes to /tmp/hello.tif,
-                // individual output file will be called /tmp/hello/2_3.tif
-                fs::path inputBasename = std::to_string(ix) + "_" + std::to_string(iy);
-                tile.outputFilename = (outputSubdir / inputBasename).string() + ".tif";
-
-                tileOutputFiles.push_back(tile.outputFilename);
-
-                pipelines.push_back(pipeline(&tile));
+                tiles.push_back(tile);
             }
         }
     }
     else
     {
-        // single input LAS/LAZ - no parallelism
+        // all jobs need to use exactly the same grid
+        TileAlignment gridAlignment = tileAlignment;
+        gridAlignment.tileSize = resolution;
+        BOX2D dataBounds = bounds.to2d();
+        if (!filterBounds.empty())
+            dataBounds = intersectionBox2D(dataBounds, parseBounds(filterBounds).to2d());
+        BOX2D gridBounds = gridAlignment.coverBounds(dataBounds.valid() ? dataBounds : bounds.to2d()).fullBox();
+
+        std::vector<std::pair<point_count_t, point_count_t>> ranges = pointRanges(inputFile, totalPoints, max_threads);
+        if (!ranges.empty())
+        {
+            // single input LAS/LAZ split into ranges of points - each job bins points
+            // into the whole grid, and the counts get summed up in the output raster
+
+            if (!openMosaic(gridBounds, true))
+                return;
+
+            for (size_t i = 0; i < ranges.size(); ++i)
+            {
+                ParallelJobInfo tile(ParallelJobInfo::PointRange, gridBounds, filterExpression, filterBounds);
+                tile.inputFilenames.push_back(inputFile);
+                tile.pointStart = ranges[i].first;
+                tile.pointCount = ranges[i].second;
+                tiles.push_back(tile);
+            }
+        }
+        else
+        {
+            // single input LAS/LAZ - no parallelism
+
+            if (!openMosaic(gridBounds, false))
+                return;
 
-        ParallelJobInfo tile(ParallelJobInfo::Single, BOX2D(), filterExpression, filterBounds);
-        tile.inputFilenames.push_back(inputFile);
-        tile.outputFilename = outputFile;
+            ParallelJobInfo tile(ParallelJobInfo::Single, BOX2D(), filterExpression, filterBounds);
+            tile.inputFilenames.push_back(inputFile);
+            pipelines.push_back(pipeline(&tile));
+        }
+    }
+
+    // with only a few tiles (e.g. when "bounds" selects a small area), readers of each job
+    // get more threads to decompress data, so that the other threads are not left idle
+    int readerThreads = readerThreadsPerJob(tiles.size(), max_threads);
+    for (ParallelJobInfo &tile : tiles)
+    {
+        tile.readerThreads = readerThreads;
         pipelines.push_back(pipeline(&tile));
     }
+}
+
 
+bool Density::openMosaic(const BOX2D &gridBounds, bool sumValues)
+{
+    // 16k points in a cell should be enough? :)
+    mosaic.reset(new RasterMosaic(gridBounds, resolution, GDT_Int16, -9999, sumValues));
+    if (!mosaic->open(outputFile, crs.getWKT()))
+    {
+        mosaic.reset();
+        return false;
+    }
+    return true;
 }
 
 
 void Density::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
 {
-    if (!tileOutputFiles.empty())
+    if (mosaic)
     {
-        rasterTilesToCog(tileOutputFiles, outputFile);
-
-        // clean up the temporary directory
-        fs::path outputParentDir = fs::path(outputFile).parent_path();
-        fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
-        fs::remove_all(outputSubdir);
+        mosaic->finish(max_threads);
+        mosaic.reset();
     }
 }
@@ -46,6 +46,7 @@ void FilterNoise::addArgs()
     // statistical args
     argStatisticalMeanK = &programArgs.add("statistical-mean-k", "Mean number of neighbors (statistical method only)", statisticalMeanK, 8);
     argStatisticalMultiplier = &programArgs.add("statistical-multiplier", "Standard deviation threshold (statistical method only).", statisticalMultiplier, 2.0);
+    tiling.addArgs(programArgs);
 }
 
 bool FilterNoise::checkArgs()
@@ -65,6 +66,9 @@ bool FilterNoise::checkArgs()
         }
     }
 
+    if (!tiling.checkArgs())
+        return false;
+
     if ( isVpcFilename(outputFile) && outputFormatVpc == "copc" )
     {
         isStreaming = false;
@@ -100,29 +104,37 @@ bool FilterNoise::checkArgs()
 }
 
 
-static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, pdal::Options &noiseFilterOptions, bool removeNoisePoints)
+static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, pdal::Options &noiseFilterOptions, bool removeNoisePoints, double collarSize)
 {
     std::unique_ptr<PipelineManager> manager( new PipelineManager );
 
-    Stage& r = makeReader(manager.get(), tile->inputFilenames[0]);
-
-    Stage *last = &r;
-
-    // filtering
-    if (!tile->filterBounds.empty())
+    Stage *last = nullptr;
+    if (tile->mode == ParallelJobInfo::Spatial)
     {
-        Options filter_opts;
-        filter_opts.add(pdal::Option("bounds", tile->filterBounds));
+        last = &makeTileReaders(manager.get(), *tile, collarSize);
+    }
+    else
+    {
+        Stage& r = makeReader(manager.get(), tile->inputFilenames[0]);
 
-        if (readerSupportsBounds(r))
-        {
-            // Reader of the format can do the filtering - use that whenever possible!
-            r.addOptions(filter_opts);
-        }
-        else
+        last = &r;
+
+        // filtering
+        if (!tile->filterBounds.empty())
         {
-            // Reader can't do the filtering - do it with a filter
-            last = &manager->makeFilter("filters.crop", *last, filter_opts);
+            Options filter_opts;
+            filter_opts.add(pdal::Option("bounds", tile->filterBounds));
+
+            if (readerSupportsBounds(r))
+            {
+                // Reader of the format can do the filtering - use that whenever possible!
+                r.addOptions(filter_opts);
+            }
+            else
+            {
+                // Reader can't do the filtering - do it with a filter
+                last = &makeFilter(manager.get(), "filters.crop", *last, filter_opts);
+            }
         }
     }
 
@@ -130,18 +142,26 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, pdal::Op
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", tile->filterExpression));
-        last = &manager->makeFilter("filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
-    last = &manager->makeFilter("filters.outlier", *last, noiseFilterOptions);
+    last = &makeFilter(manager.get(), "filters.outlier", *last, noiseFilterOptions);
 
     if (removeNoisePoints)
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", "Classification != 7"));
-        last = &manager->makeFilter( "filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
  
+    if (!tile->tileCoreExpression.empty())
+    {
+        // only write points of the tile, not of its collar
+        Options filter_opts;
+        filter_opts.add(pdal::Option("expression", tile->tileCoreExpression));
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
+    }
+
     makeWriter(manager.get(), tile->outputFilename, last);
 
     return manager;
@@ -163,7 +183,14 @@ void FilterNoise::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>
         noiseFilterOptions.add(pdal::Option("multiplier", statisticalMultiplier));
     }
 
-    if (isVpcFilename(inputFile))
+    if (tiling.isUsed(inputFile))
+    {
+        // spatial processing in tiles: each job also reads points in a collar around its tile
+        // to avoid edge effects, but it only writes points of the tile itself
+        for (ParallelJobInfo &tile : tiling.jobs(*this, outputFile, outputFormatVpc, tileOutputFiles))
+            pipelines.push_back(pipeline(&tile, noiseFilterOptions, removeNoisePoints, tiling.collarSize));
+    }
+    else if (isVpcFilename(inputFile))
     {
         // for /tmp/hello.vpc we will use /tmp/hello dir for all results
         fs::path outputParentDir = fs::path(outputFile).parent_path();
@@ -184,7 +211,8 @@ void FilterNoise::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>
 
             tileOutputFiles.push_back(tile.outputFilename);
 
-            pipelines.push_back(pipeline(&tile, noiseFilterOptions, removeNoisePoints));
+            pipelineCosts.push_back(f.count);
+            pipelines.push_back(pipeline(&tile, noiseFilterOptions, removeNoisePoints, tiling.collarSize));
         }
     }
     else
@@ -193,7 +221,7 @@ void FilterNoise::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>
         tile.inputFilenames.push_back(inputFile);
         tile.outputFilename = outputFile;
 
-        pipelines.push_back(pipeline(&tile, noiseFilterOptions, removeNoisePoints));
+        pipelines.push_back(pipeline(&tile, noiseFilterOptions, removeNoisePoints, tiling.collarSize));
     }
 }
 
@@ -202,5 +230,5 @@ void FilterNoise::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
     if (tileOutputFiles.empty())
         return;
 
-    buildOutput(outputFile, tileOutputFiles);
+    buildOutput(outputFile, tileOutputFiles, max_threads);
 }
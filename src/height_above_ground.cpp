@@ -45,6 +45,7 @@ void HeightAboveGround::addArgs()
 
     // args - Delaunay
     argDelaunayCount = &programArgs.add("delaunay-count", "The number of ground neighbors to consider when determining the height above ground for a non-ground point.", delaunayCount, 10);
+    tiling.addArgs(programArgs);
 }
 
 bool HeightAboveGround::checkArgs()
@@ -64,6 +65,9 @@ bool HeightAboveGround::checkArgs()
         }
     }
 
+    if (!tiling.checkArgs())
+        return false;
+
     if ( isVpcFilename(outputFile) && outputFormatVpc == "copc" )
     {
         isStreaming = false;
@@ -97,31 +101,39 @@ bool HeightAboveGround::checkArgs()
 }
 
 
-static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::string algorithm, bool replaceZWithHeightAboveGround, int nnCount, double nnMaxDistance, int delaunayCount)
+static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::string algorithm, bool replaceZWithHeightAboveGround, int nnCount, double nnMaxDistance, int delaunayCount, double collarSize)
 {
     std::unique_ptr<PipelineManager> manager( new PipelineManager );
 
-    Options reader_opts;
-
-    Stage& r = makeReader( manager.get(), tile->inputFilenames[0], reader_opts );
+    Stage *last = nullptr;
+    if (tile->mode == ParallelJobInfo::Spatial)
+    {
+        last = &makeTileReaders(manager.get(), *tile, collarSize);
+    }
+    else
+    {
+        Options reader_opts;
 
-    Stage *last = &r;
+        Stage& r = makeReader( manager.get(), tile->inputFilenames[0], reader_opts );
 
-    // filtering
-    if (!tile->filterBounds.empty())
-    {
-        Options filter_opts;
-        filter_opts.add(pdal::Option("bounds", tile->filterBounds));
+        last = &r;
 
-        if (readerSupportsBounds(r))
+        // filtering
+        if (!tile->filterBounds.empty())
         {
-            // Reader of the format can do the filtering - use that whenever possible!
-            r.addOptions(filter_opts);
-        }
-        else
-        {
-            // Reader can't do the filtering - do it with a filter
-            last = &manager->makeFilter( "filters.crop", *last, filter_opts);
+            Options filter_opts;
+            filter_opts.add(pdal::Option("bounds", tile->filterBounds));
+
+            if (readerSupportsBounds(r))
+            {
+                // Reader of the format can do the filtering - use that whenever possible!
+                r.addOptions(filter_opts);
+            }
+            else
+            {
+                // Reader can't do the filtering - do it with a filter
+                last = &makeFilter(manager.get(), "filters.crop", *last, filter_opts);
+            }
         }
     }
 
@@ -129,7 +141,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", tile->filterExpression));
-        last = &manager->makeFilter( "filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
     // NN HAG filter
@@ -147,7 +159,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
             hag_nn_opts.add(pdal::Option("max_distance", nnMaxDistance));
         }
 
-        last = &manager->makeFilter( "filters.hag_nn", *last, hag_nn_opts);
+        last = &makeFilter(manager.get(), "filters.hag_nn", *last, hag_nn_opts);
     }
 
     // Delaunay HAG filter
@@ -160,7 +172,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
             hag_delaunay_opts.add(pdal::Option("count", delaunayCount));
         }
 
-        last = &manager->makeFilter( "filters.hag_delaunay", *last, hag_delaunay_opts);
+        last = &makeFilter(manager.get(), "filters.hag_delaunay", *last, hag_delaunay_opts);
     }
 
     if (replaceZWithHeightAboveGround)
@@ -168,7 +180,15 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
         pdal::Options ferry_opts;
         ferry_opts.add(pdal::Option("dimensions", "HeightAboveGround=>Z"));
 
-        last = &manager->makeFilter( "filters.ferry", *last, ferry_opts);
+        last = &makeFilter(manager.get(), "filters.ferry", *last, ferry_opts);
+    }
+
+    if (!tile->tileCoreExpression.empty())
+    {
+        // only write points of the tile, not of its collar
+        Options filter_opts;
+        filter_opts.add(pdal::Option("expression", tile->tileCoreExpression));
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
     makeWriter( manager.get(), tile->outputFilename, last);
@@ -179,7 +199,14 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
 
 void HeightAboveGround::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipelines)
 {   
-    if (isVpcFilename(inputFile))
+    if (tiling.isUsed(inputFile))
+    {
+        // spatial processing in tiles: each job also reads points in a collar around its tile
+        // to avoid edge effects, but it only writes points of the tile itself
+        for (ParallelJobInfo &tile : tiling.jobs(*this, outputFile, outputFormatVpc, tileOutputFiles))
+            pipelines.push_back(pipeline(&tile, algorithm, replaceZWithHeightAboveGround, nnCount, nnMaxDistance, delaunayCount, tiling.collarSize));
+    }
+    else if (isVpcFilename(inputFile))
     {
         // for /tmp/hello.vpc we will use /tmp/hello dir for all results
         fs::path outputParentDir = fs::path(outputFile).parent_path();
@@ -200,7 +227,8 @@ void HeightAboveGround::preparePipelines(std::vector<std::unique_ptr<PipelineMan
 
             tileOutputFiles.push_back(tile.outputFilename);
 
-            pipelines.push_back(pipeline(&tile, algorithm, replaceZWithHeightAboveGround, nnCount, nnMaxDistance, delaunayCount));
+            pipelineCosts.push_back(f.count);
+            pipelines.push_back(pipeline(&tile, algorithm, replaceZWithHeightAboveGround, nnCount, nnMaxDistance, delaunayCount, tiling.collarSize));
         }
     }
     else
@@ -208,7 +236,7 @@ void HeightAboveGround::preparePipelines(std::vector<std::unique_ptr<PipelineMan
         ParallelJobInfo tile(ParallelJobInfo::Single, BOX2D(), filterExpression, filterBounds);
         tile.inputFilenames.push_back(inputFile);
         tile.outputFilename = outputFile;
-        pipelines.push_back(pipeline(&tile, algorithm, replaceZWithHeightAboveGround, nnCount, nnMaxDistance, delaunayCount));
+        pipelines.push_back(pipeline(&tile, algorithm, replaceZWithHeightAboveGround, nnCount, nnMaxDistance, delaunayCount, tiling.collarSize));
     }
 }
 
@@ -217,5 +245,5 @@ void HeightAboveGround::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
     if (tileOutputFiles.empty())
         return;
 
-    buildOutput(outputFile, tileOutputFiles);
+    buildOutput(outputFile, tileOutputFiles, max_threads);
 }
@@ -0,0 +1,485 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include "las_header.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include <pdal/util/ThreadPool.hpp>
+
+#include "profile.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+// offsets of fields in the LAS header (all values are little endian)
+#define LAS_OFFSET_GLOBAL_ENCODING    6
+#define LAS_OFFSET_VERSION_MAJOR      24
+#define LAS_OFFSET_VERSION_MINOR      25
+#define LAS_OFFSET_HEADER_SIZE        94
+#define LAS_OFFSET_POINT_OFFSET       96
+#define LAS_OFFSET_VLR_COUNT          100
+#define LAS_OFFSET_POINT_FORMAT       104
+#define LAS_OFFSET_POINT_LENGTH       105
+#define LAS_OFFSET_LEGACY_COUNT       107
+#define LAS_OFFSET_LEGACY_BY_RETURN   111
+#define LAS_OFFSET_SCALE              131
+#define LAS_OFFSET_OFFSET             155
+#define LAS_OFFSET_BOUNDS             179   // max x, min x, max y, min y, max z, min z
+#define LAS_OFFSET_EVLR_OFFSET        235   // 1.4 only
+#define LAS_OFFSET_EVLR_COUNT         243   // 1.4 only
+#define LAS_OFFSET_POINT_COUNT        247   // 1.4 only
+#define LAS_OFFSET_BY_RETURN          255   // 1.4 only
+
+#define LAS_HEADER_SIZE_MIN           227
+#define LAS_HEADER_SIZE_14            375
+
+// LASzip VLR describes how the points of a LAZ file are compressed
+#define LASZIP_VLR_USER_ID            "laszip encoded"
+#define LASZIP_VLR_RECORD_ID          22204
+#define LASZIP_OFFSET_COMPRESSOR      0
+#define LASZIP_OFFSET_CHUNK_SIZE      12
+#define LASZIP_VARIABLE_CHUNK_SIZE    0xFFFFFFFFU
+
+#define VLR_HEADER_SIZE               54
+
+// copying of point records is done in chunks of this size
+#define COPY_BUFFER_SIZE              (16 * 1024 * 1024)
+
+
+template<typename T>
+static T readValue(const std::vector<char> &data, size_t offset)
+{
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+}
+
+template<typename T>
+static void writeValue(std::vector<char> &data, size_t offset, T value)
+{
+    std::memcpy(data.data() + offset, &value, sizeof(T));
+}
+
+
+bool LasHeader::read(const std::string &filename)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if (!f)
+        return false;
+
+    rawHeader.resize(LAS_HEADER_SIZE_MIN);
+    if (!f.read(rawHeader.data(), rawHeader.size()) || std::memcmp(rawHeader.data(), "LASF", 4) != 0)
+        return false;
+
+    versionMajor = readValue<uint8_t>(rawHeader, LAS_OFFSET_VERSION_MAJOR);
+    versionMinor = readValue<uint8_t>(rawHeader, LAS_OFFSET_VERSION_MINOR);
+    headerSize = readValue<uint16_t>(rawHeader, LAS_OFFSET_HEADER_SIZE);
+    pointOffset = readValue<uint32_t>(rawHeader, LAS_OFFSET_POINT_OFFSET);
+    if (versionMajor != 1 || headerSize < LAS_HEADER_SIZE_MIN || pointOffset < headerSize)
+        return false;
+    if (versionMinor >= 4 && headerSize < LAS_HEADER_SIZE_14)
+        return false;
+
+    rawHeader.resize(headerSize);
+    if (!f.read(rawHeader.data() + LAS_HEADER_SIZE_MIN, headerSize - LAS_HEADER_SIZE_MIN))
+        return false;
+
+    globalEncoding = readValue<uint16_t>(rawHeader, LAS_OFFSET_GLOBAL_ENCODING);
+    vlrCount = readValue<uint32_t>(rawHeader, LAS_OFFSET_VLR_COUNT);
+    pointFormat = readValue<uint8_t>(rawHeader, LAS_OFFSET_POINT_FORMAT);
+    pointRecordLength = readValue<uint16_t>(rawHeader, LAS_OFFSET_POINT_LENGTH);
+    pointCount = readValue<uint32_t>(rawHeader, LAS_OFFSET_LEGACY_COUNT);
+    for (int i = 0; i < 5; ++i)
+        pointsByReturn[i] = readValue<uint32_t>(rawHeader, LAS_OFFSET_LEGACY_BY_RETURN + 4*i);
+    for (int i = 0; i < 3; ++i)
+    {
+        scale[i] = readValue<double>(rawHeader, LAS_OFFSET_SCALE + 8*i);
+        offset[i] = readValue<double>(rawHeader, LAS_OFFSET_OFFSET + 8*i);
+        maximum[i] = readValue<double>(rawHeader, LAS_OFFSET_BOUNDS + 16*i);
+        minimum[i] = readValue<double>(rawHeader, LAS_OFFSET_BOUNDS + 16*i + 8);
+    }
+
+    if (versionMinor >= 4)
+    {
+        evlrOffset = readValue<uint64_t>(rawHeader, LAS_OFFSET_EVLR_OFFSET);
+        evlrCount = readValue<uint32_t>(rawHeader, LAS_OFFSET_EVLR_COUNT);
+        pointCount = readValue<uint64_t>(rawHeader, LAS_OFFSET_POINT_COUNT);
+        for (int i = 0; i < 15; ++i)
+            pointsByReturn[i] = readValue<uint64_t>(rawHeader, LAS_OFFSET_BY_RETURN + 8*i);
+    }
+
+    rawVlrs.resize(pointOffset - headerSize);
+    if (!f.read(rawVlrs.data(), rawVlrs.size()))
+        return false;
+
+    return true;
+}
+
+std::vector<char> LasHeader::updatedRawHeader() const
+{
+    std::vector<char> data = rawHeader;
+
+    writeValue<uint16_t>(data, LAS_OFFSET_GLOBAL_ENCODING, globalEncoding);
+    writeValue<uint32_t>(data, LAS_OFFSET_POINT_OFFSET, pointOffset);
+    writeValue<uint32_t>(data, LAS_OFFSET_VLR_COUNT, vlrCount);
+
+    // legacy fields are only set if the point format allows it and the values fit
+    bool legacyCounts = (pointFormat & 0x3f) < 6 && pointCount <= std::numeric_limits<uint32_t>::max();
+    writeValue<uint32_t>(data, LAS_OFFSET_LEGACY_COUNT, legacyCounts ? (uint32_t)pointCount : 0);
+    for (int i = 0; i < 5; ++i)
+        writeValue<uint32_t>(data, LAS_OFFSET_LEGACY_BY_RETURN + 4*i, legacyCounts ? (uint32_t)pointsByReturn[i] : 0);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        writeValue<double>(data, LAS_OFFSET_BOUNDS + 16*i, maximum[i]);
+        writeValue<double>(data, LAS_OFFSET_BOUNDS + 16*i + 8, minimum[i]);
+    }
+
+    if (versionMinor >= 4)
+    {
+        writeValue<uint64_t>(data, LAS_OFFSET_EVLR_OFFSET, evlrOffset);
+        writeValue<uint32_t>(data, LAS_OFFSET_EVLR_COUNT, evlrCount);
+        writeValue<uint64_t>(data, LAS_OFFSET_POINT_COUNT, pointCount);
+        for (int i = 0; i < 15; ++i)
+            writeValue<uint64_t>(data, LAS_OFFSET_BY_RETURN + 8*i, pointsByReturn[i]);
+    }
+    return data;
+}
+
+
+bool copyFileRange(const std::string &inputFile, uint64_t inputOffset, const std::string &outputFile, uint64_t outputOffset, uint64_t size)
+{
+    std::ifstream in(inputFile, std::ios::binary);
+    // every job opens its own handle of the output file and writes to its own region of it
+    std::fstream out(outputFile, std::ios::binary | std::ios::in | std::ios::out);
+    if (!in || !out)
+        return false;
+
+    in.seekg(inputOffset);
+    out.seekp(outputOffset);
+
+    std::vector<char> buffer((size_t)(std::min)(size, (uint64_t)COPY_BUFFER_SIZE));
+    while (size > 0)
+    {
+        size_t chunk = (size_t)(std::min)(size, (uint64_t)buffer.size());
+        if (!in.read(buffer.data(), chunk) || !out.write(buffer.data(), chunk))
+            return false;
+        size -= chunk;
+    }
+    return (bool)out.flush();
+}
+
+
+/**
+ * Returns offset of the LASzip VLR's data within raw VLRs (or zero if there is no such VLR).
+ */
+static size_t laszipVlrDataOffset(const std::vector<char> &rawVlrs)
+{
+    size_t pos = 0;
+    while (pos + VLR_HEADER_SIZE <= rawVlrs.size())
+    {
+        uint16_t recordId = readValue<uint16_t>(rawVlrs, pos + 18);
+        uint16_t length = readValue<uint16_t>(rawVlrs, pos + 20);
+        size_t dataOffset = pos + VLR_HEADER_SIZE;
+        if (std::strncmp(rawVlrs.data() + pos + 2, LASZIP_VLR_USER_ID, 16) == 0 && recordId == LASZIP_VLR_RECORD_ID &&
+            dataOffset + LASZIP_OFFSET_CHUNK_SIZE + 4 <= rawVlrs.size())
+            return dataOffset;
+        pos = dataOffset + length;
+    }
+    return 0;
+}
+
+/**
+ * Returns VLRs of a LAZ file with chunk size in LASzip VLR set to variable chunk size
+ * (or empty array if the file is not compressed in chunks that could be concatenated).
+ */
+static std::vector<char> variableChunkSizeVlrs(const LasHeader &h)
+{
+    size_t offset = laszipVlrDataOffset(h.rawVlrs);
+    if (offset == 0)
+        return std::vector<char>();
+
+    // only pointwise chunked (2) and layered chunked (3) compressors store independent chunks
+    uint16_t compressor = readValue<uint16_t>(h.rawVlrs, offset + LASZIP_OFFSET_COMPRESSOR);
+    if (compressor != 2 && compressor != 3)
+        return std::vector<char>();
+
+    std::vector<char> vlrs = h.rawVlrs;
+    writeValue<uint32_t>(vlrs, offset + LASZIP_OFFSET_CHUNK_SIZE, LASZIP_VARIABLE_CHUNK_SIZE);
+    return vlrs;
+}
+
+bool LasHeader::setVariableChunkSize()
+{
+    std::vector<char> vlrs = variableChunkSizeVlrs(*this);
+    if (vlrs.empty())
+        return false;
+    rawVlrs = vlrs;
+    return true;
+}
+
+/**
+ * Checks that point records of all files can be simply put together.
+ */
+static bool headersCompatible(const std::vector<LasHeader> &headers, bool compressed)
+{
+    const LasHeader &first = headers[0];
+    std::vector<char> firstVlrs = compressed ? variableChunkSizeVlrs(first) : first.rawVlrs;
+    if (compressed && firstVlrs.empty())
+        return false;
+
+    for (const LasHeader &h : headers)
+    {
+        if (h.isCompressed() != compressed || h.evlrCount != 0 ||
+            h.versionMinor != first.versionMinor ||
+            h.pointFormat != first.pointFormat || h.pointRecordLength != first.pointRecordLength ||
+            !std::equal(h.scale, h.scale + 3, first.scale) || !std::equal(h.offset, h.offset + 3, first.offset) ||
+            (compressed ? variableChunkSizeVlrs(h) : h.rawVlrs) != firstVlrs)
+            return false;
+    }
+    return true;
+}
+
+static bool readHeaders(const std::vector<std::string> &inputFiles, std::vector<LasHeader> &headers)
+{
+    if (inputFiles.empty())
+        return false;
+
+    headers.resize(inputFiles.size());
+    for (size_t i = 0; i < inputFiles.size(); ++i)
+    {
+        if (!headers[i].read(inputFiles[i]))
+            return false;
+    }
+    return true;
+}
+
+LasHeader mergeLasHeaders(const std::vector<LasHeader> &headers)
+{
+    LasHeader output = headers[0];
+    output.pointCount = 0;
+    std::fill(output.pointsByReturn, output.pointsByReturn + 15, 0);
+    for (int i = 0; i < 3; ++i)
+    {
+        output.minimum[i] = std::numeric_limits<double>::max();
+        output.maximum[i] = std::numeric_limits<double>::lowest();
+    }
+
+    for (const LasHeader &h : headers)
+    {
+        if (h.pointCount == 0)
+            continue;  // bounds of empty files are not meaningful
+        output.pointCount += h.pointCount;
+        for (int r = 0; r < 15; ++r)
+            output.pointsByReturn[r] += h.pointsByReturn[r];
+        for (int j = 0; j < 3; ++j)
+        {
+            output.minimum[j] = (std::min)(output.minimum[j], h.minimum[j]);
+            output.maximum[j] = (std::max)(output.maximum[j], h.maximum[j]);
+        }
+    }
+    if (output.pointCount == 0)
+    {
+        std::fill(output.minimum, output.minimum + 3, 0);
+        std::fill(output.maximum, output.maximum + 3, 0);
+    }
+    return output;
+}
+
+/**
+ * Writes header + VLRs of the output file and allocates space for the rest of the file
+ */
+static bool createOutputFile(const std::string &outputFile, const LasHeader &output, uint64_t outputSize)
+{
+    {
+        std::ofstream out(outputFile, std::ios::binary | std::ios::trunc);
+        std::vector<char> rawHeader = output.updatedRawHeader();
+        if (!out.write(rawHeader.data(), rawHeader.size()) || !out.write(output.rawVlrs.data(), output.rawVlrs.size()))
+        {
+            std::cerr << "Failed to write " << outputFile << std::endl;
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::resize_file(outputFile, outputSize, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to write " << outputFile << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Copies given ranges of bytes from input files to their place in the output file, in parallel
+ */
+static bool copyRanges(const std::vector<std::string> &inputFiles, const std::vector<uint64_t> &inputOffsets,
+                       const std::string &outputFile, const std::vector<uint64_t> &outputOffsets,
+                       const std::vector<uint64_t> &sizes, int numThreads)
+{
+    std::atomic<bool> ok(true);
+    ProgressBar progressBar;
+    progressBar.init(inputFiles.size());
+    pdal::ThreadPool pool((std::max)(1, (std::min)(numThreads, (int)inputFiles.size())));
+    for (size_t i = 0; i < inputFiles.size(); ++i)
+    {
+        if (sizes[i] == 0)
+        {
+            progressBar.add();
+            continue;
+        }
+
+        pool.add([&, i]()
+        {
+            if (!copyFileRange(inputFiles[i], inputOffsets[i], outputFile, outputOffsets[i], sizes[i]))
+            {
+                std::cerr << "Failed to copy points from " << inputFiles[i] << std::endl;
+                ok = false;
+            }
+            progressBar.add();
+        });
+    }
+    pool.join();
+    progressBar.done();
+
+    return ok;
+}
+
+
+bool canConcatenateLasFiles(const std::vector<std::string> &inputFiles, bool compressed)
+{
+    std::vector<LasHeader> headers;
+    return readHeaders(inputFiles, headers) && headersCompatible(headers, compressed);
+}
+
+
+bool concatenateLasFiles(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads)
+{
+    std::vector<LasHeader> headers;
+    if (!readHeaders(inputFiles, headers) || !headersCompatible(headers, false))
+        return false;
+
+    LasHeader output = mergeLasHeaders(headers);
+
+    std::vector<uint64_t> inputOffsets(inputFiles.size()), outputOffsets(inputFiles.size()), sizes(inputFiles.size());
+    uint64_t outputSize = output.pointOffset;
+    for (size_t i = 0; i < headers.size(); ++i)
+    {
+        inputOffsets[i] = headers[i].pointOffset;
+        outputOffsets[i] = outputSize;
+        sizes[i] = headers[i].pointCount * headers[i].pointRecordLength;
+        outputSize += sizes[i];
+    }
+
+    ProfileScope profileScope("concatenateLasFiles");
+
+    return createOutputFile(outputFile, output, outputSize) &&
+           copyRanges(inputFiles, inputOffsets, outputFile, outputOffsets, sizes, numThreads);
+}
+
+
+bool readLazChunks(const std::string &filename, const LasHeader &h, std::vector<LazChunk> &chunks)
+{
+    std::ifstream f(filename, std::ios::binary);
+    int64_t tableOffset = -1;
+    if (!f.seekg(h.pointOffset) || !f.read((char*)&tableOffset, 8))
+        return false;
+
+    // -1 means that the writer could not seek back to write the offset (not supported here)
+    std::error_code ec;
+    uint64_t fileSize = fs::file_size(filename, ec);
+    if (ec || tableOffset < (int64_t)h.pointOffset + 8 || (uint64_t)tableOffset >= fileSize)
+        return false;
+
+    std::vector<char> table((size_t)(fileSize - tableOffset));
+    if (!f.seekg(tableOffset) || !f.read(table.data(), table.size()))
+        return false;
+
+    size_t vlrOffset = laszipVlrDataOffset(h.rawVlrs);
+    uint32_t chunkSize = readValue<uint32_t>(h.rawVlrs, vlrOffset + LASZIP_OFFSET_CHUNK_SIZE);
+    bool variable = chunkSize == LASZIP_VARIABLE_CHUNK_SIZE;
+    if (!decodeLazChunkTable(table, variable, chunks))
+        return false;
+
+    // with fixed chunk size, all chunks are full except the last one
+    uint64_t points = 0, chunksSize = 0;
+    for (LazChunk &chunk : chunks)
+    {
+        if (!variable)
+            chunk.pointCount = (std::min)((uint64_t)chunkSize, h.pointCount - points);
+        points += chunk.pointCount;
+        chunksSize += chunk.byteSize;
+    }
+
+    // sanity check that the table was decoded correctly
+    return points == h.pointCount && chunksSize == (uint64_t)tableOffset - h.pointOffset - 8;
+}
+
+
+bool concatenateLazFiles(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads)
+{
+    std::vector<LasHeader> headers;
+    if (!readHeaders(inputFiles, headers) || !headersCompatible(headers, true))
+        return false;
+
+    // chunk tables of all inputs are read first, so that nothing is written if any of them is not usable
+    std::vector<LazChunk> outputChunks;
+    std::vector<uint64_t> inputOffsets(inputFiles.size()), outputOffsets(inputFiles.size()), sizes(inputFiles.size());
+    LasHeader output = mergeLasHeaders(headers);
+    output.setVariableChunkSize();
+    uint64_t outputSize = output.pointOffset + 8;
+    for (size_t i = 0; i < headers.size(); ++i)
+    {
+        inputOffsets[i] = headers[i].pointOffset + 8;
+        outputOffsets[i] = outputSize;
+        if (headers[i].pointCount == 0)
+            continue;
+
+        std::vector<LazChunk> chunks;
+        if (!readLazChunks(inputFiles[i], headers[i], chunks))
+            return false;
+        for (const LazChunk &chunk : chunks)
+            sizes[i] += chunk.byteSize;
+        outputChunks.insert(outputChunks.end(), chunks.begin(), chunks.end());
+        outputSize += sizes[i];
+    }
+
+    ProfileScope profileScope("concatenateLazFiles");
+
+    std::vector<char> table = encodeLazChunkTable(outputChunks);
+    int64_t tableOffset = (int64_t)outputSize;
+    if (!createOutputFile(outputFile, output, outputSize + table.size()))
+        return false;
+
+    {
+        std::fstream out(outputFile, std::ios::binary | std::ios::in | std::ios::out);
+        out.seekp(output.pointOffset);
+        out.write((const char*)&tableOffset, 8);
+        out.seekp(tableOffset);
+        out.write(table.data(), table.size());
+        if (!out.flush())
+        {
+            std::cerr << "Failed to write " << outputFile << std::endl;
+            return false;
+        }
+    }
+
+    // the chunks are compressed independently of each other, so they can be just copied
+    return copyRanges(inputFiles, inputOffsets, outputFile, outputOffsets, sizes, numThreads);
+}
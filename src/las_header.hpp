@@ -0,0 +1,112 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "laz_chunk_table.hpp"
+
+/**
+ * Minimal reading/writing of LAS file headers (versions 1.0 - 1.4), so that LAS files can be
+ * manipulated directly without going through PDAL, e.g. to concatenate point records of files.
+ */
+struct LasHeader
+{
+    uint16_t globalEncoding = 0;
+    uint8_t versionMajor = 1;
+    uint8_t versionMinor = 2;
+    uint16_t headerSize = 0;
+    uint32_t pointOffset = 0;
+    uint32_t vlrCount = 0;
+    uint8_t pointFormat = 0;          // with bit 7 set if the points are compressed (LAZ)
+    uint16_t pointRecordLength = 0;
+    uint64_t pointCount = 0;
+    uint64_t pointsByReturn[15] = {0};
+    double scale[3] = {0, 0, 0};
+    double offset[3] = {0, 0, 0};
+    double minimum[3] = {0, 0, 0};
+    double maximum[3] = {0, 0, 0};
+    uint64_t evlrOffset = 0;          // 1.4 only
+    uint32_t evlrCount = 0;           // 1.4 only
+
+    std::vector<char> rawHeader;      // the whole header as read from the file
+    std::vector<char> rawVlrs;        // VLRs between the header and point records
+
+    bool isCompressed() const { return (pointFormat & 0x80) || (pointFormat & 0x40); }
+
+    /**
+     * Reads header and VLRs of a LAS/LAZ file. Returns false on error.
+     */
+    bool read(const std::string &filename);
+
+    /**
+     * Returns the raw header updated with the current values of point counts, bounds,
+     * global encoding, offset of points and number of (E)VLRs.
+     */
+    std::vector<char> updatedRawHeader() const;
+
+    /**
+     * Sets chunk size in the LASzip VLR to variable chunk size (so that chunks of any size can be
+     * put together). Returns false if the points are not compressed in independent chunks.
+     */
+    bool setVariableChunkSize();
+};
+
+
+/**
+ * Returns header with point counts and bounds summed up from the given headers (other fields
+ * and VLRs are taken from the first header).
+ */
+LasHeader mergeLasHeaders(const std::vector<LasHeader> &headers);
+
+/**
+ * Reads chunk table of a LAZ file with the given header. Point counts of chunks are filled in
+ * also when the file uses fixed chunk size. Chunks of the file start right after the 8-byte offset
+ * of the chunk table (which is at the start of point data). Returns false on error.
+ */
+bool readLazChunks(const std::string &filename, const LasHeader &header, std::vector<LazChunk> &chunks);
+
+/**
+ * Copies a range of bytes from the input file to the given offset in an existing output file.
+ * Multiple threads may copy to different regions of the same output file at once.
+ */
+bool copyFileRange(const std::string &inputFile, uint64_t inputOffset, const std::string &outputFile, uint64_t outputOffset, uint64_t size);
+
+
+/**
+ * Concatenates point records of uncompressed LAS files that have the same point format, scale, offset
+ * and VLRs (e.g. outputs of parallel jobs that come from a single input) into a single LAS file.
+ * The header of the output is created from the input headers, and point records of the input files
+ * are copied to their place in the output file in parallel, without decoding the points.
+ * Returns false if the files can't be concatenated this way (nothing is written in that case)
+ * or if there was an error.
+ */
+bool concatenateLasFiles(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads);
+
+/**
+ * Concatenates chunks of compressed points of LAZ files that have the same point format, scale, offset
+ * and VLRs into a single LAZ file (with variable chunk size). Points are not decompressed: compressed
+ * chunks of the input files are copied to their place in the output file in parallel, and only a new
+ * chunk table is written. This way, LAZ output can be compressed in parallel by the jobs that write
+ * the input files. Returns false if the files can't be concatenated this way (nothing is written
+ * in that case) or if there was an error.
+ */
+bool concatenateLazFiles(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads);
+
+/**
+ * Returns true if all files are LAS files (compressed or uncompressed, as requested) that look like
+ * they can be put together by concatenateLasFiles() or concatenateLazFiles() - only headers are checked.
+ */
+bool canConcatenateLasFiles(const std::vector<std::string> &inputFiles, bool compressed);
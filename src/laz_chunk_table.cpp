@@ -0,0 +1,525 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include "laz_chunk_table.hpp"
+
+#include <cstring>
+#include <limits>
+
+// constants of the arithmetic coder (they must match LASzip / laz-perf)
+#define AC_MIN_LENGTH     0x01000000U
+#define AC_MAX_LENGTH     0xFFFFFFFFU
+#define BM_LENGTH_SHIFT   13
+#define BM_MAX_COUNT      (1U << BM_LENGTH_SHIFT)
+#define DM_LENGTH_SHIFT   15
+#define DM_MAX_COUNT      (1U << DM_LENGTH_SHIFT)
+
+// the chunk table is encoded by an integer compressor with 32 bits and two contexts
+// (one for point counts, one for byte sizes), with the upper 8 bits of correctors modelled
+#define IC_BITS_HIGH      8
+#define IC_CORR_BITS      32
+
+namespace
+{
+
+/**
+ * Adaptive model of a single bit.
+ */
+struct BitModel
+{
+    uint32_t bit0Count = 1;
+    uint32_t bitCount = 2;
+    uint32_t bit0Prob = 1U << (BM_LENGTH_SHIFT - 1);
+    uint32_t updateCycle = 4;
+    uint32_t bitsUntilUpdate = 4;
+
+    void update()
+    {
+        // halve counts when a threshold is reached
+        if ((bitCount += updateCycle) > BM_MAX_COUNT)
+        {
+            bitCount = (bitCount + 1) >> 1;
+            bit0Count = (bit0Count + 1) >> 1;
+            if (bit0Count == bitCount)
+                ++bitCount;
+        }
+
+        uint32_t scale = 0x80000000U / bitCount;
+        bit0Prob = (bit0Count * scale) >> (31 - BM_LENGTH_SHIFT);
+
+        updateCycle = (5 * updateCycle) >> 2;
+        if (updateCycle > 64)
+            updateCycle = 64;
+        bitsUntilUpdate = updateCycle;
+    }
+};
+
+/**
+ * Adaptive model of symbols 0 .. N-1.
+ */
+struct SymbolModel
+{
+    uint32_t symbols;
+    uint32_t lastSymbol;
+    std::vector<uint32_t> distribution;
+    std::vector<uint32_t> symbolCount;
+    uint32_t totalCount = 0;
+    uint32_t updateCycle;
+    uint32_t symbolsUntilUpdate;
+
+    explicit SymbolModel(uint32_t n)
+        : symbols(n), lastSymbol(n - 1), distribution(n), symbolCount(n, 1), updateCycle(n)
+    {
+        update();
+        symbolsUntilUpdate = updateCycle = (symbols + 6) >> 1;
+    }
+
+    void update()
+    {
+        // halve counts when a threshold is reached
+        if ((totalCount += updateCycle) > DM_MAX_COUNT)
+        {
+            totalCount = 0;
+            for (uint32_t n = 0; n < symbols; n++)
+                totalCount += (symbolCount[n] = (symbolCount[n] + 1) >> 1);
+        }
+
+        // cumulative distribution
+        uint32_t sum = 0;
+        uint32_t scale = 0x80000000U / totalCount;
+        for (uint32_t k = 0; k < symbols; k++)
+        {
+            distribution[k] = (scale * sum) >> (31 - DM_LENGTH_SHIFT);
+            sum += symbolCount[k];
+        }
+
+        updateCycle = (5 * updateCycle) >> 2;
+        uint32_t maxCycle = (symbols + 6) << 3;
+        if (updateCycle > maxCycle)
+            updateCycle = maxCycle;
+        symbolsUntilUpdate = updateCycle;
+    }
+};
+
+
+class Encoder
+{
+public:
+    std::vector<char> &output;
+
+    explicit Encoder(std::vector<char> &out) : output(out) {}
+
+    void encodeBit(BitModel &m, uint32_t bit)
+    {
+        uint32_t x = m.bit0Prob * (length >> BM_LENGTH_SHIFT);
+        if (bit == 0)
+        {
+            length = x;
+            ++m.bit0Count;
+        }
+        else
+        {
+            uint32_t initBase = base;
+            base += x;
+            length -= x;
+            if (initBase > base)
+                propagateCarry();
+        }
+        if (length < AC_MIN_LENGTH)
+            renormalize();
+        if (--m.bitsUntilUpdate == 0)
+            m.update();
+    }
+
+    void encodeSymbol(SymbolModel &m, uint32_t sym)
+    {
+        uint32_t x, initBase = base;
+        if (sym == m.lastSymbol)
+        {
+            x = m.distribution[sym] * (length >> DM_LENGTH_SHIFT);
+            base += x;
+            length -= x;
+        }
+        else
+        {
+            x = m.distribution[sym] * (length >>= DM_LENGTH_SHIFT);
+            base += x;
+            length = m.distribution[sym + 1] * length - x;
+        }
+        if (initBase > base)
+            propagateCarry();
+        if (length < AC_MIN_LENGTH)
+            renormalize();
+
+        ++m.symbolCount[sym];
+        if (--m.symbolsUntilUpdate == 0)
+            m.update();
+    }
+
+    void writeBits(uint32_t bits, uint32_t sym)
+    {
+        if (bits > 19)
+        {
+            writeShort(sym & 0xFFFF);
+            sym = sym >> 16;
+            bits = bits - 16;
+        }
+        uint32_t initBase = base;
+        base += sym * (length >>= bits);
+        if (initBase > base)
+            propagateCarry();
+        if (length < AC_MIN_LENGTH)
+            renormalize();
+    }
+
+    void done()
+    {
+        uint32_t initBase = base;
+        bool anotherByte = true;
+        if (length > 2 * AC_MIN_LENGTH)
+        {
+            base += AC_MIN_LENGTH;
+            length = AC_MIN_LENGTH >> 1;
+        }
+        else
+        {
+            base += AC_MIN_LENGTH >> 1;
+            length = AC_MIN_LENGTH >> 9;
+            anotherByte = false;
+        }
+        if (initBase > base)
+            propagateCarry();
+        renormalize();
+
+        // extra zero bytes to be in sync with the byte reads of the decoder
+        output.push_back(0);
+        output.push_back(0);
+        if (anotherByte)
+            output.push_back(0);
+    }
+
+private:
+    uint32_t base = 0;
+    uint32_t length = AC_MAX_LENGTH;
+
+    void writeShort(uint32_t sym)
+    {
+        uint32_t initBase = base;
+        base += sym * (length >>= 16);
+        if (initBase > base)
+            propagateCarry();
+        if (length < AC_MIN_LENGTH)
+            renormalize();
+    }
+
+    void propagateCarry()
+    {
+        for (size_t i = output.size(); i > start; --i)
+        {
+            char &c = output[i - 1];
+            if ((uint8_t)c == 0xFF)
+            {
+                c = 0;
+            }
+            else
+            {
+                c = (char)((uint8_t)c + 1);
+                return;
+            }
+        }
+    }
+
+    void renormalize()
+    {
+        do
+        {
+            output.push_back((char)(uint8_t)(base >> 24));
+            base <<= 8;
+        } while ((length <<= 8) < AC_MIN_LENGTH);
+    }
+
+    size_t start = output.size();  // carry must not propagate to bytes written before the encoder
+};
+
+
+class Decoder
+{
+public:
+    Decoder(const std::vector<char> &data, size_t offset) : input(data), pos(offset)
+    {
+        for (int i = 0; i < 4; ++i)
+            value = (value << 8) | getByte();
+    }
+
+    bool overrun = false;   // set when the decoder tried to read past the end of data
+
+    uint32_t decodeBit(BitModel &m)
+    {
+        uint32_t x = m.bit0Prob * (length >> BM_LENGTH_SHIFT);
+        uint32_t bit = (value >= x);
+        if (bit == 0)
+        {
+            length = x;
+            ++m.bit0Count;
+        }
+        else
+        {
+            value -= x;
+            length -= x;
+        }
+        if (length < AC_MIN_LENGTH)
+            renormalize();
+        if (--m.bitsUntilUpdate == 0)
+            m.update();
+        return bit;
+    }
+
+    uint32_t decodeSymbol(SymbolModel &m)
+    {
+        uint32_t n, sym = 0, x = 0, y = length;
+
+        // bisection search of the symbol
+        length >>= DM_LENGTH_SHIFT;
+        uint32_t k = (n = m.symbols) >> 1;
+        do
+        {
+            uint32_t z = length * m.distribution[k];
+            if (z > value)
+            {
+                n = k;
+                y = z;
+            }
+            else
+            {
+                sym = k;
+                x = z;
+            }
+        } while ((k = (sym + n) >> 1) != sym);
+
+        value -= x;
+        length = y - x;
+        if (length < AC_MIN_LENGTH)
+            renormalize();
+
+        ++m.symbolCount[sym];
+        if (--m.symbolsUntilUpdate == 0)
+            m.update();
+        return sym;
+    }
+
+    uint32_t readBits(uint32_t bits)
+    {
+        if (bits > 19)
+        {
+            uint32_t low = readShort();
+            uint32_t high = readBits(bits - 16) << 16;
+            return high | low;
+        }
+        uint32_t sym = value / (length >>= bits);
+        value -= length * sym;
+        if (length < AC_MIN_LENGTH)
+            renormalize();
+        return sym;
+    }
+
+private:
+    const std::vector<char> &input;
+    size_t pos;
+    uint32_t value = 0;
+    uint32_t length = AC_MAX_LENGTH;
+
+    uint32_t readShort()
+    {
+        uint32_t sym = value / (length >>= 16);
+        value -= length * sym;
+        if (length < AC_MIN_LENGTH)
+            renormalize();
+        return sym;
+    }
+
+    uint32_t getByte()
+    {
+        if (pos >= input.size())
+        {
+            overrun = true;
+            return 0;
+        }
+        return (uint8_t)input[pos++];
+    }
+
+    void renormalize()
+    {
+        do
+        {
+            value = (value << 8) | getByte();
+        } while ((length <<= 8) < AC_MIN_LENGTH);
+    }
+};
+
+
+/**
+ * Integer compressor (32 bits) coding differences between predicted and real values.
+ * A difference (corrector) is coded as the number of its bits k followed by its value
+ * within the interval given by k.
+ */
+class IntegerCoder
+{
+public:
+    IntegerCoder(uint32_t contexts)
+    {
+        for (uint32_t i = 0; i < contexts; ++i)
+            m_bits.emplace_back(IC_CORR_BITS + 1);
+        m_corrector.emplace_back(2);  // unused - k == 0 uses the bit model
+        for (uint32_t i = 1; i <= IC_CORR_BITS; ++i)
+            m_corrector.emplace_back(1U << (i <= IC_BITS_HIGH ? i : IC_BITS_HIGH));
+    }
+
+    void compress(Encoder &enc, int32_t pred, int32_t real, uint32_t context)
+    {
+        // with 32 bits the corrector does not need any folding
+        uint32_t c = (uint32_t)real - (uint32_t)pred;
+        int32_t corr = (int32_t)c;
+
+        // find the tightest interval [ - (2^k - 1) ... + (2^k) ] that contains the corrector
+        uint32_t c1 = corr <= 0 ? 0U - c : c - 1;
+        uint32_t k = 0;
+        while (c1)
+        {
+            c1 >>= 1;
+            ++k;
+        }
+        enc.encodeSymbol(m_bits[context], k);
+
+        if (k == 0)
+        {
+            enc.encodeBit(m_bit, c);   // corrector is 0 or 1
+        }
+        else if (k < 32)
+        {
+            // translate the corrector to the interval [ 0 ... 2^k - 1 ]
+            if (corr < 0)
+                c += (1U << k) - 1;
+            else
+                c -= 1;
+
+            if (k <= IC_BITS_HIGH)
+            {
+                enc.encodeSymbol(m_corrector[k], c);
+            }
+            else
+            {
+                // higher bits are modelled, lower bits are stored raw
+                uint32_t k1 = k - IC_BITS_HIGH;
+                enc.encodeSymbol(m_corrector[k], c >> k1);
+                enc.writeBits(k1, c & ((1U << k1) - 1));
+            }
+        }
+    }
+
+    int32_t decompress(Decoder &dec, int32_t pred, uint32_t context)
+    {
+        uint32_t c;
+        uint32_t k = dec.decodeSymbol(m_bits[context]);
+        if (k == 0)
+        {
+            c = dec.decodeBit(m_bit);
+        }
+        else if (k < 32)
+        {
+            if (k <= IC_BITS_HIGH)
+            {
+                c = dec.decodeSymbol(m_corrector[k]);
+            }
+            else
+            {
+                uint32_t k1 = k - IC_BITS_HIGH;
+                c = dec.decodeSymbol(m_corrector[k]);
+                c = (c << k1) | dec.readBits(k1);
+            }
+
+            // translate the corrector back to its interval
+            if (c >= (1U << (k - 1)))
+                c += 1;
+            else
+                c -= (1U << k) - 1;
+        }
+        else
+        {
+            c = (uint32_t)std::numeric_limits<int32_t>::min();
+        }
+        return (int32_t)((uint32_t)pred + c);
+    }
+
+private:
+    std::vector<SymbolModel> m_bits;
+    std::vector<SymbolModel> m_corrector;
+    BitModel m_bit;
+};
+
+}  // namespace
+
+
+bool decodeLazChunkTable(const std::vector<char> &data, bool variableChunkSize, std::vector<LazChunk> &chunks)
+{
+    uint32_t version, count;
+    if (data.size() < 8)
+        return false;
+    std::memcpy(&version, data.data(), 4);
+    std::memcpy(&count, data.data() + 4, 4);
+    if (version != 0)
+        return false;
+
+    chunks.clear();
+    if (count == 0)
+        return true;
+    if (count > data.size() * 8)   // every chunk takes at least a bit
+        return false;
+
+    Decoder dec(data, 8);
+    IntegerCoder ic(2);
+    int32_t prevCount = 0, prevSize = 0;
+    chunks.resize(count);
+    for (LazChunk &chunk : chunks)
+    {
+        if (variableChunkSize)
+        {
+            prevCount = ic.decompress(dec, prevCount, 0);
+            chunk.pointCount = (uint32_t)prevCount;
+        }
+        prevSize = ic.decompress(dec, prevSize, 1);
+        chunk.byteSize = (uint32_t)prevSize;
+    }
+    return !dec.overrun;
+}
+
+std::vector<char> encodeLazChunkTable(const std::vector<LazChunk> &chunks)
+{
+    std::vector<char> data(8);
+    uint32_t version = 0, count = (uint32_t)chunks.size();
+    std::memcpy(data.data(), &version, 4);
+    std::memcpy(data.data() + 4, &count, 4);
+    if (chunks.empty())
+        return data;
+
+    Encoder enc(data);
+    IntegerCoder ic(2);
+    int32_t prevCount = 0, prevSize = 0;
+    for (const LazChunk &chunk : chunks)
+    {
+        ic.compress(enc, prevCount, (int32_t)(uint32_t)chunk.pointCount, 0);
+        ic.compress(enc, prevSize, (int32_t)(uint32_t)chunk.byteSize, 1);
+        prevCount = (int32_t)(uint32_t)chunk.pointCount;
+        prevSize = (int32_t)(uint32_t)chunk.byteSize;
+    }
+    enc.done();
+    return data;
+}
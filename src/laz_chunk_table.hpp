@@ -0,0 +1,44 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Reading and writing of the chunk table of LAZ files. Points of a LAZ file are compressed
+ * in chunks that can be decompressed independently of each other, and the chunk table
+ * (stored after the last chunk) lists the size of each chunk in bytes and - if the file
+ * uses variable chunk size (LAZ 1.4) - the number of points in each chunk.
+ *
+ * The table is encoded with the same arithmetic coder and integer compressor as used by LASzip
+ * and laz-perf, so that chunks of multiple LAZ files can be put together into a single file
+ * without decompressing and compressing the points again.
+ */
+
+struct LazChunk
+{
+    uint64_t pointCount = 0;
+    uint64_t byteSize = 0;
+};
+
+/**
+ * Decodes chunk table (including its version and number of chunks). If the table does not contain
+ * point counts (fixed chunk size), pointCount of chunks is left as zero. Returns false on error.
+ */
+bool decodeLazChunkTable(const std::vector<char> &data, bool variableChunkSize, std::vector<LazChunk> &chunks);
+
+/**
+ * Encodes chunk table of a file with variable chunk size (including its version and number of chunks).
+ */
+std::vector<char> encodeLazChunkTable(const std::vector<LazChunk> &chunks);
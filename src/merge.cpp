@@ -26,6 +26,8 @@
 #include "utils.hpp"
 #include "alg.hpp"
 #include "vpc.hpp"
+#include "las_header.hpp"
+#include "copc_builder.hpp"
 
 using namespace pdal;
 
@@ -170,6 +172,60 @@ void Merge::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipe
         processInputFile(inputFile);
     }
 
+    // only algs with single input have the number of points figured out already
+    totalPoints = 0;
+    std::vector<point_count_t> inputCounts;
+    for (const std::string& f : inputFiles)
+    {
+        QuickInfo qi = getQuickInfo(f);
+        totalPoints += qi.m_pointCount;
+        inputCounts.push_back(qi.m_pointCount);
+    }
+
+    if (directOutput && filterExpression.empty() && filterBounds.empty())
+    {
+        // if all inputs are already in the output format, their points (or compressed chunks)
+        // can be just copied to the output file, without going through a pipeline
+        bool copcOutput = ends_with(outputFile, ".copc.laz");
+        bool uncompressedInputs = canConcatenateLasFiles(inputFiles, false);
+
+        // if all inputs are already in the output format, their points (or compressed chunks)
+        // can be just copied to the output file, without going through a pipeline. COPC output
+        // is built directly from uncompressed inputs, without loading them in memory.
+        // The output gets written in finalize().
+        if ((inputFiles.size() > 1 && ends_with(outputFile, ".las") && uncompressedInputs) ||
+            (inputFiles.size() > 1 && isLazFilename(outputFile) && canConcatenateLasFiles(inputFiles, true)) ||
+            (copcOutput && uncompressedInputs))
+        {
+            concatenateInputs = true;
+            outputWithoutPipelines = true;
+            return;
+        }
+
+        // uncompressed inputs going to LAZ output: each input gets compressed by its own job
+        // and the compressed chunks are put together in finalize(). Other inputs going to COPC
+        // output get decompressed by their own jobs and the COPC file is built in finalize().
+        if ((isLazFilename(outputFile) && inputFiles.size() > 1 && uncompressedInputs) ||
+            (copcOutput && !uncompressedInputs))
+        {
+            fs::path outputParentDir = fs::path(outputFile).parent_path();
+            fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
+            fs::create_directories(outputSubdir);
+
+            for (size_t i = 0; i < inputFiles.size(); ++i)
+            {
+                ParallelJobInfo fileTile(ParallelJobInfo::FileBased, BOX2D(), filterExpression, filterBounds);
+                fileTile.inputFilenames.push_back(inputFiles[i]);
+                fileTile.outputFilename = tileOutputFileName(outputFile, "laz", outputSubdir, "input_" + std::to_string(i));
+                tileOutputFiles.push_back(fileTile.outputFilename);
+
+                pipelineCosts.push_back(inputCounts[i]);
+                pipelines.push_back(pipeline(&fileTile));
+            }
+            return;
+        }
+    }
+
     tile.inputFilenames = inputFiles;
     tile.outputFilename = outputFile;
 
@@ -179,12 +235,61 @@ void Merge::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipe
     }
 
     pipelines.push_back(pipeline(&tile));
+}
 
-    // only algs with single input have the number of points figured out already
-    totalPoints = 0;
-    for (const std::string& f : inputFiles)
+/**
+ * Writes output directly from the input files (copying points or compressed chunks, or building
+ * a COPC file). Returns false if that was not possible and the inputs need to go through a pipeline.
+ */
+static bool concatenateToOutput(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads)
+{
+    if (ends_with(outputFile, ".las"))
+        return concatenateLasFiles(inputFiles, outputFile, numThreads);
+    if (isLazFilename(outputFile))
+        return concatenateLazFiles(inputFiles, outputFile, numThreads);
+    return buildCopcFromLasFiles(inputFiles, outputFile, numThreads);
+}
+
+void Merge::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
+{
+    if (concatenateInputs)
     {
-        QuickInfo qi = getQuickInfo(f);
-        totalPoints += qi.m_pointCount;
+        if (concatenateToOutput(inputFiles, outputFile, max_threads))
+            return;
+
+        // inputs could not be put together directly (e.g. unusable LAZ chunk table) - use a merge pipeline,
+        // with the same options as this run
+        std::vector<std::string> args;
+        args.push_back("--output=" + outputFile);
+        args.push_back("--threads=" + std::to_string(max_threads));
+        if (verbose)
+            args.push_back("--verbose");
+        if (progressJson)
+            args.push_back("--progress-json");
+        if (!filterExpression.empty())
+            args.push_back("--filter=" + filterExpression);
+        if (!filterBounds.empty())
+            args.push_back("--bounds=" + filterBounds);
+        if (!profileFile.empty())
+            args.push_back("--profile=" + profileFile);
+        if (!memoryLimit.empty())
+            args.push_back("--memory-limit=" + memoryLimit);
+        args.insert(args.end(), inputFiles.begin(), inputFiles.end());
+
+        Merge merge;
+        merge.directOutput = false;
+        if (ends_with(outputFile, ".copc.laz"))
+            merge.isStreaming = false;
+        if (!runAlg(args, merge))
+        {
+            std::cerr << "Failed to merge inputs to " << outputFile << std::endl;
+            finalizeFailed = true;
+        }
+        return;
     }
+
+    if (tileOutputFiles.empty())
+        return;
+
+    buildOutput(outputFile, tileOutputFiles, max_threads);
 }
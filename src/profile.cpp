@@ -0,0 +1,491 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include "profile.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <pdal/Filter.hpp>
+#include <pdal/PluginInfo.hpp>
+#include <pdal/PluginManager.hpp>
+#include <pdal/Streamable.hpp>
+
+#include "nlohmann/json.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+
+// CPU time consumed by the current thread (in seconds)
+static double threadCpuTime()
+{
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+        return 0;
+    auto toSeconds = [](const FILETIME &t) { return ((uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 1e-7; };
+    return toSeconds(kernelTime) + toSeconds(userTime);
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+
+// Pipeline stages are measured using probe stages inserted after stages when the pipeline is built
+// (see profileProbe()), so a "stage" in the profile may also be a few stages without a probe between them.
+// Both in streaming and in standard mode, each stage processes all points of a chunk (or of the whole
+// point view) before the next stage starts, so the first time a probe sees a point in a chunk
+// marks the end of work of the stage before it. Time between two consecutive marks is attributed
+// to the stage between the probes, and time from the last mark until the chunk is done belongs to the last stage.
+struct PipelineProfile
+{
+    std::string name;
+    std::vector<std::string> stageNames;   // in the order of execution, the last one is usually a writer
+    std::vector<double> wallTime, cpuTime;
+    std::vector<point_count_t> points;     // number of points that came out of each stage
+
+    std::vector<bool> marked;
+    std::vector<Clock::time_point> markWall;
+    std::vector<double> markCpu;
+    Clock::time_point chunkStartWall;
+    double chunkStartCpu = 0;
+
+    Clock::time_point jobStartWall, jobEndWall;
+    int threadIndex = 0;
+
+    void addStage(const std::string &stageName)
+    {
+        stageNames.push_back(stageName);
+        wallTime.push_back(0);
+        cpuTime.push_back(0);
+        points.push_back(0);
+        marked.push_back(false);
+        markWall.push_back(Clock::time_point());
+        markCpu.push_back(0);
+    }
+
+    void mark(size_t stageIndex)
+    {
+        if (marked[stageIndex])
+            return;
+        marked[stageIndex] = true;
+        markWall[stageIndex] = Clock::now();
+        markCpu[stageIndex] = threadCpuTime();
+    }
+
+    void startChunk()
+    {
+        chunkStartWall = Clock::now();
+        chunkStartCpu = threadCpuTime();
+        std::fill(marked.begin(), marked.end(), false);
+    }
+
+    void closeChunk(point_count_t pointsWritten)
+    {
+        Clock::time_point prevWall = chunkStartWall;
+        double prevCpu = chunkStartCpu;
+        for (size_t i = 0; i + 1 < stageNames.size(); ++i)
+        {
+            if (!marked[i])
+                continue;  // the stage did not pass any points - its time goes to the next stage
+            wallTime[i] += std::chrono::duration<double>(markWall[i] - prevWall).count();
+            cpuTime[i] += markCpu[i] - prevCpu;
+            prevWall = markWall[i];
+            prevCpu = markCpu[i];
+        }
+
+        Clock::time_point nowWall = Clock::now();
+        double nowCpu = threadCpuTime();
+        wallTime.back() += std::chrono::duration<double>(nowWall - prevWall).count();
+        cpuTime.back() += nowCpu - prevCpu;
+        points.back() += pointsWritten;
+
+        startChunk();
+    }
+};
+
+
+static PluginInfo const s_probeInfo
+{
+    "filters.wrench_probe",
+    "Marks the time when the previous stage has finished (used by --profile)",
+    ""
+};
+
+// The probe is registered as a plugin so that it can be created by PipelineManager like any other
+// filter and become a regular stage of the pipeline.
+class ProbeFilter : public Filter, public Streamable
+{
+public:
+    std::string getName() const override { return s_probeInfo.name; }
+
+    void setProfile(const std::shared_ptr<PipelineProfile> &profile, size_t stageIndex)
+    {
+        m_profile = profile;
+        m_stageIndex = stageIndex;
+    }
+
+    const std::shared_ptr<PipelineProfile> &profile() const { return m_profile; }
+
+private:
+    virtual bool processOne(PointRef& point) override
+    {
+        (void)point;
+        m_profile->mark(m_stageIndex);
+        ++m_profile->points[m_stageIndex];
+        return true;
+    }
+
+    virtual void filter(PointView& view) override
+    {
+        m_profile->mark(m_stageIndex);
+        m_profile->points[m_stageIndex] += view.size();
+    }
+
+    // shared by all probes of the pipeline, so the profile lives as long as the pipeline
+    std::shared_ptr<PipelineProfile> m_profile;
+    size_t m_stageIndex = 0;
+};
+
+
+// Profile of the pipeline that the stage belongs to, found through probes that were already
+// added to the pipeline before the stage (or null if there are none yet).
+static std::shared_ptr<PipelineProfile> findProfile(Stage *stage)
+{
+    if (ProbeFilter *probe = dynamic_cast<ProbeFilter*>(stage))
+        return probe->profile();
+    for (Stage *input : stage->getInputs())
+    {
+        std::shared_ptr<PipelineProfile> profile = findProfile(input);
+        if (profile)
+            return profile;
+    }
+    return nullptr;
+}
+
+
+// Name of the part of the pipeline that ends with the given stage: stages are followed back
+// to the previous probe, and a stage with multiple inputs gets time of all its inputs included.
+static std::string stagesName(Stage *stage)
+{
+    std::string name = stage->getName();
+    while (stage->getInputs().size() == 1 && !dynamic_cast<ProbeFilter*>(stage->getInputs()[0]))
+    {
+        stage = stage->getInputs()[0];
+        name = stage->getName() + " + " + name;
+    }
+    if (stage->getInputs().size() > 1)
+        name += " (with inputs)";
+    return name;
+}
+
+
+// a step measured with ProfileScope
+struct ProfileStep
+{
+    std::string name;
+    Clock::time_point startWall, endWall;
+    double cpuTime;
+    int threadIndex;
+};
+
+struct Profiler
+{
+    bool enabled = false;
+    std::string outputFile;
+    Clock::time_point startTime;
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<PipelineProfile>> jobs;          // profiles of attached pipelines (in order)
+    std::map<PipelineManager*, PipelineProfile*> attached;       // attached pipelines that were not detached yet
+    std::vector<ProfileStep> steps;
+    std::map<std::thread::id, int> threadIndexes;
+
+    // needs to be called with the mutex locked
+    int currentThreadIndex()
+    {
+        auto it = threadIndexes.find(std::this_thread::get_id());
+        if (it != threadIndexes.end())
+            return it->second;
+        int index = (int)threadIndexes.size();
+        threadIndexes[std::this_thread::get_id()] = index;
+        return index;
+    }
+};
+
+static Profiler sProfiler;
+
+
+void profileInit(const std::string &outputFile)
+{
+    sProfiler.enabled = true;
+    sProfiler.outputFile = outputFile;
+    sProfiler.startTime = Clock::now();
+
+    PluginManager<Stage>::registerPlugin<ProbeFilter>(s_probeInfo);
+
+    // the main thread will be the first one in the trace
+    std::lock_guard<std::mutex> lock(sProfiler.mutex);
+    sProfiler.currentThreadIndex();
+}
+
+bool profileEnabled()
+{
+    return sProfiler.enabled;
+}
+
+Stage &profileProbe(PipelineManager *pipeline, Stage &stage)
+{
+    if (!sProfiler.enabled)
+        return stage;
+
+    std::shared_ptr<PipelineProfile> profile = findProfile(&stage);
+    if (!profile)
+        profile = std::make_shared<PipelineProfile>();
+
+    Stage &probe = pipeline->makeFilter(s_probeInfo.name, stage);
+    static_cast<ProbeFilter&>(probe).setProfile(profile, profile->stageNames.size());
+    profile->addStage(stagesName(&stage));
+    return probe;
+}
+
+void profileAttach(PipelineManager *pipeline, const std::string &jobName)
+{
+    if (!sProfiler.enabled)
+        return;
+
+    Stage *leaf = pipeline->getStage();
+    if (!leaf)
+        return;
+
+    Stage *first = leaf;
+    while (!first->getInputs().empty())
+        first = first->getInputs()[0];
+
+    // a pipeline without probes is measured as a single stage
+    std::shared_ptr<PipelineProfile> profile = findProfile(leaf);
+    if (!profile)
+        profile = std::make_shared<PipelineProfile>();
+
+    profile->name = jobName;
+    std::string inputFile = first->getOptions().getValueOrDefault<std::string>("filename", "");
+    if (!inputFile.empty())
+        profile->name += " (" + inputFile + ")";
+
+    // the rest of the pipeline after the last probe
+    profile->addStage(stagesName(leaf));
+
+    std::lock_guard<std::mutex> lock(sProfiler.mutex);
+    sProfiler.jobs.push_back(profile);
+    sProfiler.attached[pipeline] = profile.get();
+}
+
+void profileDetach(PipelineManager *pipeline)
+{
+    if (!sProfiler.enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(sProfiler.mutex);
+    sProfiler.attached.erase(pipeline);
+}
+
+PipelineProfile *profileForPipeline(PipelineManager *pipeline)
+{
+    if (!sProfiler.enabled)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(sProfiler.mutex);
+    auto it = sProfiler.attached.find(pipeline);
+    return it != sProfiler.attached.end() ? it->second : nullptr;
+}
+
+void profileJobStart(PipelineProfile *profile)
+{
+    if (!profile)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(sProfiler.mutex);
+        profile->threadIndex = sProfiler.currentThreadIndex();
+    }
+    profile->jobStartWall = Clock::now();
+    profile->startChunk();
+}
+
+void profileChunkDone(PipelineProfile *profile, point_count_t pointsWritten)
+{
+    if (profile)
+        profile->closeChunk(pointsWritten);
+}
+
+void profileJobEnd(PipelineProfile *profile, point_count_t pointsWritten)
+{
+    if (!profile)
+        return;
+
+    profile->closeChunk(pointsWritten);
+    profile->jobEndWall = Clock::now();
+}
+
+
+ProfileScope::ProfileScope(const std::string &name)
+{
+    if (!sProfiler.enabled)
+        return;
+
+    m_name = name;
+    m_startWall = Clock::now();
+    m_startCpu = threadCpuTime();
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (!sProfiler.enabled || m_name.empty())
+        return;
+
+    ProfileStep step;
+    step.name = m_name;
+    step.startWall = m_startWall;
+    step.endWall = Clock::now();
+    step.cpuTime = threadCpuTime() - m_startCpu;
+
+    std::lock_guard<std::mutex> lock(sProfiler.mutex);
+    step.threadIndex = sProfiler.currentThreadIndex();
+    sProfiler.steps.push_back(step);
+}
+
+
+bool profileWrite()
+{
+    if (!sProfiler.enabled)
+        return true;
+
+    std::lock_guard<std::mutex> lock(sProfiler.mutex);
+
+    auto microseconds = [](Clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - sProfiler.startTime).count();
+    };
+
+    nlohmann::ordered_json events = nlohmann::json::array();
+    struct Totals { double wallTime = 0, cpuTime = 0; point_count_t points = 0; size_t count = 0; };
+    std::map<std::string, Totals> stageTotals, stepTotals;
+
+    for (const std::shared_ptr<PipelineProfile> &jobProfile : sProfiler.jobs)
+    {
+        const PipelineProfile &profile = *jobProfile;
+        if (profile.jobEndWall == Clock::time_point())
+            continue;  // the pipeline has not been executed
+
+        nlohmann::ordered_json stages = nlohmann::json::array();
+        for (size_t i = 0; i < profile.stageNames.size(); ++i)
+        {
+            stages.push_back({
+                { "name", profile.stageNames[i] },
+                { "wall_time", profile.wallTime[i] },
+                { "cpu_time", profile.cpuTime[i] },
+                { "points", profile.points[i] },
+            });
+
+            Totals &t = stageTotals[profile.stageNames[i]];
+            t.wallTime += profile.wallTime[i];
+            t.cpuTime += profile.cpuTime[i];
+            t.points += profile.points[i];
+            t.count++;
+        }
+
+        events.push_back({
+            { "name", profile.name },
+            { "cat", "pipeline" },
+            { "ph", "X" },
+            { "ts", microseconds(profile.jobStartWall) },
+            { "dur", microseconds(profile.jobEndWall) - microseconds(profile.jobStartWall) },
+            { "pid", 1 },
+            { "tid", profile.threadIndex },
+            { "args", { { "stages", stages } } },
+        });
+    }
+
+    for (const ProfileStep &step : sProfiler.steps)
+    {
+        events.push_back({
+            { "name", step.name },
+            { "cat", "step" },
+            { "ph", "X" },
+            { "ts", microseconds(step.startWall) },
+            { "dur", microseconds(step.endWall) - microseconds(step.startWall) },
+            { "pid", 1 },
+            { "tid", step.threadIndex },
+            { "args", { { "cpu_time", step.cpuTime } } },
+        });
+
+        Totals &t = stepTotals[step.name];
+        t.wallTime += std::chrono::duration<double>(step.endWall - step.startWall).count();
+        t.cpuTime += step.cpuTime;
+        t.count++;
+    }
+
+    nlohmann::ordered_json stagesSummary = nlohmann::json::array();
+    for (const auto &it : stageTotals)
+    {
+        stagesSummary.push_back({
+            { "name", it.first },
+            { "pipelines", it.second.count },
+            { "wall_time", it.second.wallTime },
+            { "cpu_time", it.second.cpuTime },
+            { "points", it.second.points },
+        });
+    }
+    nlohmann::ordered_json stepsSummary = nlohmann::json::array();
+    for (const auto &it : stepTotals)
+    {
+        stepsSummary.push_back({
+            { "name", it.first },
+            { "count", it.second.count },
+            { "wall_time", it.second.wallTime },
+            { "cpu_time", it.second.cpuTime },
+        });
+    }
+
+    nlohmann::ordered_json root = {
+        { "traceEvents", events },
+        { "displayTimeUnit", "ms" },
+        { "summary", {
+            { "total_time", std::chrono::duration<double>(Clock::now() - sProfiler.startTime).count() },
+            { "stages", stagesSummary },
+            { "steps", stepsSummary },
+        } },
+    };
+
+    std::ofstream out(sProfiler.outputFile);
+    if (!out.good())
+    {
+        std::cerr << "Failed to write profile: " << sProfiler.outputFile << std::endl;
+        return false;
+    }
+    out << std::setw(2) << root << std::endl;
+    return out.good();
+}
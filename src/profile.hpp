@@ -0,0 +1,91 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <pdal/PipelineManager.hpp>
+
+using namespace pdal;
+
+/**
+ * Timing profile of a run (enabled with --profile): wall and CPU time of stages of pipelines
+ * (readers, filters, writers) together with numbers of points, and time of other steps
+ * like preparation of pipelines or finalization of results. The profile is written as a JSON
+ * file in Chrome trace format (can be opened in chrome://tracing or Perfetto), with an extra
+ * "summary" entry that has totals for each stage type.
+ */
+
+struct PipelineProfile;
+
+/**
+ * Enables profiling - results will be written to the given file by profileWrite().
+ */
+void profileInit(const std::string &outputFile);
+
+bool profileEnabled();
+
+/**
+ * Adds a probe stage after the given stage (to be used as input of the next stage) so that time
+ * spent in stages up to this one can be measured. Returns the stage itself if profiling is not enabled.
+ * The profile is owned by the probes of the pipeline, so it goes away with the pipeline unless attached.
+ */
+Stage &profileProbe(PipelineManager *pipeline, Stage &stage);
+
+/**
+ * Starts profiling of the pipeline once it is fully built (with probes added by profileProbe()).
+ * Does nothing if profiling is not enabled.
+ */
+void profileAttach(PipelineManager *pipeline, const std::string &jobName);
+
+/**
+ * To be called before an attached pipeline gets destroyed: its profile is kept for profileWrite(),
+ * but profileForPipeline() will not return it anymore (another pipeline may get the same address).
+ */
+void profileDetach(PipelineManager *pipeline);
+
+/**
+ * Returns profile of the pipeline (or null if profiling is not enabled or the pipeline is not attached).
+ */
+PipelineProfile *profileForPipeline(PipelineManager *pipeline);
+
+/**
+ * To be called when a job starts/ends executing the pipeline. In streaming mode, profileChunkDone()
+ * should be called whenever a chunk of points went through the whole pipeline.
+ */
+void profileJobStart(PipelineProfile *profile);
+void profileChunkDone(PipelineProfile *profile, point_count_t pointsWritten);
+void profileJobEnd(PipelineProfile *profile, point_count_t pointsWritten);
+
+/**
+ * Writes the profile to the file given in profileInit(). Returns false on error.
+ */
+bool profileWrite();
+
+/**
+ * Measures time of a block of code (e.g. a step in finalization of an algorithm).
+ */
+struct ProfileScope
+{
+    ProfileScope(const std::string &name);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope &other) = delete;
+    ProfileScope& operator=(const ProfileScope &other) = delete;
+
+private:
+    std::string m_name;
+    std::chrono::steady_clock::time_point m_startWall;
+    double m_startCpu = 0;
+};
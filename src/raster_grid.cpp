@@ -0,0 +1,620 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include "raster_grid.hpp"
+
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+
+#include <pdal/PluginInfo.hpp>
+#include <pdal/PluginManager.hpp>
+#include <pdal/Streamable.hpp>
+#include <pdal/Writer.hpp>
+
+#include "profile.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+
+// how much data may wait in the queue of the writer thread before jobs get blocked
+static const size_t MAX_QUEUED_BYTES = 512 * 1024 * 1024;
+
+// default block size of the COG driver - overviews are created until they fit into a single block
+static const int COG_BLOCK_SIZE = 512;
+
+
+RasterMosaic::RasterMosaic(const BOX2D &box, double resolution, GDALDataType dataType, double noData, bool sumValues)
+  : m_resolution(resolution), m_dataType(dataType), m_noData(noData), m_sumValues(sumValues)
+{
+    m_xSize = (std::max)(1, (int)std::llround((box.maxx - box.minx) / resolution));
+    m_ySize = (std::max)(1, (int)std::llround((box.maxy - box.miny) / resolution));
+    m_box = BOX2D(box.minx, box.miny, box.minx + m_xSize * resolution, box.miny + m_ySize * resolution);
+}
+
+RasterMosaic::~RasterMosaic()
+{
+    if (m_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+    if (m_ds)
+    {
+        GDALClose(m_ds);
+        std::error_code ec;
+        fs::remove(m_tempFile, ec);
+    }
+}
+
+bool RasterMosaic::open(const std::string &outputFile, const std::string &crsWkt)
+{
+    m_outputFile = outputFile;
+
+    GDALAllRegister();
+
+    // for /tmp/hello.tif the temporary raster will be /tmp/hello_mosaic.tif
+    fs::path outputPath(outputFile);
+    m_tempFile = (outputPath.parent_path() / (outputPath.stem().string() + "_mosaic.tif")).string();
+
+    // The temporary raster is not compressed: windows of jobs are generally not aligned with
+    // blocks of the GeoTIFF, and partially written compressed blocks would get rewritten
+    // at the end of the file. With sparse files, areas with no data take no space.
+    const char* createOpts[] = { "TILED=YES", "SPARSE_OK=TRUE", "BIGTIFF=IF_SAFER", NULL };
+    m_ds = GDALCreate(GDALGetDriverByName("GTiff"), m_tempFile.c_str(), m_xSize, m_ySize, 1, m_dataType, (char**)createOpts);
+    if (!m_ds)
+    {
+        std::cerr << "Failed to create raster: " << m_tempFile << std::endl;
+        return false;
+    }
+
+    double geoTransform[6] = { m_box.minx, m_resolution, 0, m_box.maxy, 0, -m_resolution };
+    GDALSetGeoTransform(m_ds, geoTransform);
+    if (!crsWkt.empty())
+        GDALSetProjection(m_ds, crsWkt.c_str());
+    // summed values start at zero: with no nodata value, blocks that were never written read as zeros
+    if (!m_sumValues)
+        GDALSetRasterNoDataValue(GDALGetRasterBand(m_ds, 1), m_noData);
+
+    // Create (empty) overviews, the same levels as the COG driver would create, until
+    // the overview fits into a single block. They get filled in by the writer thread
+    // as windows are written, so that they do not need to be computed at the end.
+    std::vector<int> overviewFactors;
+    int levelXSize = m_xSize, levelYSize = m_ySize;
+    for (int factor = 2; levelXSize > COG_BLOCK_SIZE || levelYSize > COG_BLOCK_SIZE; factor *= 2)
+    {
+        overviewFactors.push_back(factor);
+        levelXSize = (m_xSize + factor - 1) / factor;
+        levelYSize = (m_ySize + factor - 1) / factor;
+    }
+    if (!overviewFactors.empty() &&
+        GDALBuildOverviews(m_ds, "NONE", (int)overviewFactors.size(), overviewFactors.data(), 0, nullptr, nullptr, nullptr) != CE_None)
+    {
+        std::cerr << "Failed to create overviews: " << m_tempFile << std::endl;
+        return false;
+    }
+
+    m_thread = std::thread(&RasterMosaic::writerThread, this);
+    return true;
+}
+
+bool RasterMosaic::finish(int numThreads)
+{
+    if (!m_ds)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+
+    GDALClose(m_ds);
+    m_ds = nullptr;
+
+    bool ok = !m_failed;
+    if (!ok)
+        std::cerr << "Failed to write raster: " << m_tempFile << std::endl;
+    else
+    {
+        ProfileScope profileScope("rasterMosaicToCog");
+        ok = rasterToCog(m_tempFile, m_outputFile, numThreads);
+    }
+
+    std::error_code ec;
+    fs::remove(m_tempFile, ec);
+    return ok;
+}
+
+BOX2D RasterMosaic::snapToGrid(const BOX2D &box) const
+{
+    auto snapX = [this](double x) { return m_box.minx + std::round((x - m_box.minx) / m_resolution) * m_resolution; };
+    auto snapY = [this](double y) { return m_box.miny + std::round((y - m_box.miny) / m_resolution) * m_resolution; };
+    BOX2D b(snapX(box.minx), snapY(box.miny), snapX(box.maxx), snapY(box.maxy));
+    b.clip(m_box);
+    return b;
+}
+
+void RasterMosaic::boxToWindow(const BOX2D &box, int &xOff, int &yOff, int &xCount, int &yCount) const
+{
+    xOff = (int)std::llround((box.minx - m_box.minx) / m_resolution);
+    yOff = (int)std::llround((m_box.maxy - box.maxy) / m_resolution);
+    xCount = (int)std::llround((box.maxx - box.minx) / m_resolution);
+    yCount = (int)std::llround((box.maxy - box.miny) / m_resolution);
+}
+
+void RasterMosaic::addWindow(int xOff, int yOff, int xCount, int yCount, std::vector<double> &&values)
+{
+    size_t bytes = values.size() * sizeof(double);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return m_queuedBytes < MAX_QUEUED_BYTES || m_failed; });
+    if (m_failed)
+        return;
+    m_queue.push_back(Window{ xOff, yOff, xCount, yCount, std::move(values) });
+    m_queuedBytes += bytes;
+    lock.unlock();
+    m_cv.notify_all();
+}
+
+void RasterMosaic::writerThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return !m_queue.empty() || m_finished; });
+        if (m_queue.empty())
+            break;  // finished and everything has been written
+
+        Window w = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+
+        bool ok = !m_failed && writeWindow(w);
+
+        lock.lock();
+        m_queuedBytes -= w.values.size() * sizeof(double);
+        if (!ok)
+            m_failed = true;
+        m_cv.notify_all();
+    }
+}
+
+bool RasterMosaic::writeWindow(Window &w)
+{
+    GDALRasterBandH band = GDALGetRasterBand(m_ds, 1);
+
+    if (m_sumValues)
+    {
+        // add values to what has been written already by other jobs
+        std::vector<double> existing(w.values.size());
+        if (GDALRasterIO(band, GF_Read, w.xOff, w.yOff, w.xCount, w.yCount, existing.data(), w.xCount, w.yCount, GDT_Float64, 0, 0) != CE_None)
+            return false;
+
+        for (size_t i = 0; i < existing.size(); ++i)
+        {
+            if (w.values[i] == m_noData)
+                w.values[i] = existing[i];
+            else if (existing[i] != m_noData)
+                w.values[i] += existing[i];
+        }
+    }
+
+    if (GDALRasterIO(band, GF_Write, w.xOff, w.yOff, w.xCount, w.yCount, w.values.data(), w.xCount, w.yCount, GDT_Float64, 0, 0) != CE_None)
+        return false;
+
+    return updateOverviews(w.xOff, w.yOff, w.xCount, w.yCount);
+}
+
+bool RasterMosaic::updateOverviews(int xOff, int yOff, int xCount, int yCount)
+{
+    // Each overview level is calculated from the previous level by averaging 2x2 cells
+    // (ignoring cells with no data). Cells at the edges of the window may also depend on cells
+    // of neighboring windows that have not been written yet - they get calculated again
+    // when the neighboring window is written.
+    GDALRasterBandH srcBand = GDALGetRasterBand(m_ds, 1);
+    int srcXSize = m_xSize, srcYSize = m_ySize;
+    int x0 = xOff, y0 = yOff, x1 = xOff + xCount, y1 = yOff + yCount;
+    std::vector<double> src, dst;
+
+    int overviewCount = GDALGetOverviewCount(srcBand);
+    for (int i = 0; i < overviewCount; ++i)
+    {
+        GDALRasterBandH ovrBand = GDALGetOverview(GDALGetRasterBand(m_ds, 1), i);
+        int ovrXSize = GDALGetRasterBandXSize(ovrBand), ovrYSize = GDALGetRasterBandYSize(ovrBand);
+
+        // cells of the overview affected by the window, and the cells of the source they are calculated from
+        x0 /= 2;
+        y0 /= 2;
+        x1 = (std::min)(ovrXSize, (x1 + 1) / 2);
+        y1 = (std::min)(ovrYSize, (y1 + 1) / 2);
+        int sx0 = x0 * 2, sy0 = y0 * 2;
+        int sxCount = (std::min)(srcXSize, x1 * 2) - sx0, syCount = (std::min)(srcYSize, y1 * 2) - sy0;
+        int dxCount = x1 - x0, dyCount = y1 - y0;
+
+        src.resize((size_t)sxCount * syCount);
+        if (GDALRasterIO(srcBand, GF_Read, sx0, sy0, sxCount, syCount, src.data(), sxCount, syCount, GDT_Float64, 0, 0) != CE_None)
+            return false;
+
+        dst.assign((size_t)dxCount * dyCount, m_noData);
+        for (int dy = 0; dy < dyCount; ++dy)
+        {
+            for (int dx = 0; dx < dxCount; ++dx)
+            {
+                double sum = 0;
+                int count = 0;
+                for (int sy = dy * 2; sy < (std::min)(syCount, dy * 2 + 2); ++sy)
+                {
+                    for (int sx = dx * 2; sx < (std::min)(sxCount, dx * 2 + 2); ++sx)
+                    {
+                        double v = src[(size_t)sy * sxCount + sx];
+                        if (v != m_noData)
+                        {
+                            sum += v;
+                            ++count;
+                        }
+                    }
+                }
+                if (count)
+                    dst[(size_t)dy * dxCount + dx] = sum / count;
+            }
+        }
+
+        if (GDALRasterIO(ovrBand, GF_Write, x0, y0, dxCount, dyCount, dst.data(), dxCount, dyCount, GDT_Float64, 0, 0) != CE_None)
+            return false;
+
+        srcBand = ovrBand;
+        srcXSize = ovrXSize;
+        srcYSize = ovrYSize;
+    }
+    return true;
+}
+
+
+/////////////
+
+
+static PluginInfo const s_info
+{
+    "writers.wrench_grid",
+    "Bins points into a raster grid (used internally by pdal_wrench)",
+    ""
+};
+
+// cells are kept in square blocks that are only allocated when some points fall in them,
+// so that the data of a cell and its neighbors stay close in memory
+static const int BLOCK_BITS = 6;
+static const int BLOCK_SIZE = 1 << BLOCK_BITS;    // 64x64 cells
+static const int BLOCK_MASK = BLOCK_SIZE - 1;
+
+// points are binned in batches so that the computation of cells can be vectorized by the compiler
+static const size_t BATCH_SIZE = 4096;
+
+
+class GridWriter : public Writer, public Streamable
+{
+public:
+    std::string getName() const override { return s_info.name; }
+
+    void setup(RasterMosaic *mosaic, const BOX2D &box, GridOutputType outputType, const std::string &dimension, double radius)
+    {
+        m_mosaic = mosaic;
+        m_outputType = outputType;
+        m_dimension = dimension;
+        m_radius = radius;
+
+        if (box.valid())
+            mosaic->boxToWindow(mosaic->snapToGrid(box), m_xOff, m_yOff, m_xCount, m_yCount);
+        else
+        {
+            m_xOff = m_yOff = 0;
+            m_xCount = mosaic->xSize();
+            m_yCount = mosaic->ySize();
+        }
+    }
+
+private:
+    struct Block
+    {
+        std::vector<uint32_t> count;   // count only: number of points
+        std::vector<double> value;     // idw only: weighted sum of values
+        std::vector<double> weight;    // idw only: sum of weights (NaN if a point is exactly at the cell center)
+    };
+
+    virtual void prepared(PointTableRef table) override
+    {
+        if (m_outputType != GridOutputType::Count)
+        {
+            m_dimId = table.layout()->findDim(m_dimension);
+            if (m_dimId == Dimension::Id::Unknown)
+                throwError("Dimension '" + m_dimension + "' does not exist.");
+        }
+    }
+
+    virtual void ready(PointTableRef table) override
+    {
+        (void)table;
+        BOX2D mosaicBox = m_mosaic->box();
+        m_res = m_mosaic->resolution();
+        m_invRes = 1 / m_res;
+        m_gridMinX = mosaicBox.minx;
+        m_gridMaxY = mosaicBox.maxy;
+        m_windowMinX = mosaicBox.minx + m_xOff * m_res;
+        m_windowMaxY = mosaicBox.maxy - m_yOff * m_res;
+
+        m_blocksX = (m_xCount + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        m_blocksY = (m_yCount + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        m_blocks.clear();
+        m_blocks.resize((size_t)m_blocksX * m_blocksY);
+
+        m_batchX.resize(BATCH_SIZE);
+        m_batchY.resize(BATCH_SIZE);
+        m_batchValue.resize(BATCH_SIZE);
+        m_batchCol.resize(BATCH_SIZE);
+        m_batchRow.resize(BATCH_SIZE);
+        m_batchSize = 0;
+    }
+
+    virtual bool processOne(PointRef& point) override
+    {
+        m_batchX[m_batchSize] = point.getFieldAs<double>(Dimension::Id::X);
+        m_batchY[m_batchSize] = point.getFieldAs<double>(Dimension::Id::Y);
+        if (m_outputType != GridOutputType::Count)
+            m_batchValue[m_batchSize] = point.getFieldAs<double>(m_dimId);
+        if (++m_batchSize == BATCH_SIZE)
+            addBatch();
+        return true;
+    }
+
+    virtual void write(const PointViewPtr view) override
+    {
+        PointRef point(*view, 0);
+        for (PointId idx = 0; idx < view->size(); ++idx)
+        {
+            point.setPointId(idx);
+            processOne(point);
+        }
+    }
+
+    virtual void done(PointTableRef table) override
+    {
+        (void)table;
+        addBatch();
+
+        // only the part of the window with some points gets written: jobs with a range of points
+        // of a single input have the whole grid as their window, but their points usually cover
+        // just a part of it (their counts get summed in the mosaic, where the other cells stay zero).
+        // Otherwise counts are written for the whole window, with zeros where there are no points.
+        int bxMin = m_blocksX, bxMax = -1, byMin = m_blocksY, byMax = -1;
+        for (int by = 0; by < m_blocksY; ++by)
+        {
+            for (int bx = 0; bx < m_blocksX; ++bx)
+            {
+                if (!m_blocks[(size_t)by * m_blocksX + bx])
+                    continue;
+                bxMin = (std::min)(bxMin, bx);
+                bxMax = (std::max)(bxMax, bx);
+                byMin = (std::min)(byMin, by);
+                byMax = (std::max)(byMax, by);
+            }
+        }
+        if (m_outputType == GridOutputType::Count && !m_mosaic->sumValues())
+        {
+            bxMin = byMin = 0;
+            bxMax = m_blocksX - 1;
+            byMax = m_blocksY - 1;
+        }
+        if (bxMax >= 0)
+        {
+            int colBegin = bxMin * BLOCK_SIZE, rowBegin = byMin * BLOCK_SIZE;
+            int colEnd = (std::min)(m_xCount, (bxMax + 1) * BLOCK_SIZE);
+            int rowEnd = (std::min)(m_yCount, (byMax + 1) * BLOCK_SIZE);
+            m_mosaic->addWindow(m_xOff + colBegin, m_yOff + rowBegin, colEnd - colBegin, rowEnd - rowBegin,
+                                windowValues(colBegin, rowBegin, colEnd, rowEnd));
+        }
+        m_blocks.clear();
+    }
+
+    Block &block(int col, int row)
+    {
+        std::unique_ptr<Block> &b = m_blocks[(size_t)(row >> BLOCK_BITS) * m_blocksX + (col >> BLOCK_BITS)];
+        if (!b)
+        {
+            b.reset(new Block);
+            if (m_outputType == GridOutputType::Idw)
+                b->weight.resize(BLOCK_SIZE * BLOCK_SIZE, 0);
+            else
+                b->count.resize(BLOCK_SIZE * BLOCK_SIZE, 0);
+            if (m_outputType != GridOutputType::Count)
+                b->value.resize(BLOCK_SIZE * BLOCK_SIZE, 0);
+        }
+        return *b;
+    }
+
+    static size_t cellInBlock(int col, int row)
+    {
+        return ((size_t)(row & BLOCK_MASK) << BLOCK_BITS) | (size_t)(col & BLOCK_MASK);
+    }
+
+    void addBatch()
+    {
+        if (m_outputType == GridOutputType::Idw)
+            addBatchIdw();
+        else
+            addBatchBins();
+        m_batchSize = 0;
+    }
+
+    void addBatchBins()
+    {
+        // first calculate cells of all points in the batch (no branches, so this can be vectorized)
+        const int gridXSize = m_mosaic->xSize(), gridYSize = m_mosaic->ySize();
+        for (size_t i = 0; i < m_batchSize; ++i)
+        {
+            double fx = (m_batchX[i] - m_gridMinX) * m_invRes;
+            double fy = (m_gridMaxY - m_batchY[i]) * m_invRes;
+            // NaN coordinates or points far outside of the grid can't be converted to int
+            bool valid = fx >= 0 && fx <= gridXSize && fy >= 0 && fy <= gridYSize;
+            int col = valid ? (int)fx : -1;
+            int row = valid ? (int)fy : -1;
+            // points exactly at the right/bottom edge of the whole grid belong to the last column/row
+            col -= (col == gridXSize);
+            row -= (row == gridYSize);
+            col -= m_xOff;
+            row -= m_yOff;
+            bool inside = (unsigned)col < (unsigned)m_xCount && (unsigned)row < (unsigned)m_yCount;
+            m_batchCol[i] = inside ? col : -1;
+            m_batchRow[i] = row;
+        }
+
+        for (size_t i = 0; i < m_batchSize; ++i)
+        {
+            int col = m_batchCol[i], row = m_batchRow[i];
+            if (col < 0)
+                continue;
+
+            ++block(col, row).count[cellInBlock(col, row)];
+        }
+    }
+
+    void addBatchIdw()
+    {
+        // every point contributes to all cells whose centers are within the radius,
+        // with weight 1/distance (same as idw in writers.gdal)
+        const double radiusCells = m_radius * m_invRes;
+        for (size_t i = 0; i < m_batchSize; ++i)
+        {
+            // position of the point in the window, in units of cells, relative to the center of the first cell
+            double fx = (m_batchX[i] - m_windowMinX) * m_invRes - 0.5;
+            double fy = (m_windowMaxY - m_batchY[i]) * m_invRes - 0.5;
+            if (!std::isfinite(fx) || !std::isfinite(fy))
+                continue;
+            double colMin = (std::max)(0.0, std::ceil(fx - radiusCells));
+            double colMax = (std::min)(m_xCount - 1.0, std::floor(fx + radiusCells));
+            double rowMin = (std::max)(0.0, std::ceil(fy - radiusCells));
+            double rowMax = (std::min)(m_yCount - 1.0, std::floor(fy + radiusCells));
+            if (colMin > colMax || rowMin > rowMax)
+                continue;
+
+            double v = m_batchValue[i];
+            for (int row = (int)rowMin; row <= (int)rowMax; ++row)
+            {
+                double dy = (row - fy) * m_res;
+                for (int col = (int)colMin; col <= (int)colMax; ++col)
+                {
+                    double dx = (col - fx) * m_res;
+                    double dist = std::sqrt(dx * dx + dy * dy);
+                    if (dist > m_radius)
+                        continue;
+
+                    Block &b = block(col, row);
+                    size_t k = cellInBlock(col, row);
+                    if (std::isnan(b.weight[k]))
+                        continue;  // there is a point exactly at the center of the cell
+                    if (dist == 0)
+                    {
+                        b.value[k] = v;
+                        b.weight[k] = std::numeric_limits<double>::quiet_NaN();
+                    }
+                    else
+                    {
+                        b.value[k] += v / dist;
+                        b.weight[k] += 1 / dist;
+                    }
+                }
+            }
+        }
+    }
+
+    // values of cells in the given part of the window (begin/end columns and rows aligned to blocks),
+    // cells without points are zero for count and nodata otherwise
+    std::vector<double> windowValues(int colBegin, int rowBegin, int colEnd, int rowEnd) const
+    {
+        const double empty = m_outputType == GridOutputType::Count ? 0 : m_mosaic->noData();
+        const int xCount = colEnd - colBegin;
+        std::vector<double> values((size_t)xCount * (rowEnd - rowBegin), empty);
+        for (int by = rowBegin / BLOCK_SIZE; by * BLOCK_SIZE < rowEnd; ++by)
+        {
+            for (int bx = colBegin / BLOCK_SIZE; bx * BLOCK_SIZE < colEnd; ++bx)
+            {
+                const Block *b = m_blocks[(size_t)by * m_blocksX + bx].get();
+                if (!b)
+                    continue;
+
+                int blockRowEnd = (std::min)(rowEnd, (by + 1) * BLOCK_SIZE);
+                int blockColEnd = (std::min)(colEnd, (bx + 1) * BLOCK_SIZE);
+                for (int row = by * BLOCK_SIZE; row < blockRowEnd; ++row)
+                {
+                    for (int col = bx * BLOCK_SIZE; col < blockColEnd; ++col)
+                    {
+                        size_t k = cellInBlock(col, row);
+                        double &out = values[(size_t)(row - rowBegin) * xCount + (col - colBegin)];
+                        switch (m_outputType)
+                        {
+                        case GridOutputType::Count:
+                            out = b->count[k];
+                            break;
+                        case GridOutputType::Idw:
+                            if (std::isnan(b->weight[k]))
+                                out = b->value[k];
+                            else if (b->weight[k] > 0)
+                                out = b->value[k] / b->weight[k];
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        return values;
+    }
+
+    RasterMosaic *m_mosaic = nullptr;
+    GridOutputType m_outputType = GridOutputType::Count;
+    std::string m_dimension;
+    Dimension::Id m_dimId = Dimension::Id::Unknown;
+    double m_radius = 0;
+
+    // window of the mosaic written by this stage
+    int m_xOff = 0, m_yOff = 0, m_xCount = 0, m_yCount = 0;
+
+    double m_res = 0, m_invRes = 0;
+    double m_gridMinX = 0, m_gridMaxY = 0;      // top-left corner of the mosaic
+    double m_windowMinX = 0, m_windowMaxY = 0;  // top-left corner of the window
+
+    int m_blocksX = 0, m_blocksY = 0;
+    std::vector<std::unique_ptr<Block>> m_blocks;
+
+    size_t m_batchSize = 0;
+    std::vector<double> m_batchX, m_batchY, m_batchValue;
+    std::vector<int> m_batchCol, m_batchRow;
+};
+
+
+Stage &makeGridWriter(PipelineManager *manager, RasterMosaic *mosaic, const BOX2D &box,
+                      GridOutputType outputType, const std::string &dimension, double radius)
+{
+    // the stage is not built into PDAL, so it needs to be registered before PDAL can create it
+    static std::once_flag registered;
+    std::call_once(registered, [] { PluginManager<Stage>::registerPlugin<GridWriter>(s_info); });
+
+    pdal::StageCreationOptions opts{ "", s_info.name, nullptr, pdal::Options(), "" };
+    Stage &w = manager->makeWriter(opts);
+    static_cast<GridWriter&>(w).setup(mosaic, box, outputType, dimension, radius);
+    return w;
+}
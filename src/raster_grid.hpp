@@ -0,0 +1,135 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pdal/PipelineManager.hpp>
+
+#include <gdal.h>
+
+using namespace pdal;
+
+/**
+ * Native rasterization of points used by density and to_raster: instead of each job writing
+ * its own GeoTIFF with writers.gdal (which then get merged through a VRT), each job bins points
+ * into an in-memory grid (GridWriter stage) and when it is done, its part of the grid is handed
+ * over to RasterMosaic, where a single background thread writes it to the output raster.
+ */
+
+enum class GridOutputType
+{
+    Count,   // number of points in a cell
+    Idw,     // inverse distance weighting of points within a radius from the cell center
+};
+
+
+/**
+ * Raster covering a box with a given resolution. Parts of the raster (windows) are
+ * queued by addWindow() from any thread, and they get written by a single writer thread
+ * to a temporary GeoTIFF, which gets converted to COG in the end by finish(). Overviews of the raster
+ * are also updated by the writer thread whenever a window is written, while other jobs are still running.
+ */
+class RasterMosaic
+{
+public:
+    /**
+     * Grid will have its origin at the lower-left corner of the box. If sumValues is true,
+     * values of windows are added to the existing values (used when multiple jobs produce
+     * partial counts for the same area), and cells that no window covers are zero.
+     */
+    RasterMosaic(const BOX2D &box, double resolution, GDALDataType dataType, double noData, bool sumValues = false);
+    ~RasterMosaic();
+
+    RasterMosaic(const RasterMosaic &other) = delete;
+    RasterMosaic& operator=(const RasterMosaic &other) = delete;
+
+    /**
+     * Creates the temporary raster (next to the output file) and starts the writer thread.
+     */
+    bool open(const std::string &outputFile, const std::string &crsWkt);
+
+    /**
+     * Waits until all windows are written, then writes the final COG to the output file
+     * (compressed using numThreads threads) and removes the temporary raster. Returns false on error.
+     */
+    bool finish(int numThreads);
+
+    BOX2D box() const { return m_box; }
+    double resolution() const { return m_resolution; }
+    int xSize() const { return m_xSize; }
+    int ySize() const { return m_ySize; }
+    double noData() const { return m_noData; }
+    bool sumValues() const { return m_sumValues; }
+
+    /**
+     * Returns the box snapped to the edges of the cells of this grid (and clipped to the grid).
+     */
+    BOX2D snapToGrid(const BOX2D &box) const;
+
+    /**
+     * Converts box to a window of cells of this grid (the box is expected to be snapped to grid).
+     */
+    void boxToWindow(const BOX2D &box, int &xOff, int &yOff, int &xCount, int &yCount) const;
+
+    /**
+     * Queues values of a window (row-major, top row first) to be written. If too much data
+     * is waiting to be written, the call blocks until the writer thread catches up.
+     */
+    void addWindow(int xOff, int yOff, int xCount, int yCount, std::vector<double> &&values);
+
+private:
+    struct Window
+    {
+        int xOff, yOff, xCount, yCount;
+        std::vector<double> values;
+    };
+
+    void writerThread();
+    bool writeWindow(Window &w);
+    bool updateOverviews(int xOff, int yOff, int xCount, int yCount);
+
+    BOX2D m_box;
+    double m_resolution;
+    int m_xSize = 0, m_ySize = 0;
+    GDALDataType m_dataType;
+    double m_noData;
+    bool m_sumValues;
+
+    std::string m_outputFile;
+    std::string m_tempFile;
+    GDALDatasetH m_ds = nullptr;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Window> m_queue;
+    size_t m_queuedBytes = 0;
+    bool m_finished = false;
+    bool m_failed = false;
+};
+
+
+/**
+ * Creates "writers.wrench_grid" stage in the pipeline that bins points of its inputs into a window
+ * of the mosaic given by the box (or the whole mosaic if the box is not valid). For Idw output type,
+ * radius is the maximum distance of points from cell centers (points outside of the box within
+ * the radius are used too). Dimension is not used for Count output type.
+ */
+Stage &makeGridWriter(PipelineManager *manager, RasterMosaic *mosaic, const BOX2D &box,
+                      GridOutputType outputType, const std::string &dimension = std::string(), double radius = 0);
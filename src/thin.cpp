@@ -100,7 +100,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
 {
     std::unique_ptr<PipelineManager> manager( new PipelineManager );
 
-    Stage& r = makeReader(manager.get(), tile->inputFilenames[0]);
+    Stage& r = makeReader(manager.get(), tile->inputFilenames[0], pointRangeReaderOptions(*tile));
 
     Stage *last = &r;
 
@@ -118,27 +118,27 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
         else
         {
             // Reader can't do the filtering - do it with a filter
-            last = &manager->makeFilter( "filters.crop", *last, filter_opts);
+            last = &makeFilter(manager.get(), "filters.crop", *last, filter_opts);
         }
     }
     if (!tile->filterExpression.empty())
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", tile->filterExpression));
-        last = &manager->makeFilter( "filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
     if (mode == "every-nth")
     {
         pdal::Options decim_opts;
         decim_opts.add(pdal::Option("step", stepEveryN));
-        last = &manager->makeFilter( "filters.decimation", *last, decim_opts );
+        last = &makeFilter(manager.get(), "filters.decimation", *last, decim_opts );
     }
     else if (mode == "sample")
     {
         pdal::Options sample_opts;
         sample_opts.add(pdal::Option("cell", stepSample));
-        last = &manager->makeFilter( "filters.sample", *last, sample_opts );
+        last = &makeFilter(manager.get(), "filters.sample", *last, sample_opts );
     }
 
     makeWriter(manager.get(), tile->outputFilename, last);
@@ -170,11 +170,43 @@ void Thin::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipel
 
             tileOutputFiles.push_back(tile.outputFilename);
 
+            pipelineCosts.push_back(f.count);
             pipelines.push_back(pipeline(&tile, mode, stepEveryN, stepSample));
         }
     }
     else
     {
+        // sampling depends on neighboring points so only every-nth mode can be split to ranges of points:
+        // with sizes of ranges being multiples of the step the result is the same as with a single job
+        // (as long as no points get filtered out before decimation)
+        std::vector<std::pair<point_count_t, point_count_t>> ranges;
+        if (mode == "every-nth" && stepEveryN > 0 && filterExpression.empty() && filterBounds.empty())
+            ranges = pointRanges(inputFile, totalPoints, max_threads, stepEveryN);
+
+        if (!ranges.empty())
+        {
+            // for /tmp/hello.laz we will use /tmp/hello dir for all results
+            fs::path outputParentDir = fs::path(outputFile).parent_path();
+            fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
+            fs::create_directories(outputSubdir);
+
+            for (size_t i = 0; i < ranges.size(); ++i)
+            {
+                ParallelJobInfo tile(ParallelJobInfo::PointRange, BOX2D(), filterExpression, filterBounds);
+                tile.inputFilenames.push_back(inputFile);
+                tile.pointStart = ranges[i].first;
+                tile.pointCount = ranges[i].second;
+
+                std::string rangeName = fileStem(inputFile).string() + "_" + std::to_string(i);
+                tile.outputFilename = tileOutputFileName(outputFile, outputFormatVpc, outputSubdir, rangeName);
+
+                tileOutputFiles.push_back(tile.outputFilename);
+
+                pipelines.push_back(pipeline(&tile, mode, stepEveryN, stepSample));
+            }
+            return;
+        }
+
         if (ends_with(outputFile, ".copc.laz"))
         {
             isStreaming = false;
@@ -191,29 +223,5 @@ void Thin::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
     if (tileOutputFiles.empty())
         return;
 
-    // now build a new output VPC
-    std::vector<std::string> args;
-    args.push_back("--output=" + outputFile);
-    for (std::string f : tileOutputFiles)
-        args.push_back(f);
-    
-    if (isVpcFilename(outputFile))
-    {
-        // now build a new output VPC
-        buildVpc(args);
-    }
-    else
-    {
-        // merge all the output files into a single file        
-        Merge merge;
-        // for copc set isStreaming to false
-        if (ends_with(outputFile, ".copc.laz"))
-        {
-            merge.isStreaming = false;
-        }
-        runAlg(args, merge);
-
-        // remove files as they are not needed anymore - they are merged
-        removeFiles(tileOutputFiles, true);
-    }
+    buildOutput(outputFile, tileOutputFiles, max_threads);
 }
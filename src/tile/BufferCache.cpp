@@ -12,6 +12,7 @@
 
 
 #include <mutex>
+#include <thread>
 
 #include "BufferCache.hpp"
 
@@ -22,32 +23,50 @@ namespace epf
 
 // If we have a buffer in the cache, return it. Otherwise create a new one and return that.
 // If nonblock is true and there are no available buffers, return null.
-DataVecPtr BufferCache::fetch(std::unique_lock<std::mutex>& lock, bool nonblock)
+DataVecPtr BufferCache::fetch(bool nonblock)
 {
-    if (nonblock && m_buffers.empty() && m_count >= MaxBuffers)
-        return nullptr;
+    DataVecPtr buf;
+    if (m_buffers.pop(buf))
+        return buf;
 
-    m_cv.wait(lock, [this](){ return m_buffers.size() || m_count < MaxBuffers; });
-    if (m_buffers.size())
+    // m_count tracks the number of created buffers. We only create MaxBuffers buffers.
+    int count = m_count.load();
+    while (count < MaxBuffers)
     {
-        DataVecPtr buf(std::move(m_buffers.back()));
-        m_buffers.pop_back();
-        return buf;
+        if (m_count.compare_exchange_weak(count, count + 1))
+            return DataVecPtr(new DataVec(BufSize));
     }
 
-    // m_count tracks the number of created buffers. We only create MaxBuffers buffers.
+    if (nonblock)
+        return nullptr;
+
     // If we've created that many, we wait until one is available.
-    m_count++;
-    return DataVecPtr(new DataVec(BufSize));
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ++m_waiting;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_cv.wait(lock, [this, &buf](){ return m_buffers.pop(buf); });
+    --m_waiting;
+    return buf;
 }
 
 // Put a buffer back in the cache.
 void BufferCache::replace(DataVecPtr&& buf)
 {
-    m_buffers.push_back(std::move(buf));
+    // There is always space in the queue for all MaxBuffers buffers, but a push can still fail
+    // for a moment while another thread is in the middle of popping from the same slot.
+    while (!m_buffers.push(buf))
+        std::this_thread::yield();
 
-    if (m_count == MaxBuffers)
+    // Together with the fence in fetch(), either we see the waiting thread or it sees the buffer.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiting)
+    {
+        // The waiting thread holds the mutex until it waits, so it can't miss the notification.
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
         m_cv.notify_one();
+    }
 }
 
 } // namespace epf
@@ -13,11 +13,12 @@
 
 #pragma once
 
-#include <deque>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 
 #include "EpfTypes.hpp"
+#include "MpmcQueue.hpp"
 
 namespace untwine
 {
@@ -25,19 +26,24 @@ namespace epf
 {
 
 // This is simply a cache of data buffers to avoid continuous allocation and deallocation.
+// Free buffers are kept in a lock-free queue, so fetching and replacing buffers does not
+// need any lock. The mutex is only used by threads waiting for a buffer when all MaxBuffers
+// buffers are in use.
 class BufferCache
 {
 public:
-    BufferCache() : m_count(0)
+    BufferCache() : m_buffers(MaxBuffers), m_count(0), m_waiting(0)
     {}
 
-    DataVecPtr fetch(std::unique_lock<std::mutex>& lock, bool nonblock);
+    DataVecPtr fetch(bool nonblock);
     void replace(DataVecPtr&& buf);
 
 private:
-    std::deque<DataVecPtr> m_buffers;
+    MpmcQueue<DataVecPtr> m_buffers;
+    std::atomic<int> m_count;    // number of buffers created so far
+    std::atomic<int> m_waiting;  // number of threads waiting for a free buffer
+    std::mutex m_mutex;
     std::condition_variable m_cv;
-    int m_count;
 };
 
 } // namespace epf
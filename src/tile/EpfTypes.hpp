@@ -38,6 +38,7 @@ constexpr int BufSize = 4096 * 10;
 constexpr int MaxBuffers = 1000;
 constexpr int NumWriters = 4;
 constexpr int NumFileProcessors = 8;
+constexpr int MaxOpenTileFiles = 256;
 
 struct FileInfo
 {
@@ -0,0 +1,202 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "FileHandleCache.hpp"
+#include "Common.hpp"
+
+namespace untwine
+{
+namespace epf
+{
+
+#ifdef _WIN32
+
+TileFile::TileFile(const std::string& filename, bool truncate) : m_filename(filename)
+{
+    m_out.open(toNative(filename), (truncate ? std::ios::trunc : std::ios::app) | std::ios::binary);
+    if (!m_out)
+        throw FatalError("Can't open '" + m_filename + "' for writing.");
+}
+
+TileFile::~TileFile()
+{}
+
+void TileFile::write(const std::vector<Chunk>& chunks)
+{
+    for (const Chunk& c : chunks)
+        m_out.write(reinterpret_cast<const char *>(c.data), c.size);
+    if (!m_out)
+        throw FatalError("Failure writing to '" + m_filename + "'.");
+}
+
+void TileFile::close()
+{
+    m_out.close();
+    if (!m_out)
+        throw FatalError("Failure writing to '" + m_filename + "'.");
+}
+
+#else
+
+TileFile::TileFile(const std::string& filename, bool truncate) : m_filename(filename)
+{
+    m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+    if (m_fd < 0)
+        throw FatalError("Can't open '" + m_filename + "' for writing: " + std::strerror(errno));
+}
+
+TileFile::~TileFile()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+void TileFile::write(const std::vector<Chunk>& chunks)
+{
+    std::vector<iovec> iov;
+    iov.reserve(chunks.size());
+    for (const Chunk& c : chunks)
+        if (c.size)
+            iov.push_back({ const_cast<void *>(c.data), c.size });
+
+    // writev() takes at most IOV_MAX buffers and may write less than asked for,
+    // in which case we continue from where it stopped.
+    size_t pos = 0;
+    while (pos < iov.size())
+    {
+        int count = (int)(std::min)(iov.size() - pos, (size_t)IOV_MAX);
+        ssize_t written = ::writev(m_fd, iov.data() + pos, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw FatalError("Failure writing to '" + m_filename + "': " + std::strerror(errno));
+        }
+        while (pos < iov.size() && (size_t)written >= iov[pos].iov_len)
+            written -= iov[pos++].iov_len;
+        if (written)
+        {
+            iov[pos].iov_base = static_cast<char *>(iov[pos].iov_base) + written;
+            iov[pos].iov_len -= written;
+        }
+    }
+}
+
+void TileFile::close()
+{
+    int fd = m_fd;
+    m_fd = -1;
+    if (::close(fd) != 0)
+        throw FatalError("Failure writing to '" + m_filename + "': " + std::strerror(errno));
+}
+
+#endif
+
+
+FileHandleCache::FileHandleCache(size_t maxOpenFiles, std::vector<char> fileHeader) :
+    m_maxOpenFiles(maxOpenFiles), m_fileHeader(std::move(fileHeader))
+{}
+
+TileFile *FileHandleCache::acquire(const TileKey& key, const std::string& filename)
+{
+    std::vector<std::unique_ptr<TileFile>> evicted;
+    TileFile *file;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        auto it = m_files.find(key);
+        if (it != m_files.end())
+        {
+            Entry& e = it->second;
+            e.inUse = true;
+            m_lru.splice(m_lru.begin(), m_lru, e.lruPos);
+            return e.file.get();
+        }
+
+        bool create = m_fileHeader.size() && m_created.insert(key).second;
+
+        // Opening the file can take a while - don't hold the lock. Nobody else
+        // is going to acquire the same key in the meantime.
+        lock.unlock();
+        std::unique_ptr<TileFile> newFile(new TileFile(filename, create));
+        if (create)
+            newFile->write({ { m_fileHeader.data(), m_fileHeader.size() } });
+        file = newFile.get();
+        lock.lock();
+
+        // Close the least recently used files that aren't being written to get under the limit.
+        auto li = m_lru.end();
+        while (m_files.size() >= m_maxOpenFiles && li != m_lru.begin())
+        {
+            --li;
+            auto fi = m_files.find(*li);
+            if (fi->second.inUse)
+                continue;
+            evicted.push_back(std::move(fi->second.file));
+            m_files.erase(fi);
+            li = m_lru.erase(li);
+        }
+
+        m_lru.push_front(key);
+        m_files[key] = { std::move(newFile), true, m_lru.begin() };
+    }
+
+    for (std::unique_ptr<TileFile>& f : evicted)
+        f->close();
+    return file;
+}
+
+void FileHandleCache::release(const TileKey& key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_files.find(key);
+    if (it != m_files.end())
+        it->second.inUse = false;
+}
+
+void FileHandleCache::closeAll()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string error;
+    for (auto& fi : m_files)
+    {
+        try
+        {
+            fi.second.file->close();
+        }
+        catch (const FatalError& err)
+        {
+            if (error.empty())
+                error = err.what();
+        }
+    }
+    m_files.clear();
+    m_lru.clear();
+    if (error.size())
+        throw FatalError(error);
+}
+
+} // namespace epf
+} // namespace untwine
@@ -0,0 +1,100 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#endif
+
+#include "TileKey.hpp"
+
+namespace untwine
+{
+namespace epf
+{
+
+// A tile file opened for appending.
+class TileFile
+{
+public:
+    struct Chunk
+    {
+        const void *data;
+        size_t size;
+    };
+
+    // Opens the file for appending, or creates it anew if 'truncate' is set.
+    TileFile(const std::string& filename, bool truncate);
+    ~TileFile();
+
+    // Appends all the chunks to the file. On POSIX systems this is done with writev(),
+    // so a batch of buffers costs a single system call.
+    void write(const std::vector<Chunk>& chunks);
+    void close();
+
+private:
+    std::string m_filename;
+#ifdef _WIN32
+    std::ofstream m_out;
+#else
+    int m_fd;
+#endif
+};
+
+// Keeps up to MaxOpenFiles tile files open so that a file is not opened and closed
+// each time a buffer is written to it. When the limit is hit, the least recently used
+// file that isn't being written is closed.
+//
+// If a file header is given, each file gets created anew with the header when it's acquired
+// for the first time (this is used when tiles are written directly as LAS files).
+//
+// A key must not be acquired by more than one thread at a time - the writer makes sure
+// of that with its set of active keys.
+class FileHandleCache
+{
+public:
+    FileHandleCache(size_t maxOpenFiles, std::vector<char> fileHeader = std::vector<char>());
+
+    // Returns the open file for the key, opening it if necessary.
+    TileFile *acquire(const TileKey& key, const std::string& filename);
+    // Marks the file as not being written anymore (it stays open).
+    void release(const TileKey& key);
+    // Closes all the files. Throws if any of them failed to close properly.
+    void closeAll();
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<TileFile> file;
+        bool inUse;
+        std::list<TileKey>::iterator lruPos;
+    };
+
+    size_t m_maxOpenFiles;
+    std::vector<char> m_fileHeader;
+    std::unordered_set<TileKey> m_created;  // keys with files created (only with a file header)
+    std::unordered_map<TileKey, Entry> m_files;
+    std::list<TileKey> m_lru;  // most recently used at the front
+    std::mutex m_mutex;
+};
+
+} // namespace epf
+} // namespace untwine
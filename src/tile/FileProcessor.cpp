@@ -13,6 +13,7 @@
 
 #include "FileProcessor.hpp"
 #include "Common.hpp"
+#include "LasTile.hpp"
 #include "../utils.hpp"
 
 #include <pdal/pdal_features.hpp>
@@ -25,8 +26,9 @@ namespace epf
 {
 
 FileProcessor::FileProcessor(const FileInfo& fi, size_t pointSize, const TileGrid& grid,
-        untwine::epf::Writer *writer, ProgressBar& progressBar) :
-    m_fi(fi), m_cellMgr(pointSize, writer), m_grid(grid), m_progressBar(progressBar)
+        untwine::epf::Writer *writer, ProgressBar& progressBar, const LasTileEncoder *lasEncoder) :
+    m_fi(fi), m_cellMgr(lasEncoder ? lasEncoder->recordLength() : pointSize, writer), m_grid(grid),
+    m_progressBar(progressBar), m_lasEncoder(lasEncoder), m_pointSize(pointSize)
 {}
 
 void FileProcessor::run()
@@ -55,26 +57,46 @@ void FileProcessor::run()
     // into which we can write data.
     Cell *cell = m_cellMgr.get(TileKey());
 
+    // With LAS point records in the cells, the point is read to this buffer and encoded
+    // to the cell once we know which one it belongs to.
+    std::vector<uint8_t> rawPoint(m_pointSize);
+    LasTileStats stats;   // not needed for temporary files
+
     pdal::StreamCallbackFilter f;
-    f.setCallback([this, &count, &countTotal, &cell](pdal::PointRef& point)
+    f.setCallback([this, &count, &countTotal, &cell, &rawPoint, &stats](pdal::PointRef& point)
         {
-            // Write the data into the point buffer in the cell.  This is the *last*
-            // cell buffer that we used. We're hoping that it's the right one.
-            Point p = cell->point();
-            for (const FileDimInfo& fdi : m_fi.dimInfo)
-                point.getField(reinterpret_cast<char *>(p.data() + fdi.offset),
-                    fdi.dim, fdi.type);
-
-            // Find the actual cell that this point belongs in. If it's not the one
-            // we chose, copy the data to the correct cell.
-            TileKey cellIndex = m_grid.key(p.x(), p.y(), p.z());
-            if (cellIndex != cell->key())
+            if (m_lasEncoder)
+            {
+                Point p(rawPoint.data());
+                for (const FileDimInfo& fdi : m_fi.dimInfo)
+                    point.getField(reinterpret_cast<char *>(p.data() + fdi.offset),
+                        fdi.dim, fdi.type);
+
+                TileKey cellIndex = m_grid.key(p.x(), p.y(), p.z());
+                if (cellIndex != cell->key())
+                    cell = m_cellMgr.get(cellIndex);
+                m_lasEncoder->encode(p.data(), 1, cell->point().data(), stats);
+            }
+            else
             {
-                // Make sure that we exclude the current cell from any potential flush so
-                // that no other thread can claim its data buffer and overwrite it before
-                // we have a chance to copy from it in copyPoint().
-                cell = m_cellMgr.get(cellIndex, cell);
-                cell->copyPoint(p);
+                // Write the data into the point buffer in the cell.  This is the *last*
+                // cell buffer that we used. We're hoping that it's the right one.
+                Point p = cell->point();
+                for (const FileDimInfo& fdi : m_fi.dimInfo)
+                    point.getField(reinterpret_cast<char *>(p.data() + fdi.offset),
+                        fdi.dim, fdi.type);
+
+                // Find the actual cell that this point belongs in. If it's not the one
+                // we chose, copy the data to the correct cell.
+                TileKey cellIndex = m_grid.key(p.x(), p.y(), p.z());
+                if (cellIndex != cell->key())
+                {
+                    // Make sure that we exclude the current cell from any potential flush so
+                    // that no other thread can claim its data buffer and overwrite it before
+                    // we have a chance to copy from it in copyPoint().
+                    cell = m_cellMgr.get(cellIndex, cell);
+                    cell->copyPoint(p);
+                }
             }
             // Advance the cell - move the buffer pointer so when we refer to the cell's
             // point, we're referring to the next location in the cell's buffer.
@@ -24,13 +24,15 @@ namespace epf
 {
 
 class Writer;
+class LasTileEncoder;
 
 // Processes a single input file (FileInfo) and writes data to the Writer.
+// With a LasTileEncoder, points are written to the cells as LAS point records.
 class FileProcessor
 {
 public:
     FileProcessor(const FileInfo& fi, size_t pointSize, const TileGrid& grid, Writer *writer,
-        ProgressBar& progressBar);
+        ProgressBar& progressBar, const LasTileEncoder *lasEncoder = nullptr);
 
     Cell *getCell(const TileKey& key);
     void run();
@@ -40,6 +42,8 @@ private:
     CellMgr m_cellMgr;
     TileGrid m_grid;
     ProgressBar& m_progressBar;
+    const LasTileEncoder *m_lasEncoder;
+    size_t m_pointSize;
 };
 
 } // namespace epf
@@ -0,0 +1,404 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "LasTile.hpp"
+#include "Common.hpp"
+
+namespace untwine
+{
+namespace epf
+{
+
+// Extra Bytes VLR describes the extra bytes at the end of each point record
+#define EXTRA_BYTES_VLR_USER_ID       "LASF_Spec"
+#define EXTRA_BYTES_VLR_RECORD_ID     4
+#define EXTRA_BYTES_DESCRIPTOR_SIZE   192
+#define EXTRA_BYTES_OPTION_SCALE      0x08
+#define EXTRA_BYTES_OPTION_OFFSET     0x10
+#define VLR_HEADER_SIZE               54
+
+namespace
+{
+
+template<typename T>
+T load(const uint8_t *p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+template<typename T>
+void store(uint8_t *p, T value)
+{
+    std::memcpy(p, &value, sizeof(T));
+}
+
+double loadAsDouble(const uint8_t *p, pdal::Dimension::Type type)
+{
+    using T = pdal::Dimension::Type;
+    switch (type)
+    {
+    case T::Unsigned8:  return load<uint8_t>(p);
+    case T::Signed8:    return load<int8_t>(p);
+    case T::Unsigned16: return load<uint16_t>(p);
+    case T::Signed16:   return load<int16_t>(p);
+    case T::Unsigned32: return load<uint32_t>(p);
+    case T::Signed32:   return load<int32_t>(p);
+    case T::Unsigned64: return (double)load<uint64_t>(p);
+    case T::Signed64:   return (double)load<int64_t>(p);
+    case T::Float:      return load<float>(p);
+    case T::Double:     return load<double>(p);
+    default:            return 0;
+    }
+}
+
+// Rounds the value and clamps it to the range of the integer type.
+template<typename T>
+T toInt(double value)
+{
+    value = std::round(value);
+    value = (std::max)(value, (double)std::numeric_limits<T>::lowest());
+    value = (std::min)(value, (double)std::numeric_limits<T>::max());
+    return (T)value;
+}
+
+// Converts a coordinate to the integer stored in a LAS point record. Unlike other fields,
+// coordinates are not clamped - writers.las fails if they are out of range, and so do we.
+int32_t toLasCoordinate(double value, double scale, double offset, const char *dimName)
+{
+    double scaled = std::round((value - offset) / scale);
+    if (!(scaled >= (double)std::numeric_limits<int32_t>::lowest() &&
+          scaled <= (double)std::numeric_limits<int32_t>::max()))
+        throw FatalError("Unable to convert scaled value (" + std::to_string(scaled) + ") to int32 for dimension '" +
+            dimName + "' when writing LAS tile. Check the scale and offset.");
+    return (int32_t)scaled;
+}
+
+void storeFromDouble(uint8_t *p, pdal::Dimension::Type type, double value)
+{
+    using T = pdal::Dimension::Type;
+    switch (type)
+    {
+    case T::Unsigned8:  store(p, toInt<uint8_t>(value)); break;
+    case T::Signed8:    store(p, toInt<int8_t>(value)); break;
+    case T::Unsigned16: store(p, toInt<uint16_t>(value)); break;
+    case T::Signed16:   store(p, toInt<int16_t>(value)); break;
+    case T::Unsigned32: store(p, toInt<uint32_t>(value)); break;
+    case T::Signed32:   store(p, toInt<int32_t>(value)); break;
+    case T::Unsigned64: store(p, toInt<uint64_t>(value)); break;
+    case T::Signed64:   store(p, toInt<int64_t>(value)); break;
+    case T::Float:      store(p, (float)value); break;
+    case T::Double:     store(p, value); break;
+    default:            break;
+    }
+}
+
+// Data types of extra bytes (index is the type in the descriptor)
+const pdal::Dimension::Type extraBytesTypes[] =
+{
+    pdal::Dimension::Type::None,
+    pdal::Dimension::Type::Unsigned8, pdal::Dimension::Type::Signed8,
+    pdal::Dimension::Type::Unsigned16, pdal::Dimension::Type::Signed16,
+    pdal::Dimension::Type::Unsigned32, pdal::Dimension::Type::Signed32,
+    pdal::Dimension::Type::Unsigned64, pdal::Dimension::Type::Signed64,
+    pdal::Dimension::Type::Float, pdal::Dimension::Type::Double
+};
+
+} // unnamed namespace
+
+
+LasTileEncoder::LasTileEncoder(const DimInfoList& dims, size_t pointSize, const LasHeader& header) :
+    m_dims(dims), m_pointSize(pointSize), m_header(header), m_pointFormat(header.pointFormat & 0x3f)
+{
+    using D = pdal::Dimension::Id;
+
+    if (m_header.isCompressed() || m_pointFormat < 6 || m_pointFormat > 8)
+        throw FatalError("Unsupported point format for writing LAS tiles directly.");
+
+    m_x = field(D::X);
+    m_y = field(D::Y);
+    m_z = field(D::Z);
+    m_intensity = field(D::Intensity);
+    m_returnNumber = field(D::ReturnNumber);
+    m_numberOfReturns = field(D::NumberOfReturns);
+    m_classFlags = field(D::ClassFlags);
+    m_scanChannel = field(D::ScanChannel);
+    m_scanDirectionFlag = field(D::ScanDirectionFlag);
+    m_edgeOfFlightLine = field(D::EdgeOfFlightLine);
+    m_classification = field(D::Classification);
+    m_userData = field(D::UserData);
+    m_scanAngleRank = field(D::ScanAngleRank);
+    m_pointSourceId = field(D::PointSourceId);
+    m_gpsTime = field(D::GpsTime);
+    m_red = field(D::Red);
+    m_green = field(D::Green);
+    m_blue = field(D::Blue);
+    m_infrared = field(D::Infrared);
+    m_synthetic = field(D::Synthetic);
+    m_keyPoint = field(D::KeyPoint);
+    m_withheld = field(D::Withheld);
+    m_overlap = field(D::Overlap);
+
+    parseExtraBytes();
+}
+
+// Classification flags come either as a single dimension or as individual flags.
+uint8_t LasTileEncoder::classFlags(const uint8_t *in) const
+{
+    auto get = [in](const Field& f) -> uint8_t
+    {
+        return f.inOffset < 0 ? 0 : toInt<uint8_t>(loadAsDouble(in + f.inOffset, f.inType));
+    };
+
+    if (m_classFlags.inOffset >= 0)
+        return get(m_classFlags);
+    return (get(m_synthetic) & 0x01) | ((get(m_keyPoint) & 0x01) << 1) |
+        ((get(m_withheld) & 0x01) << 2) | ((get(m_overlap) & 0x01) << 3);
+}
+
+LasTileEncoder::Field LasTileEncoder::field(pdal::Dimension::Id id) const
+{
+    Field f;
+    for (const FileDimInfo& fdi : m_dims)
+    {
+        if (fdi.dim == id)
+        {
+            f.inOffset = fdi.offset;
+            f.inType = fdi.type;
+        }
+    }
+    return f;
+}
+
+void LasTileEncoder::parseExtraBytes()
+{
+    const std::vector<char>& vlrs = m_header.rawVlrs;
+    int outOffset = m_pointFormat == 6 ? 30 : (m_pointFormat == 7 ? 36 : 38);
+
+    size_t pos = 0;
+    while (pos + VLR_HEADER_SIZE <= vlrs.size())
+    {
+        uint16_t recordId, length;
+        std::memcpy(&recordId, vlrs.data() + pos + 18, 2);
+        std::memcpy(&length, vlrs.data() + pos + 20, 2);
+        size_t dataOffset = pos + VLR_HEADER_SIZE;
+        if (std::strncmp(vlrs.data() + pos + 2, EXTRA_BYTES_VLR_USER_ID, 16) == 0 &&
+            recordId == EXTRA_BYTES_VLR_RECORD_ID)
+        {
+            for (size_t d = dataOffset; d + EXTRA_BYTES_DESCRIPTOR_SIZE <= dataOffset + length &&
+                d + EXTRA_BYTES_DESCRIPTOR_SIZE <= vlrs.size(); d += EXTRA_BYTES_DESCRIPTOR_SIZE)
+            {
+                uint8_t dataType = vlrs[d + 2];
+                uint8_t options = vlrs[d + 3];
+                std::string name(vlrs.data() + d + 4, strnlen(vlrs.data() + d + 4, 32));
+
+                ExtraField ef;
+                ef.outOffset = outOffset;
+                // values of the dimension are stored as (value - offset) / scale if the option bits are set
+                if (dataType != 0 && (options & EXTRA_BYTES_OPTION_SCALE))
+                    std::memcpy(&ef.scale, vlrs.data() + d + 112, 8);
+                if (dataType != 0 && (options & EXTRA_BYTES_OPTION_OFFSET))
+                    std::memcpy(&ef.offset, vlrs.data() + d + 136, 8);
+                if (ef.scale == 0)
+                    throw FatalError("Invalid scale of extra bytes '" + name + "' for writing LAS tiles directly.");
+                ef.scaled = ef.scale != 1 || ef.offset != 0;
+                if (dataType == 0)
+                {
+                    ef.outType = pdal::Dimension::Type::None;
+                    ef.size = options;
+                }
+                else if (dataType <= 10)
+                {
+                    ef.outType = extraBytesTypes[dataType];
+                    ef.size = (int)pdal::Dimension::size(ef.outType);
+                    for (const FileDimInfo& fdi : m_dims)
+                    {
+                        if (fdi.name == name)
+                        {
+                            ef.in.inOffset = fdi.offset;
+                            ef.in.inType = fdi.type;
+                        }
+                    }
+                }
+                else
+                    throw FatalError("Unsupported type of extra bytes for writing LAS tiles directly.");
+
+                m_extraFields.push_back(ef);
+                outOffset += ef.size;
+            }
+        }
+        pos = dataOffset + length;
+    }
+
+    if (outOffset != (int)m_header.pointRecordLength)
+        throw FatalError("Unexpected point record length for writing LAS tiles directly.");
+}
+
+std::vector<char> LasTileEncoder::fileHeader() const
+{
+    LasHeader h(m_header);
+    h.pointCount = 0;
+    std::fill(std::begin(h.pointsByReturn), std::end(h.pointsByReturn), 0);
+
+    std::vector<char> data = h.updatedRawHeader();
+    data.insert(data.end(), h.rawVlrs.begin(), h.rawVlrs.end());
+    return data;
+}
+
+std::vector<char> LasTileEncoder::tileHeader(const LasTileStats& stats) const
+{
+    LasHeader h(m_header);
+    h.pointCount = stats.count;
+    std::copy(std::begin(stats.pointsByReturn), std::end(stats.pointsByReturn), std::begin(h.pointsByReturn));
+    for (int i = 0; i < 3; ++i)
+    {
+        h.minimum[i] = stats.minimum[i] * h.scale[i] + h.offset[i];
+        h.maximum[i] = stats.maximum[i] * h.scale[i] + h.offset[i];
+    }
+    return h.updatedRawHeader();
+}
+
+void LasTileEncoder::encode(const uint8_t *in, size_t count, uint8_t *out, LasTileStats& stats) const
+{
+    auto get = [](const uint8_t *p, const Field& f) -> double
+    {
+        return f.inOffset < 0 ? 0 : loadAsDouble(p + f.inOffset, f.inType);
+    };
+
+    const double *scale = m_header.scale;
+    const double *offset = m_header.offset;
+
+    for (size_t i = 0; i < count; ++i, in += m_pointSize, out += m_header.pointRecordLength)
+    {
+        int32_t xyz[3] = {
+            toLasCoordinate(get(in, m_x), scale[0], offset[0], "X"),
+            toLasCoordinate(get(in, m_y), scale[1], offset[1], "Y"),
+            toLasCoordinate(get(in, m_z), scale[2], offset[2], "Z")
+        };
+        for (int d = 0; d < 3; ++d)
+        {
+            store(out + 4 * d, xyz[d]);
+            stats.minimum[d] = (std::min)(stats.minimum[d], xyz[d]);
+            stats.maximum[d] = (std::max)(stats.maximum[d], xyz[d]);
+        }
+
+        uint8_t returnNumber = toInt<uint8_t>(get(in, m_returnNumber)) & 0x0f;
+        uint8_t numberOfReturns = toInt<uint8_t>(get(in, m_numberOfReturns)) & 0x0f;
+        uint8_t flags = (classFlags(in) & 0x0f) |
+            ((toInt<uint8_t>(get(in, m_scanChannel)) & 0x03) << 4) |
+            ((toInt<uint8_t>(get(in, m_scanDirectionFlag)) & 0x01) << 6) |
+            ((toInt<uint8_t>(get(in, m_edgeOfFlightLine)) & 0x01) << 7);
+
+        store(out + 12, toInt<uint16_t>(get(in, m_intensity)));
+        store(out + 14, (uint8_t)(returnNumber | (numberOfReturns << 4)));
+        store(out + 15, flags);
+        store(out + 16, toInt<uint8_t>(get(in, m_classification)));
+        store(out + 17, toInt<uint8_t>(get(in, m_userData)));
+        store(out + 18, toInt<int16_t>(get(in, m_scanAngleRank) / 0.006));
+        store(out + 20, toInt<uint16_t>(get(in, m_pointSourceId)));
+        store(out + 22, get(in, m_gpsTime));
+        if (m_pointFormat >= 7)
+        {
+            store(out + 30, toInt<uint16_t>(get(in, m_red)));
+            store(out + 32, toInt<uint16_t>(get(in, m_green)));
+            store(out + 34, toInt<uint16_t>(get(in, m_blue)));
+        }
+        if (m_pointFormat == 8)
+            store(out + 36, toInt<uint16_t>(get(in, m_infrared)));
+
+        for (const ExtraField& ef : m_extraFields)
+        {
+            uint8_t *dst = out + ef.outOffset;
+            if (ef.in.inOffset < 0 || ef.outType == pdal::Dimension::Type::None)
+                std::memset(dst, 0, ef.size);
+            else if (ef.scaled)
+                storeFromDouble(dst, ef.outType, (get(in, ef.in) - ef.offset) / ef.scale);
+            else if (ef.in.inType == ef.outType)
+                std::memcpy(dst, in + ef.in.inOffset, ef.size);
+            else
+                storeFromDouble(dst, ef.outType, get(in, ef.in));
+        }
+
+        stats.count++;
+        if (returnNumber >= 1)
+            stats.pointsByReturn[returnNumber - 1]++;
+    }
+}
+
+void LasTileEncoder::decode(const uint8_t *in, size_t count, uint8_t *out) const
+{
+    auto set = [](uint8_t *p, const Field& f, double value)
+    {
+        if (f.inOffset >= 0)
+            storeFromDouble(p + f.inOffset, f.inType, value);
+    };
+
+    const double *scale = m_header.scale;
+    const double *offset = m_header.offset;
+
+    for (size_t i = 0; i < count; ++i, in += m_header.pointRecordLength, out += m_pointSize)
+    {
+        set(out, m_x, load<int32_t>(in) * scale[0] + offset[0]);
+        set(out, m_y, load<int32_t>(in + 4) * scale[1] + offset[1]);
+        set(out, m_z, load<int32_t>(in + 8) * scale[2] + offset[2]);
+
+        uint8_t returns = in[14];
+        uint8_t flags = in[15];
+        set(out, m_intensity, load<uint16_t>(in + 12));
+        set(out, m_returnNumber, returns & 0x0f);
+        set(out, m_numberOfReturns, returns >> 4);
+        set(out, m_classFlags, flags & 0x0f);
+        set(out, m_synthetic, flags & 0x01);
+        set(out, m_keyPoint, (flags >> 1) & 0x01);
+        set(out, m_withheld, (flags >> 2) & 0x01);
+        set(out, m_overlap, (flags >> 3) & 0x01);
+        set(out, m_scanChannel, (flags >> 4) & 0x03);
+        set(out, m_scanDirectionFlag, (flags >> 6) & 0x01);
+        set(out, m_edgeOfFlightLine, (flags >> 7) & 0x01);
+        set(out, m_classification, in[16]);
+        set(out, m_userData, in[17]);
+        set(out, m_scanAngleRank, load<int16_t>(in + 18) * 0.006);
+        set(out, m_pointSourceId, load<uint16_t>(in + 20));
+        set(out, m_gpsTime, load<double>(in + 22));
+        if (m_pointFormat >= 7)
+        {
+            set(out, m_red, load<uint16_t>(in + 30));
+            set(out, m_green, load<uint16_t>(in + 32));
+            set(out, m_blue, load<uint16_t>(in + 34));
+        }
+        if (m_pointFormat == 8)
+            set(out, m_infrared, load<uint16_t>(in + 36));
+
+        for (const ExtraField& ef : m_extraFields)
+        {
+            if (ef.in.inOffset < 0 || ef.outType == pdal::Dimension::Type::None)
+                continue;
+            if (ef.scaled)
+                storeFromDouble(out + ef.in.inOffset, ef.in.inType,
+                    loadAsDouble(in + ef.outOffset, ef.outType) * ef.scale + ef.offset);
+            else if (ef.in.inType == ef.outType)
+                std::memcpy(out + ef.in.inOffset, in + ef.outOffset, ef.size);
+            else
+                storeFromDouble(out + ef.in.inOffset, ef.in.inType, loadAsDouble(in + ef.outOffset, ef.outType));
+        }
+    }
+}
+
+} // namespace epf
+} // namespace untwine
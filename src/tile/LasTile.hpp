@@ -0,0 +1,102 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "FileDimInfo.hpp"
+#include "../las_header.hpp"
+
+namespace untwine
+{
+namespace epf
+{
+
+// Summary of the points written to a LAS tile, needed to fill in its header at the end.
+struct LasTileStats
+{
+    uint64_t count = 0;
+    uint64_t pointsByReturn[15] = {0};
+    int32_t minimum[3] = { std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max(),
+                           std::numeric_limits<int32_t>::max() };
+    int32_t maximum[3] = { std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min(),
+                           std::numeric_limits<int32_t>::min() };
+};
+
+// Converts points in the layout of the temporary files (see FileDimInfo) to LAS 1.4 point
+// records (point formats 6, 7 and 8 with extra bytes), so that tiles can be written as LAS
+// files directly while the input is being read. The same records may be used as a compact
+// format of the temporary files, which get decoded back to points in the second pass.
+//
+// The header and VLRs come from an empty LAS file written by writers.las with the options used
+// for the tiles, so SRS, extra bytes and other VLRs are exactly what writers.las would write.
+// Each tile file starts with that header, point records are appended to it, and the header is
+// updated with the point count and bounds once all points are written.
+class LasTileEncoder
+{
+public:
+    LasTileEncoder(const DimInfoList& dims, size_t pointSize, const LasHeader& header);
+
+    size_t recordLength() const
+        { return m_header.pointRecordLength; }
+    const LasHeader& header() const
+        { return m_header; }
+    // Header and VLRs to be written at the start of each tile.
+    std::vector<char> fileHeader() const;
+    // Header of a finished tile.
+    std::vector<char> tileHeader(const LasTileStats& stats) const;
+
+    // Converts 'count' points from 'in' to LAS point records in 'out', updating the stats.
+    void encode(const uint8_t *in, size_t count, uint8_t *out, LasTileStats& stats) const;
+    // Converts 'count' LAS point records from 'in' back to points in 'out'. Only the data
+    // that would be written to a LAS tile are kept (e.g. coordinates are quantized).
+    void decode(const uint8_t *in, size_t count, uint8_t *out) const;
+
+private:
+    struct Field
+    {
+        int inOffset = -1;   // -1 if the dimension is not in the input
+        pdal::Dimension::Type inType = pdal::Dimension::Type::None;
+    };
+
+    struct ExtraField
+    {
+        Field in;
+        int outOffset;
+        pdal::Dimension::Type outType;   // None for undocumented extra bytes
+        int size;
+        double scale = 1;    // from the descriptor if its scale/offset option bits are set
+        double offset = 0;
+        bool scaled = false;
+    };
+
+    Field field(pdal::Dimension::Id id) const;
+    uint8_t classFlags(const uint8_t *in) const;
+    void parseExtraBytes();
+
+    DimInfoList m_dims;
+    size_t m_pointSize;
+    LasHeader m_header;
+    int m_pointFormat;
+
+    Field m_x, m_y, m_z, m_intensity, m_returnNumber, m_numberOfReturns, m_classFlags,
+        m_scanChannel, m_scanDirectionFlag, m_edgeOfFlightLine, m_classification, m_userData,
+        m_scanAngleRank, m_pointSourceId, m_gpsTime, m_red, m_green, m_blue, m_infrared,
+        m_synthetic, m_keyPoint, m_withheld, m_overlap;
+    std::vector<ExtraField> m_extraFields;
+};
+
+} // namespace epf
+} // namespace untwine
@@ -0,0 +1,131 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace untwine
+{
+
+// Bounded multi-producer multi-consumer queue that does not use any locks
+// (the algorithm by Dmitry Vyukov). Each slot of the ring buffer has a sequence number
+// that tells whether the slot is ready to be written by a producer or read by a consumer
+// in the current round, so producers and consumers only contend on their own position
+// counters with a compare-and-swap. Pushing to a full queue or popping from an empty
+// queue fails immediately rather than blocking - waiting is up to the caller.
+template <typename T>
+class MpmcQueue
+{
+public:
+    // Capacity gets rounded up to a power of two (at least 2).
+    explicit MpmcQueue(size_t capacity)
+    {
+        m_capacity = 2;
+        while (m_capacity < capacity)
+            m_capacity *= 2;
+        m_mask = m_capacity - 1;
+        m_slots.reset(new Slot[m_capacity]);
+        for (size_t i = 0; i < m_capacity; ++i)
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MpmcQueue(const MpmcQueue& other) = delete;
+    MpmcQueue& operator=(const MpmcQueue& other) = delete;
+
+    // Returns false if the queue is full (the value is not moved from then).
+    bool push(T& value)
+    {
+        size_t pos = m_pushPos.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true)
+        {
+            slot = &m_slots[pos & m_mask];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;  // the slot has not been read yet in the previous round
+            else
+                pos = m_pushPos.load(std::memory_order_relaxed);
+        }
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty.
+    bool pop(T& value)
+    {
+        size_t pos = m_popPos.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true)
+        {
+            slot = &m_slots[pos & m_mask];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;  // the slot has not been written yet in this round
+            else
+                pos = m_popPos.load(std::memory_order_relaxed);
+        }
+        value = std::move(slot->value);
+        slot->value = T();  // do not keep resources of the value alive in the queue
+        slot->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate number of items in the queue (exact only if nobody is pushing or popping).
+    size_t size() const
+    {
+        size_t pushPos = m_pushPos.load(std::memory_order_acquire);
+        size_t popPos = m_popPos.load(std::memory_order_acquire);
+        return pushPos > popPos ? pushPos - popPos : 0;
+    }
+
+    bool empty() const
+    { return size() == 0; }
+
+    size_t capacity() const
+    { return m_capacity; }
+
+private:
+    // producers and consumers update different counters - keep them on separate cache lines
+    static constexpr size_t CacheLineSize = 64;
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    size_t m_capacity;
+    size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+    alignas(CacheLineSize) std::atomic<size_t> m_pushPos {0};
+    alignas(CacheLineSize) std::atomic<size_t> m_popPos {0};
+};
+
+} // namespace untwine
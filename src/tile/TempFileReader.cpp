@@ -0,0 +1,221 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "TempFileReader.hpp"
+#include "Common.hpp"
+
+namespace untwine
+{
+namespace epf
+{
+
+// Number of LAS records decoded at once
+#define DECODE_CHUNK_SIZE 4096
+
+TempFileReader::TempFileReader(const std::string& filename, const DimInfoList& dims, size_t pointSize,
+        const LasTileEncoder *lasEncoder) :
+    m_tempFilename(filename), m_dims(dims), m_pointSize(pointSize), m_lasEncoder(lasEncoder),
+    m_recordSize(lasEncoder ? lasEncoder->recordLength() : pointSize)
+{}
+
+TempFileReader::~TempFileReader()
+{
+    unmap();
+}
+
+void TempFileReader::addDimensions(pdal::PointLayoutPtr layout)
+{
+    for (FileDimInfo& fdi : m_dims)
+        fdi.dim = layout->registerOrAssignDim(fdi.name, fdi.type);
+}
+
+void TempFileReader::ready(pdal::PointTableRef table)
+{
+    map();
+
+    // Work out how the records get copied to the points in the table: dimensions of the same
+    // type are copied directly, and runs of them that are next to each other both in the file
+    // and in the table are merged.
+    DimInfoList dims = m_dims;
+    std::sort(dims.begin(), dims.end(), [](const FileDimInfo& d1, const FileDimInfo& d2)
+        { return d1.offset < d2.offset; });
+
+    m_copyRuns.clear();
+    m_convertDims.clear();
+    pdal::PointLayoutPtr layout = table.layout();
+    for (const FileDimInfo& fdi : dims)
+    {
+        const pdal::Dimension::Detail *detail = layout->dimDetail(fdi.dim);
+        if (detail->type() != fdi.type)
+        {
+            m_convertDims.push_back(fdi);
+            continue;
+        }
+
+        size_t size = pdal::Dimension::size(fdi.type);
+        if (m_copyRuns.size())
+        {
+            CopyRun& last = m_copyRuns.back();
+            if (last.srcOffset + last.size == (size_t)fdi.offset &&
+                last.dstOffset + last.size == (size_t)detail->offset())
+            {
+                last.size += size;
+                continue;
+            }
+        }
+        m_copyRuns.push_back({ (size_t)fdi.offset, (size_t)detail->offset(), size });
+    }
+}
+
+pdal::point_count_t TempFileReader::read(pdal::PointViewPtr view, pdal::point_count_t count)
+{
+    RawPointTable *table = dynamic_cast<RawPointTable *>(&view->table());
+    if (!table)
+        throw FatalError("Points of a temporary file must be read to a RawPointTable.");
+    if (m_dims.empty())
+        return 0;
+
+    // The view is the only one of the table, so the IDs of the points in the view and
+    // in the table are the same.
+    const FileDimInfo& first = m_convertDims.size() ? m_convertDims.front() : m_dims.front();
+    size_t numConvertDims = m_convertDims.size();
+
+    pdal::point_count_t numPoints = (std::min)((pdal::point_count_t)(m_size / m_recordSize), count);
+    const char *src = m_data;
+    if (m_lasEncoder)
+        m_decoded.resize(DECODE_CHUNK_SIZE * m_pointSize);
+    for (pdal::point_count_t i = 0; i < numPoints; ++i, src += m_pointSize)
+    {
+        if (m_lasEncoder && i % DECODE_CHUNK_SIZE == 0)
+        {
+            size_t chunk = (std::min)((pdal::point_count_t)DECODE_CHUNK_SIZE, numPoints - i);
+            m_lasEncoder->decode(reinterpret_cast<const uint8_t *>(m_data + i * m_recordSize), chunk,
+                reinterpret_cast<uint8_t *>(m_decoded.data()));
+            src = m_decoded.data();
+        }
+
+        // Setting a field of the next point ID adds the point.
+        pdal::PointId idx = view->size();
+        view->setField(first.dim, first.type, idx, src + first.offset);
+
+        char *dst = table->pointData(idx);
+        for (const CopyRun& run : m_copyRuns)
+            std::memcpy(dst + run.dstOffset, src + run.srcOffset, run.size);
+        for (size_t d = 1; d < numConvertDims; ++d)
+        {
+            const FileDimInfo& fdi = m_convertDims[d];
+            view->setField(fdi.dim, fdi.type, idx, src + fdi.offset);
+        }
+    }
+    return numPoints;
+}
+
+void TempFileReader::done(pdal::PointTableRef)
+{
+    unmap();
+}
+
+#ifdef _WIN32
+
+void TempFileReader::map()
+{
+    HANDLE file = CreateFileW(toNative(m_tempFilename).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw FatalError("Unable to open temporary file: " + m_tempFilename);
+    m_fileHandle = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+        throw FatalError("Unable to read temporary file: " + m_tempFilename);
+    m_size = (size_t)size.QuadPart;
+    if (m_size == 0)
+        return;
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+        throw FatalError("Unable to map temporary file: " + m_tempFilename);
+    m_mappingHandle = mapping;
+
+    m_data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data)
+        throw FatalError("Unable to map temporary file: " + m_tempFilename);
+}
+
+void TempFileReader::unmap()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mappingHandle)
+        CloseHandle(m_mappingHandle);
+    if (m_fileHandle)
+        CloseHandle(m_fileHandle);
+    m_data = nullptr;
+    m_mappingHandle = nullptr;
+    m_fileHandle = nullptr;
+    m_size = 0;
+}
+
+#else
+
+void TempFileReader::map()
+{
+    int fd = ::open(m_tempFilename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw FatalError("Unable to open temporary file: " + m_tempFilename);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        throw FatalError("Unable to read temporary file: " + m_tempFilename);
+    }
+    m_size = (size_t)st.st_size;
+
+    // an empty file can't be mapped
+    if (m_size)
+    {
+        void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            ::close(fd);
+            throw FatalError("Unable to map temporary file: " + m_tempFilename + ": " + std::strerror(errno));
+        }
+        madvise(data, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char *>(data);
+    }
+    ::close(fd);
+}
+
+void TempFileReader::unmap()
+{
+    if (m_data)
+        munmap(const_cast<char *>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
+
+} // namespace epf
+} // namespace untwine
@@ -0,0 +1,88 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#pragma once
+
+#include <pdal/PointTable.hpp>
+#include <pdal/Reader.hpp>
+
+#include "FileDimInfo.hpp"
+#include "LasTile.hpp"
+
+namespace untwine
+{
+namespace epf
+{
+
+// Point table that gives access to the memory of its points, so that whole point records
+// can be copied to it at once.
+class RawPointTable : public pdal::PointTable
+{
+public:
+    char *pointData(pdal::PointId idx)
+        { return getPoint(idx); }
+};
+
+// Reads a temporary file with raw point data written in the first pass of tiling.
+//
+// The file is memory mapped and the records are copied straight to the points of
+// a RawPointTable: dimensions stored with the same type are copied with memcpy (neighbouring
+// dimensions in a single run), only dimensions with a different type in the table go through
+// PointView::setField().
+//
+// With a LasTileEncoder, the file holds compact LAS point records instead, which are decoded
+// in chunks to the raw layout before being copied the same way.
+class TempFileReader : public pdal::Reader
+{
+public:
+    TempFileReader(const std::string& filename, const DimInfoList& dims, size_t pointSize,
+        const LasTileEncoder *lasEncoder = nullptr);
+    ~TempFileReader();
+
+    std::string getName() const override
+        { return "readers.untwinetemp"; }
+
+private:
+    struct CopyRun
+    {
+        size_t srcOffset;
+        size_t dstOffset;
+        size_t size;
+    };
+
+    void addDimensions(pdal::PointLayoutPtr layout) override;
+    void ready(pdal::PointTableRef table) override;
+    pdal::point_count_t read(pdal::PointViewPtr view, pdal::point_count_t count) override;
+    void done(pdal::PointTableRef table) override;
+
+    void map();
+    void unmap();
+
+    std::string m_tempFilename;
+    DimInfoList m_dims;
+    size_t m_pointSize;
+    const LasTileEncoder *m_lasEncoder;
+    size_t m_recordSize;   // size of a record in the file
+    std::vector<char> m_decoded;
+    std::vector<CopyRun> m_copyRuns;
+    DimInfoList m_convertDims;   // dimensions with a different type in the table
+
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void *m_fileHandle = nullptr;
+    void *m_mappingHandle = nullptr;
+#endif
+};
+
+} // namespace epf
+} // namespace untwine
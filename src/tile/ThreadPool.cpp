@@ -53,66 +53,187 @@ void ThreadPool::go()
     }
 }
 
-void ThreadPool::work()
+bool ThreadPool::add(std::function<void()> task)
 {
-    while (true)
+    // The call is counted in m_adding before m_running is checked, and join() clears m_running
+    // before the workers check m_adding, so either we see that the pool is not running, or the
+    // workers wait until the task is in the queue (both are sequentially consistent atomics).
+    ++m_adding;
+    if (!m_running)
+    {
+        --m_adding;
+        return false;
+    }
+
+    ++m_pending;
+    if (!m_tasks.push(task))
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_consumeCv.wait(lock, [this]()
+        if (m_queueSize < 0)
         {
-            return m_tasks.size() || !m_running;
-        });
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_overflow.push_back(std::move(task));
+            ++m_overflowSize;
+        }
+        else
+        {
+            // The queue is full - wait until a worker takes a task from it.
+            std::unique_lock<std::mutex> lock(m_mutex);
+            ++m_waitingProducers;
+            while (true)
+            {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                m_produceCv.wait(lock, [this]()
+                {
+                    return m_tasks.size() < m_tasks.capacity() || !m_running;
+                });
+                if (!m_running)
+                {
+                    --m_waitingProducers;
+                    lock.unlock();
+                    taskDone();
+                    --m_adding;
+                    return false;
+                }
+                if (m_tasks.push(task))
+                    break;
+            }
+            --m_waitingProducers;
+        }
+    }
+    --m_adding;
+
+    // Notify a worker that a task is available.
+    wakeOne(m_sleepingWorkers, m_consumeCv);
+    return true;
+}
+
+void ThreadPool::wakeOne(std::atomic<size_t>& sleeping, std::condition_variable& cv)
+{
+    // Together with the fence in the sleeping thread, this makes sure that either we see that
+    // the thread is going to sleep, or the thread sees the change we have made to the queue.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping == 0)
+        return;
+
+    // The sleeping thread checks the queue and starts to wait while holding the mutex,
+    // so once we have the mutex, it is already waiting and can't miss the notification.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    cv.notify_one();
+}
+
+bool ThreadPool::waitForTask()
+{
+    // The queue is not empty, but the task could not be taken - a producer is just writing it.
+    // After join(), add() calls that are still in progress are about to queue their tasks.
+    if (!m_tasks.empty() || m_overflowSize || (!m_running && m_adding))
+    {
+        std::this_thread::yield();
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ++m_sleepingWorkers;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_consumeCv.wait(lock, [this]()
+    {
+        return !m_tasks.empty() || m_overflowSize || !m_running;
+    });
+    --m_sleepingWorkers;
+    // m_adding goes first: once it is zero, tasks of the finished add() calls are visible
+    return m_adding || m_running || !m_tasks.empty() || m_overflowSize;
+}
+
+bool ThreadPool::popOverflow(std::function<void()>& task)
+{
+    if (m_overflowSize == 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_overflow.empty())
+        return false;
+    task = std::move(m_overflow.front());
+    m_overflow.pop_front();
+    --m_overflowSize;
+    return true;
+}
 
-        if (m_tasks.size())
+void ThreadPool::refillFromOverflow()
+{
+    if (m_overflowSize == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (!m_overflow.empty() && m_tasks.push(m_overflow.front()))
+    {
+        m_overflow.pop_front();
+        --m_overflowSize;
+    }
+}
+
+void ThreadPool::taskDone()
+{
+    if (--m_pending == 0)
+    {
+        // Notify await(), which may be waiting for the last task.
         {
-            ++m_outstanding;
-            auto task(std::move(m_tasks.front()));
-            m_tasks.pop();
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_doneCv.notify_all();
+    }
+}
 
-            lock.unlock();
+void ThreadPool::work()
+{
+    std::function<void()> task;
+    while (true)
+    {
+        if (!m_tasks.pop(task) && !popOverflow(task))
+        {
+            if (!waitForTask())
+                return;
+            continue;
+        }
 
-            // Notify add(), which may be waiting for a spot in the queue.
-            m_produceCv.notify_all();
+        // Notify add(), which may be waiting for a spot in the queue (or fill the spot
+        // with a task from the overflow list of an unbounded pool).
+        if (m_queueSize < 0)
+            refillFromOverflow();
+        else
+            wakeOne(m_waitingProducers, m_produceCv);
 
-            std::string err;
+        std::string err;
 
-            if (m_trap)
+        if (m_trap)
+        {
+            try
             {
-                try
-                {
-                    task();
-                }
-                catch (std::exception& e)
-                {
-                    err = e.what();
-                }
-                catch (...)
-                {
-                    err = m_catchall;
-                }
-            }
-            else
                 task();
-
-            lock.lock();
-            --m_outstanding;
-            if (err.size())
+            }
+            catch (std::exception& e)
             {
-                if (m_verbose)
-                    std::cout << "Exception in pool task: " << err << std::endl;
-                m_errors.push_back(err);
+                err = e.what();
+            }
+            catch (...)
+            {
+                err = m_catchall;
             }
-            lock.unlock();
-
-            // Notify await(), which may be waiting for a running task.
-            m_produceCv.notify_all();
         }
-        else if (!m_running)
+        else
+            task();
+        task = nullptr;
+
+        if (err.size())
         {
-            return;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_verbose)
+                std::cout << "Exception in pool task: " << err << std::endl;
+            m_errors.push_back(err);
         }
+
+        taskDone();
     }
 }
 
 } // namespace untwine
-
@@ -34,29 +34,45 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <condition_variable>
+#include <deque>
 #include <functional>
-#include <queue>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+
+#include "MpmcQueue.hpp"
 
 //#include "Common.hpp"
 
 namespace untwine
 {
 
+// Tasks are kept in a lock-free queue, so adding and picking up tasks does not go through
+// a mutex shared by all threads. The mutex is only used when a worker thread has nothing
+// to do and goes to sleep (or a producer waits for space in a full queue): then exactly
+// one sleeping thread gets woken up for each added task, rather than waking up all threads.
+//
+// There are no per-worker deques with work stealing: all tasks are added by threads outside
+// of the pool (tasks never add tasks to their own pool), so a worker would always take tasks
+// from other deques and that would only add overhead over the single shared queue.
 class ThreadPool
 {
 public:
     // After numThreads tasks are actively running, and queueSize tasks have
     // been enqueued to wait for an available worker thread, subsequent calls
     // to Pool::add will block until an enqueued task has been popped from the
-    // queue.
+    // queue. The queue size gets rounded up to a power of two. If it is not
+    // given (-1), the queue is unbounded: tasks that don't fit into the lock-free
+    // queue (DefaultQueueSize) are kept in an overflow list guarded by the mutex.
     ThreadPool(std::size_t numThreads, int64_t queueSize = -1,
             bool verbose = false) :
         m_queueSize(queueSize),
-        m_numThreads(std::max<std::size_t>(numThreads, 1)), m_verbose(verbose)
+        m_numThreads(std::max<std::size_t>(numThreads, 1)), m_verbose(verbose),
+        m_tasks(queueSize > 0 ? (size_t)queueSize : DefaultQueueSize)
     {
         assert(m_queueSize != 0);
         go();
@@ -75,12 +91,16 @@ public:
     // tasks to complete.
     void join()
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        if (!m_running) return;
-        m_running = false;
-        lock.unlock();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running) return;
+            m_running = false;
+        }
 
+        // Workers do not exit while add() calls that have seen the pool running are
+        // still in progress, so that their tasks get run (see waitForTask()).
         m_consumeCv.notify_all();
+        m_produceCv.notify_all();
         for (auto& t : m_threads) t.join();
         m_threads.clear();
     }
@@ -91,8 +111,9 @@ public:
         join();
 
         // Effectively clear the queue.
-        std::queue<std::function<void()>> q;
-        m_tasks.swap(q);
+        std::function<void()> task;
+        while (m_tasks.pop(task) || popOverflow(task))
+            taskDone();
     }
 
     // Wait for all current tasks to complete.  As opposed to join, tasks may
@@ -100,9 +121,9 @@ public:
     void await()
     {
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_produceCv.wait(lock, [this]()
+        m_doneCv.wait(lock, [this]()
         {
-            return !m_outstanding && m_tasks.empty();
+            return m_pending == 0;
         });
     }
 
@@ -137,26 +158,9 @@ public:
     }
 
 
-    // Add a threaded task, blocking until a thread is available.  If join() is
+    // Add a threaded task, blocking until there is space in the queue.  If join() is
     // called, add() may not be called again until go() is called and completes.
-    bool add(std::function<void()> task)
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        if (!m_running)
-            return false;
-
-        m_produceCv.wait(lock, [this]()
-        {
-            return m_queueSize < 0 || m_tasks.size() < (size_t)m_queueSize;
-        });
-
-        m_tasks.emplace(task);
-
-        // Notify worker that a task is available.
-        lock.unlock();
-        m_consumeCv.notify_all();
-        return true;
-    }
+    bool add(std::function<void()> task);
 
     std::size_t size() const
     { return m_numThreads; }
@@ -176,25 +180,50 @@ public:
     }
 
 private:
+    static constexpr size_t DefaultQueueSize = 4096;
+
     // Worker thread function.  Wait for a task and run it.
     void work();
 
+    // Puts the worker thread to sleep until there may be a task in the queue.
+    // Returns false if the thread should exit (the queue is empty, the pool was joined
+    // and no add() is in progress).
+    bool waitForTask();
+
+    // Takes a task from the overflow list of an unbounded pool. Returns false if it is empty.
+    bool popOverflow(std::function<void()>& task);
+
+    // Moves tasks from the overflow list to free slots of the queue, so that they do not
+    // wait behind tasks added later.
+    void refillFromOverflow();
+
+    // Wakes up one sleeping thread waiting on the condition variable (if there is any).
+    void wakeOne(std::atomic<size_t>& sleeping, std::condition_variable& cv);
+
+    // Marks a task as finished and notifies await() when there are no more tasks.
+    void taskDone();
+
     int64_t m_queueSize;
     std::size_t m_numThreads;
     bool m_verbose;
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    MpmcQueue<std::function<void()>> m_tasks;
+    std::deque<std::function<void()>> m_overflow;  // unbounded pool only: tasks that did not fit into m_tasks
     std::vector<std::string> m_errors;
 
-    std::size_t m_outstanding = 0;
-    bool m_running = false;
+    std::atomic<std::size_t> m_overflowSize {0};
+    std::atomic<std::size_t> m_adding {0};   // add() calls in progress
+    std::atomic<std::size_t> m_pending {0};  // tasks added, but not finished yet
+    std::atomic<std::size_t> m_sleepingWorkers {0};
+    std::atomic<std::size_t> m_waitingProducers {0};
+    std::atomic<bool> m_running {false};
     bool m_trap = false;
     std::string m_catchall = "Unknown error.";
 
     mutable std::mutex m_mutex;
     std::condition_variable m_produceCv;
     std::condition_variable m_consumeCv;
+    std::condition_variable m_doneCv;
 };
 
 } // namespace untwine
-
@@ -11,8 +11,15 @@
  ****************************************************************************/
 
 
+#include <algorithm>
+#include <fstream>
 #include <vector>
 
+#ifdef __linux__
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
 #include <pdal/util/FileUtils.hpp>
 
 #include "Writer.hpp"
@@ -26,17 +33,52 @@ namespace untwine
 namespace epf
 {
 
-Writer::Writer(const std::string& directory, int numThreads, size_t pointSize) :
-    m_directory(directory), m_pool(numThreads), m_stop(false), m_pointSize(pointSize)
+Writer::Writer(const std::string& directory, int numThreads, size_t pointSize,
+        const LasTileEncoder *lasEncoder) :
+    m_directory(directory), m_pool(numThreads),
+    m_files(MaxOpenTileFiles, lasEncoder ? lasEncoder->fileHeader() : std::vector<char>()),
+    m_stop(false), m_pointSize(pointSize), m_lasEncoder(lasEncoder)
 {
     std::function<void()> f = std::bind(&Writer::run, this);
     while (numThreads--)
         m_pool.add(f);
 }
 
+int Writer::defaultThreadCount(const std::string& directory, int maxThreads)
+{
+    // never use more threads than the user asked for with --threads
+    auto limit = [maxThreads](int threads) { return (std::max)(1, (std::min)(threads, maxThreads)); };
+    int ssdThreads = limit(2 * NumWriters);
+    int hddThreads = limit(2);
+
+#ifdef __linux__
+    // Find the block device of the directory in sysfs and check whether it is rotational.
+    // For a partition, the queue attributes are in the directory of the parent device.
+    struct stat st;
+    if (stat(directory.c_str(), &st) != 0)
+        return limit(NumWriters);
+
+    std::string dev = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" +
+        std::to_string(minor(st.st_dev));
+    for (const std::string& queueDir : { dev + "/queue", dev + "/../queue" })
+    {
+        std::ifstream in(queueDir + "/rotational");
+        int rotational;
+        if (in >> rotational)
+            return rotational ? hddThreads : ssdThreads;
+    }
+#else
+    (void)directory;
+    (void)ssdThreads;
+    (void)hddThreads;
+#endif
+    // Unknown disk type.
+    return limit(NumWriters);
+}
+
 std::string Writer::path(const TileKey& key)
 {
-    return m_directory + "/" + key.toString() + ".bin";
+    return m_directory + "/" + key.toString() + (m_lasEncoder ? ".las" : ".bin");
 }
 
 Totals Writer::totals(size_t minSize)
@@ -49,21 +91,19 @@ Totals Writer::totals(size_t minSize)
     return t;
 }
 
+// The buffer cache has its own synchronization, so fetching and replacing buffers
+// does not contend on the lock of the write queue.
 DataVecPtr Writer::fetchBuffer()
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
-
     // If there are fewer items in the queue than we have FileProcessors, we may choose not
     // to block and return a nullptr, expecting that the caller will flush outstanding cells.
-    return m_bufferCache.fetch(lock, m_queue.size() < NumFileProcessors);
+    return m_bufferCache.fetch(m_queueSize < NumFileProcessors);
 }
 
 
 DataVecPtr Writer::fetchBufferBlocking()
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
-
-    return m_bufferCache.fetch(lock, false);
+    return m_bufferCache.fetch(false);
 }
 
 
@@ -72,14 +112,17 @@ void Writer::enqueue(const TileKey& key, DataVecPtr data, size_t dataSize)
     {
         std::lock_guard<std::mutex> lock(m_mutex);
         m_totals[key] += (dataSize / m_pointSize);
-        m_queue.push_back({key, std::move(data), dataSize});
+        std::vector<WriteData>& queue = m_queues[key];
+        if (queue.empty() && m_active.find(key) == m_active.end())
+            m_ready.push_back(key);
+        queue.push_back({key, std::move(data), dataSize});
+        m_queueSize++;
     }
     m_available.notify_one();
 }
 
 void Writer::replace(DataVecPtr data)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
     m_bufferCache.replace(std::move(data));
 }
 
@@ -94,32 +137,76 @@ void Writer::stop()
     std::vector<std::string> errors = m_pool.clearErrors();
     if (errors.size())
         throw FatalError(errors.front());
+    if (m_failed)
+        throw FatalError(m_error);
+    m_files.closeAll();
+}
+
+std::vector<std::string> Writer::finishLasTiles()
+{
+    std::vector<std::string> filenames;
+    for (const auto& ls : m_lasStats)
+    {
+        std::string filename = path(ls.first);
+        std::vector<char> header = m_lasEncoder->tileHeader(ls.second);
+        std::fstream f(toNative(filename), std::ios::in | std::ios::out | std::ios::binary);
+        if (!f.write(header.data(), header.size()))
+            throw FatalError("Failure writing to '" + filename + "'.");
+        filenames.push_back(filename);
+    }
+    return filenames;
+}
+
+void Writer::write(const TileKey& key, const std::vector<WriteData>& batch, LasTileStats *lasStats,
+    std::vector<uint8_t>& lasRecords)
+{
+    std::vector<TileFile::Chunk> chunks;
+    if (m_lasEncoder)
+    {
+        // Convert the points to LAS point records. Nobody else touches the stats
+        // of the key while it's active.
+        size_t numPoints = 0;
+        for (const WriteData& wd : batch)
+            numPoints += wd.dataSize / m_pointSize;
+        lasRecords.resize(numPoints * m_lasEncoder->recordLength());
+        uint8_t *pos = lasRecords.data();
+        for (const WriteData& wd : batch)
+        {
+            size_t count = wd.dataSize / m_pointSize;
+            m_lasEncoder->encode(wd.data->data(), count, pos, *lasStats);
+            pos += count * m_lasEncoder->recordLength();
+        }
+        chunks.push_back({ lasRecords.data(), lasRecords.size() });
+    }
+    else
+    {
+        for (const WriteData& wd : batch)
+            chunks.push_back({ wd.data->data(), wd.dataSize });
+    }
+    TileFile *file = m_files.acquire(key, path(key));
+    file->write(chunks);
+    m_files.release(key);
 }
 
 void Writer::run()
 {
+    std::vector<uint8_t> lasRecords;
     while (true)
     {
-        WriteData wd;
+        std::vector<WriteData> batch;
+        LasTileStats *lasStats = nullptr;
 
         // Loop waiting for data.
         while (true)
         {
             std::unique_lock<std::mutex> lock(m_mutex);
 
-            // Look for a queue entry that represents a key that we aren't already
-            // actively processing.
-            //ABELL - Perhaps a writer should grab and write *all* the entries in the queue
-            //  that match the key we found.
-            auto li = m_queue.begin();
-            for (; li != m_queue.end(); ++li)
-                if (std::find(m_active.begin(), m_active.end(), li->key) == m_active.end())
-                    break;
-
-            // If there is no data to process, exit if we're stopping. Wait otherwise.
-            // If there is data to process, stick the key on the active list and
-            // remove the item from the queue and break to do the actual write.
-            if (li == m_queue.end())
+            // If there is no key ready to be processed, exit if we're stopping. Wait otherwise.
+            // Keys with buffers that are being processed by other writer threads will be
+            // made ready again by those threads.
+            // If there is a ready key, stick it in the active set, take all its buffers from
+            // the queue and break to do the actual write.
+            if (m_ready.empty())
             {
                 if (m_stop)
                     return;
@@ -127,24 +214,55 @@ void Writer::run()
             }
             else
             {
-                m_active.push_back(li->key);
-                wd = std::move(*li);
-                m_queue.erase(li);
+                TileKey key = m_ready.front();
+                m_ready.pop_front();
+                m_active.insert(key);
+                auto qi = m_queues.find(key);
+                batch = std::move(qi->second);
+                m_queues.erase(qi);
+                m_queueSize -= batch.size();
+                if (m_lasEncoder)
+                    lasStats = &m_lasStats[key];
                 break;
             }
         }
 
-        // Open the file. Write the data. Stick the buffer back on the cache.
-        // Remove the key from the active key list.
-        std::ofstream out(untwine::toNative(path(wd.key)), std::ios::app | std::ios::binary);
-        out.write(reinterpret_cast<const char *>(wd.data->data()), wd.dataSize);
-        out.close();
-        if (!out)
-            throw FatalError("Failure writing to '" + path(wd.key) + "'.");
+        // Write all the data with a single call to the (already open) file.
+        // Stick the buffers back on the cache. Remove the key from the active key set
+        // and make it ready again if more buffers were queued for it in the meantime.
+        TileKey key = batch.front().key;
+        // After an error, the buffers are still taken from the queue and put back to the cache,
+        // so that FileProcessors waiting for buffers do not get stuck. stop() reports the error.
+        if (!m_failed)
+        {
+            try
+            {
+                write(key, batch, lasStats, lasRecords);
+            }
+            catch (const std::exception& err)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_failed)
+                    m_error = err.what();
+                m_failed = true;
+            }
+        }
+
+        for (WriteData& wd : batch)
+            m_bufferCache.replace(std::move(wd.data));
 
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_bufferCache.replace(std::move(wd.data));
-        m_active.remove(wd.key);
+        bool ready = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_active.erase(key);
+            if (m_queues.find(key) != m_queues.end())
+            {
+                m_ready.push_back(key);
+                ready = true;
+            }
+        }
+        if (ready)
+            m_available.notify_one();
     }
 }
 
@@ -13,13 +13,19 @@
 
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
-#include <list>
+#include <deque>
 #include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "EpfTypes.hpp"
 #include "BufferCache.hpp"
+#include "FileHandleCache.hpp"
+#include "LasTile.hpp"
 #include "ThreadPool.hpp"
 #include "TileKey.hpp"
 
@@ -35,9 +41,17 @@ namespace epf
 // We can't have multiple writer threads write to the same file simultaneously, so rather than
 // lock (which might stall threads that could otherwise be working), we make sure that only
 // one writer thread is working on a file at a time by sticking
-// the key of the thread in an "active" list.  A writer thread looking for work will ignore
-// any buffer on the queue that's for a file currently being handled by another writer thread.
+// the key of the thread in an "active" set.  Buffers are queued per key, and keys that have
+// queued buffers and aren't active are kept in a "ready" FIFO, so a writer thread looking for
+// work simply takes the first ready key. When a writer thread is done with a key that got
+// more buffers in the meantime, the key goes to the end of the ready FIFO.
 // 
+// Tile files are kept open between writes in a cache of file handles, and a writer thread
+// takes all the buffers queued for the key it picked and appends them to the file at once.
+//
+// If the writer has a LAS tile encoder, the points are converted to LAS point records before
+// they are written, and the files are LAS tiles (with their headers filled in by finishLasTiles()).
+//
 // The writer owns a buffer cache. The cache manages the actual data buffers that are filled
 // by the file processors and written by a writer thread. The buffers are created as needed
 // until some predefined number of buffers is hit in order to limit memory use.
@@ -68,7 +82,12 @@ class Writer
     };
 
 public:
-    Writer(const std::string& directory, int numThreads, size_t pointSize);
+    Writer(const std::string& directory, int numThreads, size_t pointSize,
+        const LasTileEncoder *lasEncoder = nullptr);
+
+    // Number of writer threads that suits the disk with the directory: a few threads keep
+    // an SSD busy, while more threads only add seeks on a rotational disk. At most maxThreads.
+    static int defaultThreadCount(const std::string& directory, int maxThreads);
 
     void replace(DataVecPtr data);
     void enqueue(const TileKey& key, DataVecPtr data, size_t dataSize);
@@ -78,21 +97,33 @@ public:
     Totals totals(size_t minSize);
     DataVecPtr fetchBuffer();
     DataVecPtr fetchBufferBlocking();
+    // Writes the final headers of LAS tiles (after stop()) and returns the tile filenames.
+    std::vector<std::string> finishLasTiles();
 
 private:
     std::string path(const TileKey& key);
+    // Writes a batch of buffers of the key to its file (throws on error).
+    void write(const TileKey& key, const std::vector<WriteData>& batch, LasTileStats *lasStats,
+        std::vector<uint8_t>& lasRecords);
     void run();
 
     std::string m_directory;
     ThreadPool m_pool;
     BufferCache m_bufferCache;
+    FileHandleCache m_files;
     bool m_stop;
     size_t m_pointSize;
-    std::list<WriteData> m_queue;
-    std::list<TileKey> m_active;
+    const LasTileEncoder *m_lasEncoder;
+    std::unordered_map<TileKey, LasTileStats> m_lasStats;
+    std::unordered_map<TileKey, std::vector<WriteData>> m_queues;
+    std::deque<TileKey> m_ready;
+    std::atomic<size_t> m_queueSize {0};  // number of queued buffers, can be read without the lock
+    std::unordered_set<TileKey> m_active;
     Totals m_totals;
     std::mutex m_mutex;
     std::condition_variable m_available;
+    std::atomic<bool> m_failed {false};   // a write failed (the first error is in m_error)
+    std::string m_error;
 };
 
 } // namespace epf
@@ -28,6 +28,8 @@
 #include "Writer.hpp"
 #include "FileProcessor.hpp"
 #include "Las.hpp"
+#include "LasTile.hpp"
+#include "TempFileReader.hpp"
 
 #include "../utils.hpp"
 #include "../vpc.hpp"
@@ -126,6 +128,9 @@ public:
         bool metadata;
 
         int max_threads;
+        int writerThreads;          // threads writing temp files in the first pass (0 = auto)
+        bool singlePass;            // write LAS tiles directly in the first pass
+        bool compactTemp;           // store LAS point records in the temp files
         std::string outputFormat;   // las or laz (for now)
         bool buildVpc = false;
         std::string inputFileList; // file list with input files
@@ -140,6 +145,9 @@ public:
     using d3 = std::array<double, 3>;
     d3 scale { -1.0, -1.0, -1.0 };
     d3 offset {};
+
+    // set if the temp files hold LAS point records (compact temp files)
+    std::unique_ptr<untwine::epf::LasTileEncoder> tempEncoder;
 };
 
 
@@ -384,18 +392,16 @@ static void fillMetadata(const pdal::PointLayoutPtr layout, BaseInfo &m_b, const
 
 
 
-static void writeOutputFile(const std::string& filename, pdal::PointViewPtr view, const BaseInfo &m_b)
+static void writeOutputFile(const std::string& filename, pdal::Stage& input, pdal::PointTableRef table, const BaseInfo &m_b)
 {
     using namespace pdal;
 
     StageFactory factory;
 
-    BufferReader r;
-    r.addView(view);
-
-    Stage *prev = &r;
+    Stage *prev = &input;
 
-    if (view->layout()->hasDim(Dimension::Id::GpsTime))
+    if (std::any_of(m_b.dimInfo.begin(), m_b.dimInfo.end(),
+            [](const untwine::FileDimInfo& fdi) { return fdi.dim == Dimension::Id::GpsTime; }))
     {
         Stage *f = factory.createStage("filters.sort");
         pdal::Options fopts;
@@ -427,8 +433,39 @@ static void writeOutputFile(const std::string& filename, pdal::PointViewPtr view
     w->setOptions(wopts);
     w->setInput(*prev);
 
-    w->prepare(view->table());
-    w->execute(view->table());
+    w->prepare(table);
+    w->execute(table);
+}
+
+
+// Creates encoder of LAS point records for writing the tiles directly in the first pass
+// or for compact temp files. Header and VLRs of the tiles are taken from an empty tile
+// written by writers.las.
+static std::unique_ptr<untwine::epf::LasTileEncoder> createLasTileEncoder(const BaseInfo &m_b)
+{
+    using namespace pdal;
+
+    std::string headerFile = m_b.opts.tempDir + "/header.las";
+    {
+        PointTable table;
+        for (const untwine::FileDimInfo& fdi : m_b.dimInfo)
+            table.layout()->registerOrAssignDim(fdi.name, fdi.type);
+        table.finalize();
+
+        PointViewPtr view(new pdal::PointView(table));
+        BufferReader r;
+        r.addView(view);
+        writeOutputFile(headerFile, r, table, m_b);
+    }
+
+    LasHeader header;
+    bool valid = header.read(headerFile);
+    pdal::FileUtils::deleteFile(headerFile);
+    if (!valid)
+        throw FatalError("Unable to read header of an empty tile: " + headerFile);
+
+    return std::unique_ptr<untwine::epf::LasTileEncoder>(
+        new untwine::epf::LasTileEncoder(m_b.dimInfo, m_b.pointSize, header));
 }
 
 
@@ -456,6 +493,12 @@ void addArgs(pdal::ProgramArgs& programArgs, BaseInfo::Options& options, pdal::A
         options.metadata, false);
 
     threadsArg = &(programArgs.add("threads", "Max number of concurrent threads for parallel runs", options.max_threads));
+    programArgs.add("writer_threads", "Number of threads writing temporary files (default: based on the type "
+        "of the disk with the temp directory)", options.writerThreads, 0);
+    programArgs.add("single_pass", "Write LAS tiles directly while reading the input, without temporary files "
+        "(points are not sorted by GPS time, only for LAS output)", options.singlePass, false);
+    programArgs.add("compact_temp", "Store points in temporary files as LAS point records (quantized "
+        "coordinates, packed flags) to use less disk space", options.compactTemp, false);
 }
 
 bool handleOptions(pdal::StringList& arglist, BaseInfo::Options& options)
@@ -503,6 +546,11 @@ bool handleOptions(pdal::StringList& arglist, BaseInfo::Options& options)
         if (options.outputFormat != "las" && options.outputFormat != "laz")
             throw FatalError("Unknown output format: " + options.outputFormat);
     }
+    if (options.singlePass && options.outputFormat != "las")
+    {
+        std::cout << "Single pass tiling is only possible with LAS output, using two passes." << std::endl;
+        options.singlePass = false;
+    }
 
     if (!options.inputFileList.empty())
     {
@@ -542,7 +590,9 @@ void createDirs(const BaseInfo::Options& options)
 
 
 
-static void tilingPass1(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo)
+// Returns true if the tiles were written directly as LAS files (their names are in outFiles),
+// or false if they need to be written from the temporary files by tilingPass2().
+static bool tilingPass1(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo, StringList &outFiles)
 {
   //---------
   // pass 1: read input files and write temporary files with raw point data
@@ -593,9 +643,37 @@ static void tilingPass1(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo
 
   fillMetadata( layout, m_b, m_grid, m_srsFileInfo );
 
+  // In single pass mode, points are written as LAS records to the tiles in the output directory.
+  // With compact temp files, FileProcessors write LAS records to the temp files instead.
+  std::unique_ptr<untwine::epf::LasTileEncoder> lasEncoder;
+  if (m_b.opts.singlePass || m_b.opts.compactTemp)
+      lasEncoder = createLasTileEncoder(m_b);
+  if (m_b.opts.singlePass && lasEncoder->header().evlrCount)
+  {
+      // extended VLRs would have to be written after the points
+      std::cout << "Tiles need extended VLRs, using two passes." << std::endl;
+      m_b.opts.singlePass = false;
+  }
+  if (!m_b.opts.singlePass)
+  {
+      // the encoder is only kept for compact temp files - when single pass mode was not possible,
+      // regular temp files are used unless compact ones were requested too
+      if (m_b.opts.compactTemp)
+          m_b.tempEncoder = std::move(lasEncoder);
+      else
+          lasEncoder.reset();
+      std::cout << "Temp files:       " << (m_b.tempEncoder ? "compact" : "regular") << std::endl;
+  }
+  std::string dataDir = lasEncoder ? m_b.opts.outputDir : m_b.opts.tempDir;
+
   // Check if we have enough disk space at all
-  size_t bytesNeeded = totalPoints * m_b.pointSize;
-  std::filesystem::space_info space_info = std::filesystem::space(m_b.opts.tempDir);
+  size_t recordSize = m_b.pointSize;
+  if (lasEncoder)
+      recordSize = lasEncoder->recordLength();
+  else if (m_b.tempEncoder)
+      recordSize = m_b.tempEncoder->recordLength();
+  size_t bytesNeeded = totalPoints * recordSize;
+  std::filesystem::space_info space_info = std::filesystem::space(dataDir);
   std::cout << "Total points:     " << totalPoints/1000000. << " M" << std::endl;
   std::cout << "Space needed:     " << bytesNeeded/1000./1000./1000. << " GB" << std::endl;
   std::cout << "Space available:  " << space_info.available/1000./1000./1000. << " GB" << std::endl;
@@ -604,8 +682,13 @@ static void tilingPass1(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo
 
   // TODO: ideally we should check also for space in the output directory (but that's harder to estimate)
 
-  // Make a writer with NumWriters threads.
-  m_writer.reset(new untwine::epf::Writer(m_b.opts.tempDir, NumWriters, layout->pointSize()));
+  // Make a writer with the requested number of threads, or as many as suits the temp disk.
+  int numWriters = m_b.opts.writerThreads;
+  if (numWriters <= 0)
+      numWriters = untwine::epf::Writer::defaultThreadCount(dataDir, m_b.opts.max_threads);
+  std::cout << "Writer threads:   " << numWriters << std::endl;
+  m_writer.reset(new untwine::epf::Writer(dataDir, numWriters,
+      m_b.tempEncoder ? recordSize : layout->pointSize(), lasEncoder.get()));
 
   // Sort file infos so the largest files come first. This helps to make sure we don't delay
   // processing big files that take the longest (use threads more efficiently).
@@ -620,9 +703,10 @@ static void tilingPass1(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo
   for (const FileInfo& fi : fileInfos)
   {
       int pointSize = layout->pointSize();
-      m_pool.add([&fi, &progressBar, pointSize, &m_grid, &m_writer]()
+      const untwine::epf::LasTileEncoder *tempEncoder = m_b.tempEncoder.get();
+      m_pool.add([&fi, &progressBar, pointSize, tempEncoder, &m_grid, &m_writer]()
       {
-          untwine::epf::FileProcessor fp(fi, pointSize, m_grid, m_writer.get(), progressBar);
+          untwine::epf::FileProcessor fp(fi, pointSize, m_grid, m_writer.get(), progressBar, tempEncoder);
           fp.run();
       });
   }
@@ -639,10 +723,17 @@ static void tilingPass1(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo
   std::vector<std::string> errors = m_pool.clearErrors();
   if (errors.size())
       throw FatalError(errors.front());
+
+  if (!lasEncoder)
+      return false;
+
+  outFiles = m_writer->finishLasTiles();
+  std::sort(outFiles.begin(), outFiles.end());
+  return true;
 }
 
 
-static void tilingPass2(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo)
+static void tilingPass2(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo, StringList &outFiles)
 {
   (void)m_grid;
   (void)m_srsFileInfo;
@@ -654,7 +745,6 @@ static void tilingPass2(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo
   m_pool2.trap(true);
 
   std::vector<std::string> lstBinFiles = directoryList(m_b.opts.tempDir);
-  std::vector<std::string> outFiles;
 
   ProgressBar progressBar;
   progressBar.init(lstBinFiles.size());
@@ -667,54 +757,12 @@ static void tilingPass2(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo
 
       m_pool2.add([binFile, outFilename, &m_b, &progressBar]()
       {
-          PointTable table;
-
-          //ABELL - fixme
-          // For now we copy the dimension list so we're sure that it matches the layout, though
-          // there's no reason why it should change. We should modify things to use a single
-          // layout.
-
-          Dimension::IdList lasDims = untwine::pdrfDims(m_b.pointFormatId);
-          untwine::DimInfoList dims = m_b.dimInfo;
-          for (untwine::FileDimInfo& fdi : dims)
-          {
-              fdi.dim = table.layout()->registerOrAssignDim(fdi.name, fdi.type);
-          }
-          table.finalize();
-
-          PointViewPtr view(new pdal::PointView(table));
-
-          std::size_t ptCnt = 0;
-          std::ifstream fileReader(binFile,std::ios::binary|std::ios::ate);
-          if (!fileReader)
-          {
-            throw FatalError("Unable to open temporary file: " + binFile);
-          }
-          auto fileSize = fileReader.tellg();
-          fileReader.seekg(std::ios::beg);
-
-          ptCnt = fileSize / m_b.pointSize;
-
-          const size_t readChunkSize = 10'000;
-          std::string content(readChunkSize*m_b.pointSize, 0);
-          char *contentPtr = content.data();
-
-          pdal::PointId pointId = view->size();
-          for (size_t i = 0; i < ptCnt; i+= readChunkSize)
-          {
-              size_t nPointsToRead = (std::min)(readChunkSize, ptCnt-i);
-              fileReader.read(contentPtr, nPointsToRead*m_b.pointSize);
-              for (std::size_t a = 0; a < nPointsToRead; ++a)
-              {
-                  char *base = contentPtr + a * m_b.pointSize;
-                  for (const untwine::FileDimInfo& fdi : dims)
-                      view->setField(fdi.dim, fdi.type, pointId,
-                          reinterpret_cast<void *>(base + fdi.offset));
-                  pointId++;
-              }
-          }
-
-          writeOutputFile( outFilename, view, m_b);
+          // The temporary file is memory mapped and its records are copied to the points
+          // of the table in bulk by the reader (after decoding them if they are compact).
+          untwine::epf::RawPointTable table;
+          untwine::epf::TempFileReader reader(binFile, m_b.dimInfo, m_b.pointSize, m_b.tempEncoder.get());
+
+          writeOutputFile(outFilename, reader, table, m_b);
 
           progressBar.add();
       });
@@ -727,14 +775,6 @@ static void tilingPass2(BaseInfo &m_b, TileGrid &m_grid, FileInfo &m_srsFileInfo
       throw FatalError(errors.front());
 
   progressBar.done();
-
-  if (m_b.opts.buildVpc)
-  {
-      std::vector<std::string> args;
-      args.push_back("--output=" + m_b.opts.outputDir + ".vpc");
-      args.insert(args.end(), outFiles.begin(), outFiles.end());
-      buildVpc(args);
-  }
 }
 
 
@@ -759,8 +799,17 @@ int runTile(std::vector<std::string> arglist)
 
       auto start = std::chrono::high_resolution_clock::now();
 
-      tilingPass1(m_b, m_grid, m_srsFileInfo);
-      tilingPass2(m_b, m_grid, m_srsFileInfo);
+      StringList outFiles;
+      if (!tilingPass1(m_b, m_grid, m_srsFileInfo, outFiles))
+          tilingPass2(m_b, m_grid, m_srsFileInfo, outFiles);
+
+      if (m_b.opts.buildVpc)
+      {
+          std::vector<std::string> args;
+          args.push_back("--output=" + m_b.opts.outputDir + ".vpc");
+          args.insert(args.end(), outFiles.begin(), outFiles.end());
+          buildVpc(args);
+      }
 
       // clean up temp files
       if (!m_b.opts.preserveTempDir)
@@ -10,6 +10,7 @@
  *                                                                           *
  ****************************************************************************/
 
+#include <cmath>
 #include <iostream>
 #include <filesystem>
 #include <thread>
@@ -21,6 +22,7 @@
 #include "utils.hpp"
 #include "alg.hpp"
 #include "vpc.hpp"
+#include "raster_grid.hpp"
 
 using namespace pdal;
 
@@ -76,7 +78,7 @@ bool ToRaster::checkArgs()
 
 
 
-static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double resolution, std::string attribute, double collarSize)
+static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, RasterMosaic *mosaic, double resolution, std::string attribute, double collarSize)
 {
     std::unique_ptr<PipelineManager> manager( new PipelineManager );
 
@@ -116,7 +118,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double r
             {
                 // add "bounds" option to reader
                 pdal::Options copc_opts;
-                copc_opts.add(pdal::Option("threads", 1));
+                copc_opts.add(pdal::Option("threads", tile->readerThreads));
                 copc_opts.add(pdal::Option("bounds", box_to_pdal_bounds(boxWithCollar)));
                 reader->addOptions(copc_opts);
             }
@@ -146,31 +148,9 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double r
         last.push_back(filterExpr);
     }
 
-    pdal::Options writer_opts;
-    writer_opts.add(pdal::Option("output_type", "idw"));  // TODO: other outputs like min/max/mean as well?
-    writer_opts.add(pdal::Option("dimension", attribute));
-    writer_opts.add(pdal::Option("resolution", resolution));
-
-    writer_opts.add(pdal::Option("data_type", "float32"));
-    writer_opts.add(pdal::Option("gdalopts", "TILED=YES"));
-    writer_opts.add(pdal::Option("gdalopts", "COMPRESS=DEFLATE"));
-
-    if (box.valid())
-    {
-        BOX2D box2 = box;
-        // fix tile size - PDAL's writers.gdal adds one pixel (see GDALWriter::createGrid()),
-        // because it probably expects that that the bounds and resolution do not perfectly match
-        box2.maxx -= resolution;
-        box2.maxy -= resolution;
-
-        writer_opts.add(pdal::Option("bounds", box_to_pdal_bounds(box2)));
-    }
-
-    // TODO: "writers.gdal: Requested driver 'COG' does not support file creation.""
-    //   writer_opts.add(pdal::Option("gdaldriver", "COG"));
-
-    pdal::StageCreationOptions opts{ tile->outputFilename, "", nullptr, writer_opts, "" };
-    Stage& w = manager->makeWriter( opts );
+    // interpolate values directly into our part of the output raster (points in the collar
+    // contribute to cells within the radius as well) - radius is the same as the default of writers.gdal
+    Stage& w = makeGridWriter(manager.get(), mosaic, box, GridOutputType::Idw, attribute, resolution * std::sqrt(2.0));
     for (Stage *stage : last)
         w.setInput(*stage);
 
@@ -180,6 +160,9 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double r
 
 void ToRaster::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipelines)
 {
+    // tile jobs - their pipelines get created at the end, once we know how many jobs there are
+    std::vector<ParallelJobInfo> tiles;
+
     if (isVpcFilename(inputFile))
     {
         // using spatial processing
@@ -188,11 +171,6 @@ void ToRaster::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
         if (!vpc.read(inputFile))
             return;
 
-        // for /tmp/hello.tif we will use /tmp/hello dir for all results
-        fs::path outputParentDir = fs::path(outputFile).parent_path();
-        fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
-        fs::create_directories(outputSubdir);
-
         // TODO: optionally adjust origin to have nicer numbers for bounds?
         if (tileAlignment.originX == -1)
             tileAlignment.originX = bounds.minx;
@@ -212,16 +190,20 @@ void ToRaster::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
           std::cout << "tiles " << t.tileCountX << " " << t.tileCountY << std::endl;
         }
 
+        if (!openMosaic(gridBounds))
+            return;
+
         totalPoints = 0;  // we need to recalculate as we may use some points multiple times
         for (int iy = 0; iy < t.tileCountY; ++iy)
         {
             for (int ix = 0; ix < t.tileCountX; ++ix)
             {
-                BOX2D tileBox = t.boxAt(ix, iy);
-
                 // for tiles that are smaller than full box - only use intersection
-                // to avoid empty areas in resulting rasters
-                tileBox.clip(gridBounds);
+                // to avoid empty areas in resulting rasters (tiles also need to be aligned
+                // to cells of the raster in case tile size is not a multiple of resolution)
+                BOX2D tileBox = mosaic->snapToGrid(t.boxAt(ix, iy));
+                if (tileBox.minx >= tileBox.maxx || tileBox.miny >= tileBox.maxy)
+                    continue;
 
                 if (!filterBounds.empty() && !intersectionBox2D(tileBox, parseBounds(filterBounds).to2d()).valid())
                 {
@@ -236,23 +218,17 @@ void ToRaster::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
                 BOX2D boxWithCollar = tileBox;
                 boxWithCollar.grow(collarSize);
 
-                for (const VirtualPointCloud::File & f: vpc.overlappingBox2D(boxWithCollar))
+                for (size_t fileIndex : vpc.overlappingBox2D(boxWithCollar))
                 {
+                    const VirtualPointCloud::File &f = vpc.files[fileIndex];
                     tile.inputFilenames.push_back(f.filename);
                     totalPoints += f.count;
                 }
                 if (tile.inputFilenames.empty())
                     continue;   // no input files for this tile
 
-                // create temp output file names
-                // for tile (x=2,y=3) that goes to /tmp/hello.tif,
-                // individual output file will be called /tmp/hello/2_3.tif
-                fs::path inputBasename = std::to_string(ix) + "_" + std::to_string(iy);
-                tile.outputFilename = (outputSubdir / inputBasename).string() + ".tif";
-
-                tileOutputFiles.push_back(tile.outputFilename);
-
-                pipelines.push_back(pipeline(&tile, resolution, attribute, collarSize));
+                pipelineCosts.push_back(vpc.estimatedPointCount(boxWithCollar));
+                tiles.push_back(tile);
             }
         }
     }
@@ -260,11 +236,6 @@ void ToRaster::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
     {
         // using square tiles for single COPC
 
-        // for /tmp/hello.tif we will use /tmp/hello dir for all results
-        fs::path outputParentDir = fs::path(outputFile).parent_path();
-        fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
-        fs::create_directories(outputSubdir);
-
         if (tileAlignment.originX == -1)
             tileAlignment.originX = bounds.minx;
         if (tileAlignment.originY == -1)
@@ -272,11 +243,16 @@ void ToRaster::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
 
         Tiling t = tileAlignment.coverBounds(bounds.to2d());
 
+        if (!openMosaic(t.fullBox()))
+            return;
+
         for (int iy = 0; iy < t.tileCountY; ++iy)
         {
             for (int ix = 0; ix < t.tileCountX; ++ix)
             {
-                BOX2D tileBox = t.boxAt(ix, iy);
+                BOX2D tileBox = mosaic->snapToGrid(t.boxAt(ix, iy));
+                if (tileBox.minx >= tileBox.maxx || tileBox.miny >= tileBox.maxy)
+                    continue;
 
                 if (!filterBounds.empty() && !intersectionBox2D(tileBox, parseBounds(filterBounds).to2d()).valid())
                 {
@@ -288,19 +264,7 @@ void ToRaster::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
                 ParallelJobInfo tile(ParallelJobInfo::Spatial, tileBox, filterExpression, filterBounds);
                 tile.inputFilenames.push_back(inputFile);
 
-                // add collar to avoid edge effects
-                BOX2D boxWithCollar = tileBox;
-                boxWithCollar.grow(collarSize);
-
-                // create temp output file names
-                // for tile (x=2,y=3) that goes to /tmp/hello.tif,
-                // individual output file will be called /tmp/hello/2_3.tif
-                fs::path inputBasename = std::to_string(ix) + "_" + std::to_string(iy);
-                tile.outputFilename = (outputSubdir / inputBasename).string() + ".tif";
-
-                tileOutputFiles.push_back(tile.outputFilename);
-
-                pipelines.push_back(pipeline(&tile, resolution, attribute, collarSize));
+                tiles.push_back(tile);
             }
         }
     }
@@ -308,24 +272,49 @@ void ToRaster::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
     {
         // single input LAS/LAZ - no parallelism
 
+        TileAlignment gridAlignment;
+        gridAlignment.originX = bounds.minx;
+        gridAlignment.originY = bounds.miny;
+        gridAlignment.tileSize = resolution;
+        BOX2D dataBounds = bounds.to2d();
+        if (!filterBounds.empty())
+            dataBounds = intersectionBox2D(dataBounds, parseBounds(filterBounds).to2d());
+        if (!openMosaic(gridAlignment.coverBounds(dataBounds.valid() ? dataBounds : bounds.to2d()).fullBox()))
+            return;
+
         ParallelJobInfo tile(ParallelJobInfo::Single, BOX2D(), filterExpression, filterBounds);
         tile.inputFilenames.push_back(inputFile);
-        tile.outputFilename = outputFile;
-        pipelines.push_back(pipeline(&tile, resolution, attribute, 0));
+        pipelines.push_back(pipeline(&tile, mosaic.get(), resolution, attribute, 0));
+    }
+
+    // with only a few tiles (e.g. when "bounds" selects a small area), readers of each job
+    // get more threads to decompress data, so that the other threads are not left idle
+    int readerThreads = readerThreadsPerJob(tiles.size(), max_threads);
+    for (ParallelJobInfo &tile : tiles)
+    {
+        tile.readerThreads = readerThreads;
+        pipelines.push_back(pipeline(&tile, mosaic.get(), resolution, attribute, collarSize));
     }
+}
 
+
+bool ToRaster::openMosaic(const BOX2D &gridBounds)
+{
+    mosaic.reset(new RasterMosaic(gridBounds, resolution, GDT_Float32, -9999));
+    if (!mosaic->open(outputFile, crs.getWKT()))
+    {
+        mosaic.reset();
+        return false;
+    }
+    return true;
 }
 
 
 void ToRaster::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
 {
-    if (!tileOutputFiles.empty())
+    if (mosaic)
     {
-        rasterTilesToCog(tileOutputFiles, outputFile);
-
-        // clean up the temporary directory
-        fs::path outputParentDir = fs::path(outputFile).parent_path();
-        fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
-        fs::remove_all(outputSubdir);
+        mosaic->finish(max_threads);
+        mosaic.reset();
     }
 }
@@ -21,6 +21,7 @@
 #include "utils.hpp"
 #include "alg.hpp"
 #include "vpc.hpp"
+#include "profile.hpp"
 
 using namespace pdal;
 
@@ -120,7 +121,7 @@ std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double resoluti
             {
                 // add "bounds" option to reader
                 pdal::Options copc_opts;
-                copc_opts.add(pdal::Option("threads", 1));
+                copc_opts.add(pdal::Option("threads", tile->readerThreads));
                 copc_opts.add(pdal::Option("bounds", box_to_pdal_bounds(boxWithCollar)));
                 reader->addOptions(copc_opts);
             }
@@ -180,13 +181,13 @@ std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double resoluti
         faceRaster_opts.add(pdal::Option("height", ceil((box.maxy-box.miny)/resolution)));
     }
 
-    Stage &faceRaster = manager->makeFilter("filters.faceraster", delaunay, faceRaster_opts);
+    Stage &faceRaster = makeFilter(manager.get(), "filters.faceraster", delaunay, faceRaster_opts);
 
     pdal::Options writer_opts;
     writer_opts.add(pdal::Option("data_type", "float32"));  // default was float64 which seems like too much
     writer_opts.add(pdal::Option("gdalopts", "TILED=YES"));
     writer_opts.add(pdal::Option("gdalopts", "COMPRESS=DEFLATE"));
-    (void)manager->makeWriter(tile->outputFilename, "writers.raster", faceRaster);
+    (void)manager->makeWriter(tile->outputFilename, "writers.raster", profileProbe(manager.get(), faceRaster));
 
     return manager;
 }
@@ -194,6 +195,9 @@ std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, double resoluti
 
 void ToRasterTin::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& pipelines)
 {
+    // tile jobs - their pipelines get created at the end, once we know how many jobs there are
+    std::vector<ParallelJobInfo> tiles;
+
     if (isVpcFilename(inputFile))
     {
         // using spatial processing
@@ -250,8 +254,9 @@ void ToRasterTin::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>
                 BOX2D boxWithCollar = tileBox;
                 boxWithCollar.grow(collarSize);
 
-                for (const VirtualPointCloud::File & f: vpc.overlappingBox2D(boxWithCollar))
+                for (size_t fileIndex : vpc.overlappingBox2D(boxWithCollar))
                 {
+                    const VirtualPointCloud::File &f = vpc.files[fileIndex];
                     tile.inputFilenames.push_back(f.filename);
                     totalPoints += f.count;
                 }
@@ -266,7 +271,8 @@ void ToRasterTin::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>
 
                 tileOutputFiles.push_back(tile.outputFilename);
 
-                pipelines.push_back(pipeline(&tile, resolution, maxTriangleEdgeLength, collarSize));
+                pipelineCosts.push_back(vpc.estimatedPointCount(boxWithCollar));
+                tiles.push_back(tile);
             }
         }
     }
@@ -314,7 +320,7 @@ void ToRasterTin::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>
 
                 tileOutputFiles.push_back(tile.outputFilename);
 
-                pipelines.push_back(pipeline(&tile, resolution, maxTriangleEdgeLength, collarSize));
+                tiles.push_back(tile);
             }
         }
     }
@@ -325,13 +331,22 @@ void ToRasterTin::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>
         tile.outputFilename = outputFile;
         pipelines.push_back(pipeline(&tile, resolution, maxTriangleEdgeLength, 0));
     }
+
+    // with only a few tiles (e.g. when "bounds" selects a small area), readers of each job
+    // get more threads to decompress data, so that the other threads are not left idle
+    int readerThreads = readerThreadsPerJob(tiles.size(), max_threads);
+    for (ParallelJobInfo &tile : tiles)
+    {
+        tile.readerThreads = readerThreads;
+        pipelines.push_back(pipeline(&tile, resolution, maxTriangleEdgeLength, collarSize));
+    }
 }
 
 void ToRasterTin::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
 {
     if (!tileOutputFiles.empty())
     {
-        rasterTilesToCog(tileOutputFiles, outputFile);
+        rasterTilesToCog(tileOutputFiles, outputFile, max_threads);
 
         // clean up the temporary directory
         fs::path outputParentDir = fs::path(outputFile).parent_path();
@@ -21,10 +21,12 @@
 #include <pdal/Polygon.hpp>
 
 #include <gdal_utils.h>
+#include <ogr_api.h>
 
 #include "utils.hpp"
 #include "alg.hpp"
 #include "vpc.hpp"
+#include "profile.hpp"
 
 using namespace pdal;
 
@@ -71,21 +73,21 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, const st
         else
         {
             // Reader can't do the filtering - do it with a filter
-            last = &manager->makeFilter( "filters.crop", *last, filter_opts);
+            last = &makeFilter(manager.get(), "filters.crop", *last, filter_opts);
         }
     }
     if (!tile->filterExpression.empty())
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", tile->filterExpression));
-        last = &manager->makeFilter( "filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
     pdal::Options writer_opts;
     writer_opts.add(pdal::Option("ogrdriver", "GPKG"));
     if (!attributes.empty())
         writer_opts.add(pdal::Option("attr_dims", join_strings(attributes, ',')));
-    (void)manager->makeWriter( tile->outputFilename, "writers.ogr", *last, writer_opts);
+    (void)manager->makeWriter( tile->outputFilename, "writers.ogr", profileProbe(manager.get(), *last), writer_opts);
 
     return manager;
 }
@@ -117,8 +119,12 @@ void ToVector::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
 
             tileOutputFiles.push_back(tile.outputFilename);
 
+            pipelineCosts.push_back(f.count);
             pipelines.push_back(pipeline(&tile, attributes));
         }
+
+        // outputs of jobs get appended to the output file as soon as they are finished
+        outputAppender.reset(new OutputConsumer([this](const std::string &tileOutputFile) { return appendToOutput(tileOutputFile); }));
     }
     else
     {
@@ -129,91 +135,72 @@ void ToVector::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>& p
     }
 }
 
-void ToVector::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
+void ToVector::jobFinished(size_t pipelineIndex)
 {
-    if (tileOutputFiles.empty())
-        return;
+    if (outputAppender)
+        outputAppender->add(tileOutputFiles[pipelineIndex]);
+}
 
-    if (isVpcFilename(inputFile))
-    {
-        // for /tmp/hello.vpc we will use /tmp/hello dir for all results
-        fs::path outputParentDir = fs::path(outputFile).parent_path();
-        fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
-        fs::path vrtFile = outputSubdir / "all.vrt";
-        
-        // remove vrt if it exist
-        if (fs::exists(vrtFile))
-        {
-            fs::remove(vrtFile);
-        }
+bool ToVector::appendToOutput(const std::string &tileOutputFile)
+{
+    ProfileScope profileScope("appendToOutput");
 
-        std::ofstream outputStreamFile(vrtFile);
-        
-        // check if file opened successfully and write VRT content to it
-        if (outputStreamFile.is_open()) {
-            
-            outputStreamFile << "<OGRVRTDataSource>" << std::endl;
-            outputStreamFile << "<OGRVRTUnionLayer name=\"points\">" << std::endl;
-
-            for (const std::string& f : tileOutputFiles)
-            {   
-                outputStreamFile << "<OGRVRTLayer name=\"" << fs::path(f).stem().string() << "\">" << std::endl;
-                outputStreamFile << "<SrcDataSource>" << f <<  "</SrcDataSource>" << std::endl;
-                outputStreamFile << "<SrcLayer>points</SrcLayer>" << std::endl;
-                outputStreamFile << "</OGRVRTLayer>" << std::endl;
-            }
-
-            outputStreamFile << "</OGRVRTUnionLayer>" << std::endl;
-            outputStreamFile << "</OGRVRTDataSource>" << std::endl;
-
-            // close file
-            outputStreamFile.close();
-        }
-        else 
-        {
-            std::cerr << "Failed to open VRT file for writing: " << vrtFile.string() << std::endl;
-            return;
-        }
+    GDALDatasetH tileDs = GDALOpenEx(tileOutputFile.c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY, NULL, NULL, NULL);
+    if (!tileDs)
+    {
+        std::cerr << "Failed to open file: " << tileOutputFile << std::endl;
+        return false;
+    }
 
-        // options for translate - empty
-        GDALVectorTranslateOptions *options = GDALVectorTranslateOptionsNew(nullptr, NULL);
+    // the first file creates the output file, features from other files get appended to its layer
+    // (the name of the layer depends on the driver - e.g. shapefiles have it from the file name)
+    const char* appendArgs[] = { "-append", "-nln", outputLayerName.c_str(), NULL };
+    GDALVectorTranslateOptions *options = GDALVectorTranslateOptionsNew(outputDs ? (char**)appendArgs : nullptr, NULL);
+    GDALDatasetH resultDs = GDALVectorTranslate(outputDs ? nullptr : outputFile.c_str(), outputDs, 1, &tileDs, options, nullptr);
+    GDALVectorTranslateOptionsFree(options);
+    GDALClose(tileDs);
 
-        // open VRT file and check it
-        GDALDatasetH vrtDs = GDALOpenEx(vrtFile.string().c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY, NULL, NULL, NULL);
-        if (!vrtDs)
+    if (!resultDs)
+    {
+        std::cerr << "Failed to write output file: " << outputFile << std::endl;
+        return false;
+    }
+    if (!outputDs)
+    {
+        OGRLayerH layer = GDALDatasetGetLayer(resultDs, 0);
+        if (!layer)
         {
-            std::cerr << "Failed to open composite VRT file" << std::endl;
-            fs::remove(vrtFile);
-            return;
+            std::cerr << "Failed to write output file: " << outputFile << std::endl;
+            GDALClose(resultDs);
+            return false;
         }
+        outputLayerName = OGR_L_GetName(layer);
+    }
+    outputDs = resultDs;
 
-        // translate to resulting file and check it
-        GDALDatasetH resultDS = GDALVectorTranslate(outputFile.c_str(), nullptr, 1, (GDALDatasetH *)&vrtDs, options, nullptr);
-        if (!resultDS)
-        {
-            std::cerr << "Failed to create output file" << std::endl;
-            GDALClose(vrtDs);
-            fs::remove(vrtFile);
-            return;
-        }
-        
-        // close datasets
-        GDALClose(vrtDs);
-        GDALClose(resultDS);
+    // delete the temporary file
+    fs::remove(tileOutputFile);
+    return true;
+}
 
-        // delete temporary files 
-        for (const std::string& f : tileOutputFiles)
-        {
-            fs::remove(f);
-        }
+void ToVector::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
+{
+    if (!outputAppender)
+        return;
 
-        // delete vrt file
-        fs::remove(vrtFile);
+    // wait for the outputs of last jobs to be appended
+    bool ok = outputAppender->finish();
+    outputAppender.reset();
 
-        // delete dir if empty
-        if (fs::is_empty(outputSubdir))
-        {
-            fs::remove(outputSubdir);
-        }
+    if (outputDs)
+    {
+        GDALClose(outputDs);
+        outputDs = nullptr;
     }
+
+    if (!ok)
+        std::cerr << "Failed to create output file" << std::endl;
+
+    // delete temporary files that have not been appended and the temporary dir if empty
+    removeFiles(tileOutputFiles, true);
 }
@@ -85,6 +85,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
     Options reader_opts;
     if (!assignCrs.empty())
         reader_opts.add(pdal::Option("override_srs", assignCrs));
+    reader_opts.add(pointRangeReaderOptions(*tile));
 
     Stage& r = makeReader(manager.get(), tile->inputFilenames[0], reader_opts);
 
@@ -104,14 +105,14 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
         else
         {
             // Reader can't do the filtering - do it with a filter
-            last = &manager->makeFilter( "filters.crop", *last, filter_opts);
+            last = &makeFilter(manager.get(), "filters.crop", *last, filter_opts);
         }
     }
     if (!tile->filterExpression.empty())
     {
         Options filter_opts;
         filter_opts.add(pdal::Option("expression", tile->filterExpression));
-        last = &manager->makeFilter( "filters.expression", *last, filter_opts);
+        last = &makeFilter(manager.get(), "filters.expression", *last, filter_opts);
     }
 
     // optional reprojection
@@ -123,11 +124,11 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
         if (!transformCoordOp.empty())
         {
             transform_opts.add(pdal::Option("coord_op", transformCoordOp));
-            reproject = &manager->makeFilter( "filters.projpipeline", *last, transform_opts);
+            reproject = &makeFilter(manager.get(), "filters.projpipeline", *last, transform_opts);
         }
         else
         {
-            reproject = &manager->makeFilter( "filters.reprojection", *last, transform_opts);
+            reproject = &makeFilter(manager.get(), "filters.reprojection", *last, transform_opts);
         }
         last = reproject;
     }
@@ -136,7 +137,7 @@ static std::unique_ptr<PipelineManager> pipeline(ParallelJobInfo *tile, std::str
     {
         Options matrix_opts;
         matrix_opts.add(pdal::Option("matrix", transformMatrix));
-        Stage* matrixTransform = &manager->makeFilter( "filters.transformation", *last, matrix_opts);
+        Stage* matrixTransform = &makeFilter(manager.get(), "filters.transformation", *last, matrix_opts);
         last = matrixTransform;
     }
 
@@ -185,11 +186,40 @@ void Translate::preparePipelines(std::vector<std::unique_ptr<PipelineManager>>&
 
             tileOutputFiles.push_back(tile.outputFilename);
 
+            pipelineCosts.push_back(f.count);
             pipelines.push_back(pipeline(&tile, assignCrs, transformCrs, transformCoordOp, transformMatrix));
         }
     }
     else
     {
+        std::vector<std::pair<point_count_t, point_count_t>> ranges = pointRanges(inputFile, totalPoints, max_threads);
+        if (!ranges.empty())
+        {
+            // single input LAS/LAZ split into ranges of points processed in parallel,
+            // the outputs get merged at the end the same way as with VPC input
+
+            // for /tmp/hello.laz we will use /tmp/hello dir for all results
+            fs::path outputParentDir = fs::path(outputFile).parent_path();
+            fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
+            fs::create_directories(outputSubdir);
+
+            for (size_t i = 0; i < ranges.size(); ++i)
+            {
+                ParallelJobInfo tile(ParallelJobInfo::PointRange, BOX2D(), filterExpression, filterBounds);
+                tile.inputFilenames.push_back(inputFile);
+                tile.pointStart = ranges[i].first;
+                tile.pointCount = ranges[i].second;
+
+                std::string rangeName = fileStem(inputFile).string() + "_" + std::to_string(i);
+                tile.outputFilename = tileOutputFileName(outputFile, outputFormatVpc, outputSubdir, rangeName);
+
+                tileOutputFiles.push_back(tile.outputFilename);
+
+                pipelines.push_back(pipeline(&tile, assignCrs, transformCrs, transformCoordOp, transformMatrix));
+            }
+            return;
+        }
+
         if (ends_with(outputFile, ".copc.laz"))
         {
             isStreaming = false;
@@ -206,5 +236,5 @@ void Translate::finalize(std::vector<std::unique_ptr<PipelineManager>>&)
     if (tileOutputFiles.empty())
         return;
 
-    buildOutput(outputFile, tileOutputFiles);
+    buildOutput(outputFile, tileOutputFiles, max_threads);
 }
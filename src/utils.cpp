@@ -12,19 +12,29 @@
 
 #include "utils.hpp"
 
+#include <cassert>
 #include <filesystem>
 #include <iostream>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <map>
+#include <numeric>
+#include <thread>
 
 #include <pdal/PipelineManager.hpp>
 #include <pdal/Stage.hpp>
 #include <pdal/StageFactory.hpp>
+#include <pdal/pdal_features.hpp>
 #include <pdal/util/ThreadPool.hpp>
 
 #include <gdal_utils.h>
 
 #include "vpc.hpp"
 #include "alg.hpp"
+#include "profile.hpp"
+#include "copc_builder.hpp"
+#include "las_header.hpp"
 
 using namespace pdal;
 
@@ -32,21 +42,149 @@ using namespace pdal;
 static ProgressBar sProgressBar;
 
 
+// Progress of a single job (pipeline) run by runPipelineParallel()
+struct JobProgress
+{
+    enum State { Waiting, Running, Done };
+
+    point_count_t expectedPoints = 0;  // estimated number of points the job will read
+    std::atomic<point_count_t> pointsRead{0};
+    std::atomic<point_count_t> pointsWritten{0};  // points that were not filtered out
+    std::atomic<int> state{Waiting};
+    std::chrono::steady_clock::time_point startTime, endTime;
+
+    // the progress bar counts points read, but each job only adds at most
+    // its expected number of points, and the rest gets added once the job is done
+    // (filters or "bounds" option may make the actual number of points very different)
+    void addToProgressBar(point_count_t newPointsRead)
+    {
+        point_count_t before = (std::min)(pointsRead.load(), expectedPoints);
+        pointsRead += newPointsRead;
+        point_count_t after = state == Done ? expectedPoints : (std::min)(pointsRead.load(), expectedPoints);
+        if (after > before)
+            sProgressBar.add(after - before);
+    }
+};
+
+
 // Table subclass that also takes care of updating progress in streaming pipelines
 class MyTable : public FixedPointTable
 {
 public:
-    MyTable(point_count_t capacity) : FixedPointTable(capacity) {}
+    MyTable(point_count_t capacity, JobProgress *job, PipelineProfile *profile)
+      : FixedPointTable(capacity), m_job(job), m_profile(profile) {}
 
 protected:
     virtual void reset()
     {
-        sProgressBar.add();
+        // called when a chunk of points went through the whole pipeline: the number
+        // of points is what got read, and points filtered out are marked as skipped
+        point_count_t written = 0;
+        for (PointId idx = 0; idx < numPoints(); ++idx)
+        {
+            if (!skip(idx))
+                ++written;
+        }
+        m_job->pointsWritten += written;
+        m_job->addToProgressBar(numPoints());
+        profileChunkDone(m_profile, written);
         FixedPointTable::reset();
     }
+
+private:
+    JobProgress *m_job;
+    PipelineProfile *m_profile;  // null unless profiling
 };
 
 
+// Limits the estimated memory of jobs running at the same time (see runPipelineParallel()).
+// A job waits in acquire() until there is enough memory left in the budget - but if nothing
+// else is running, it is let through even if it alone needs more than the limit.
+class MemoryBudget
+{
+public:
+    MemoryBudget(uint64_t limit) : m_limit(limit) {}
+
+    void acquire(uint64_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this, bytes] { return m_used == 0 || m_used + bytes <= m_limit; });
+        m_used += bytes;
+    }
+
+    void release(uint64_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_used -= bytes;
+        }
+        m_cv.notify_all();
+    }
+
+private:
+    uint64_t m_limit;
+    uint64_t m_used = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+
+OutputConsumer::OutputConsumer(std::function<bool(const std::string &)> process)
+  : m_process(process)
+{
+    m_thread = std::thread(&OutputConsumer::run, this);
+}
+
+OutputConsumer::~OutputConsumer()
+{
+    finish();
+}
+
+void OutputConsumer::add(const std::string &item)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(item);
+    }
+    m_cv.notify_one();
+}
+
+bool OutputConsumer::finish()
+{
+    if (m_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+    return !m_failed;
+}
+
+void OutputConsumer::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return !m_queue.empty() || m_finished; });
+        if (m_queue.empty())
+            break;  // finished and everything has been processed
+
+        std::string item = m_queue.front();
+        m_queue.pop_front();
+        lock.unlock();
+
+        bool ok = m_process(item);
+
+        lock.lock();
+        if (!ok)
+            m_failed = true;
+    }
+}
+
+
 std::string box_to_pdal_bounds(const BOX2D &box)
 {
     std::ostringstream oss;
@@ -77,12 +215,23 @@ QuickInfo getQuickInfo(std::string inputFile)
     // return r.preview().m_pointCount;
 }
 
+std::mutex &stageCreationMutex()
+{
+    static std::mutex sMutex;
+    return sMutex;
+}
+
 MetadataNode getReaderMetadata(std::string inputFile, MetadataNode *pointLayoutMeta)
 {
     // compared to quickinfo / preview, this provides more info...
 
     PipelineManager m;
-    Stage &r = m.makeReader(inputFile, "");
+    Stage *readerStage;
+    {
+        std::lock_guard<std::mutex> lock(stageCreationMutex());
+        readerStage = &m.makeReader(inputFile, "");
+    }
+    Stage &r = *readerStage;
     FixedPointTable table(10000);
     r.prepare(table);
     if (pointLayoutMeta)
@@ -92,11 +241,101 @@ MetadataNode getReaderMetadata(std::string inputFile, MetadataNode *pointLayoutM
     return r.getMetadata();
 }
 
+MetadataNode getReaderHeaderMetadata(std::string inputFile, MetadataNode *pointLayoutMeta)
+{
+    std::string driver = StageFactory::inferReaderDriver(inputFile);
+    if (driver != "readers.las" && driver != "readers.copc")
+        return getReaderMetadata(inputFile, pointLayoutMeta);
+
+    // preview() of LAS/COPC readers only parses the header and VLRs, and the reader's
+    // metadata get populated along the way - there is no point table to allocate and finalize
+    StageFactory factory;
+    Stage *reader;
+    {
+        // called from multiple threads by build_vpc - only the creation of the stage is serialized
+        std::lock_guard<std::mutex> lock(stageCreationMutex());
+        reader = factory.createStage(driver);  // reader is owned by the factory
+    }
+    pdal::Options opts;
+    opts.add("filename", inputFile);
+    reader->setOptions(opts);
+    QuickInfo qi = reader->preview();
+    if (!qi.valid())
+        return getReaderMetadata(inputFile, pointLayoutMeta);
+
+    if (pointLayoutMeta)
+    {
+        // LAS/COPC readers register standard dimensions with their default types,
+        // only extra bytes dimensions need the full reader setup to find out their types
+        PointLayout layout;
+        for (const std::string &dimName : qi.m_dimNames)
+        {
+            Dimension::Id id = Dimension::id(dimName);
+            if (id == Dimension::Id::Unknown)
+                return getReaderMetadata(inputFile, pointLayoutMeta);
+            layout.registerDim(id);
+        }
+        layout.finalize();
+        *pointLayoutMeta = layout.toMetadata();
+    }
+    return reader->getMetadata();
+}
+
 #define CHUNK_SIZE 100000
 
-void runPipelineParallel(point_count_t totalPoints, bool isStreaming, std::vector<std::unique_ptr<PipelineManager>>& pipelines, int max_threads, bool verbose)
+// writes a line of JSON with the current state of a parallel run (or summary at the end) to stderr
+static void writeProgressJson(const std::vector<JobProgress> &jobs, std::chrono::steady_clock::time_point start, bool finished)
 {
-    int num_chunks = totalPoints / CHUNK_SIZE;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    point_count_t pointsRead = 0, pointsWritten = 0, expectedPoints = 0, progressPoints = 0;
+    size_t jobsDone = 0, jobsRunning = 0;
+    std::ostringstream running;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const JobProgress &job = jobs[i];
+        point_count_t read = job.pointsRead, written = job.pointsWritten;
+        pointsRead += read;
+        pointsWritten += written;
+        expectedPoints += job.expectedPoints;
+        if (job.state == JobProgress::Done)
+        {
+            ++jobsDone;
+            progressPoints += job.expectedPoints;
+        }
+        else if (job.state == JobProgress::Running)
+        {
+            running << (jobsRunning++ ? "," : "") << "{\"job\":" << i << ",\"points_read\":" << read
+                    << ",\"points_written\":" << written << ",\"points_expected\":" << job.expectedPoints << "}";
+            progressPoints += (std::min)(read, job.expectedPoints);
+        }
+    }
+
+    double fraction = expectedPoints ? (double)progressPoints / expectedPoints : 0;
+    double eta = fraction > 0 ? elapsed * (1 - fraction) / fraction : -1;
+
+    std::ostringstream line;
+    line << "{\"type\":\"" << (finished ? "summary" : "progress") << "\""
+         << ",\"elapsed\":" << elapsed
+         << ",\"jobs_total\":" << jobs.size()
+         << ",\"jobs_done\":" << jobsDone
+         << ",\"jobs_running\":" << jobsRunning
+         << ",\"points_read\":" << pointsRead
+         << ",\"points_written\":" << pointsWritten
+         << ",\"points_per_second\":" << (elapsed > 0 ? pointsRead / elapsed : 0)
+         << ",\"percent\":" << fraction * 100;
+    if (!finished)
+        line << ",\"eta\":" << eta << ",\"running\":[" << running.str() << "]";
+    line << "}";
+    std::cerr << line.str() << std::endl;
+}
+
+void runPipelineParallel(point_count_t totalPoints, bool isStreaming, std::vector<std::unique_ptr<PipelineManager>>& pipelines, int max_threads, bool verbose,
+                         const std::vector<point_count_t> &pipelineCosts, bool progressJson,
+                         const std::function<void(size_t)> &onJobFinished, uint64_t memoryLimit, uint64_t memoryPerPoint)
+{
+    // the memory limit only matters for non-streaming pipelines that keep all their points in memory
+    const bool useMemoryLimit = !isStreaming && memoryLimit != 0 && memoryPerPoint != 0;
 
     if (verbose)
     {
@@ -106,22 +345,98 @@ void runPipelineParallel(point_count_t totalPoints, bool isStreaming, std::vecto
         std::cout << "max threads " << max_threads << std::endl;
         if (!isStreaming)
             std::cout << "running in non-streaming mode!" << std::endl;
+        if (useMemoryLimit)
+            std::cout << "memory limit " << memoryLimit / (1024 * 1024) << " MB (estimated " << memoryPerPoint << " bytes per point)" << std::endl;
     }
 
     auto start = std::chrono::high_resolution_clock::now();
+    auto startSteady = std::chrono::steady_clock::now();
 
-    sProgressBar.init(isStreaming ? num_chunks : pipelines.size());
+    // expected number of points of each job - from the estimated costs if we have them,
+    // otherwise we assume that points are split evenly between the jobs
+    const bool hasCosts = pipelineCosts.size() == pipelines.size();
+    if (!pipelineCosts.empty() && !hasCosts)
+    {
+        // the caller should pass either no costs or one cost per pipeline - jobs still run fine
+        // without them, only not in the order of their costs
+        std::cerr << "Warning: got " << pipelineCosts.size() << " job costs for " << pipelines.size()
+                  << " jobs - ignoring the costs." << std::endl;
+    }
+    std::vector<JobProgress> jobs(pipelines.size());
+    point_count_t expectedTotal = 0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        jobs[i].expectedPoints = (std::max)((point_count_t)1, hasCosts ? pipelineCosts[i] : totalPoints / jobs.size());
+        expectedTotal += jobs[i].expectedPoints;
+    }
+
+    sProgressBar.init(expectedTotal);
+
+    // the threads pick up jobs from a shared queue as soon as they are free, so when the largest
+    // jobs are queued first, the remaining small jobs fill the gaps at the end (like in tilingPass1)
+    std::vector<size_t> jobOrder(pipelines.size());
+    std::iota(jobOrder.begin(), jobOrder.end(), 0);
+    if (hasCosts)
+    {
+        std::stable_sort(jobOrder.begin(), jobOrder.end(), [&pipelineCosts](size_t a, size_t b)
+            { return pipelineCosts[a] > pipelineCosts[b]; });
+    }
+
+    // busy time of each worker thread, to report their utilization
+    std::mutex mutex;
+    std::condition_variable jobDoneCondition;
+    size_t jobsDone = 0;
+    std::map<std::thread::id, double> threadBusyTime;
+
+    auto jobStarted = [&jobs](size_t i)
+    {
+        jobs[i].startTime = std::chrono::steady_clock::now();
+        jobs[i].state = JobProgress::Running;
+    };
+    auto jobFinished = [&](size_t i)
+    {
+        JobProgress &job = jobs[i];
+        job.endTime = std::chrono::steady_clock::now();
+        job.state = JobProgress::Done;
+        job.addToProgressBar(0);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            threadBusyTime[std::this_thread::get_id()] += std::chrono::duration<double>(job.endTime - job.startTime).count();
+            ++jobsDone;
+            jobDoneCondition.notify_one();
+        }
+
+        if (onJobFinished)
+            onJobFinished(i);
+    };
+
+    MemoryBudget memoryBudget(memoryLimit);
+    if (useMemoryLimit && verbose)
+    {
+        size_t jobsOverLimit = 0;
+        for (const JobProgress &job : jobs)
+        {
+            if (job.expectedPoints * memoryPerPoint > memoryLimit)
+                ++jobsOverLimit;
+        }
+        if (jobsOverLimit)
+            std::cout << jobsOverLimit << " jobs are estimated to need more memory than the limit - they will run alone" << std::endl;
+    }
 
     int nThreads = (std::min)( (int)pipelines.size(), max_threads );
     ThreadPool p(nThreads);
-    for (size_t i = 0; i < pipelines.size(); ++i)
+    for (size_t i : jobOrder)
     {
         PipelineManager* pipeline = pipelines[i].get();
+        PipelineProfile* profile = profileForPipeline(pipeline);
         if (isStreaming)
         {
-            p.add([pipeline]() {
+            p.add([pipeline, profile, &jobs, &jobStarted, &jobFinished, i]() {
 
-                MyTable table(CHUNK_SIZE);
+                jobStarted(i);
+                profileJobStart(profile);
+                MyTable table(CHUNK_SIZE, &jobs[i], profile);
                 try
                 {
                     pipeline->executeStream(table);
@@ -131,11 +446,20 @@ void runPipelineParallel(point_count_t totalPoints, bool isStreaming, std::vecto
                     std::cerr << "Error in wrench execution: " << e.what() << std::endl;
                     std::exit(EXIT_FAILURE);
                 }
+                profileJobEnd(profile, 0);
+                jobFinished(i);
             });
         }
         else
         {
-            p.add([pipeline, &pipelines, i]() {
+            p.add([pipeline, profile, &pipelines, &jobs, &jobStarted, &jobFinished, &memoryBudget, useMemoryLimit, memoryPerPoint, i]() {
+                // the job needs roughly all its points in memory at once, so it only starts
+                // when the estimated memory of jobs already running leaves enough room for it
+                uint64_t jobMemory = useMemoryLimit ? jobs[i].expectedPoints * memoryPerPoint : 0;
+                if (useMemoryLimit)
+                    memoryBudget.acquire(jobMemory);
+                jobStarted(i);
+                profileJobStart(profile);
                 try
                 {
                     pipeline->execute();
@@ -145,30 +469,93 @@ void runPipelineParallel(point_count_t totalPoints, bool isStreaming, std::vecto
                     std::cerr << "Error in wrench execution: " << e.what() << std::endl;
                     std::exit(EXIT_FAILURE);
                 }
+                // in non-streaming mode we only know how many points came out of the pipeline
+                for (const PointViewPtr &view : pipeline->views())
+                    jobs[i].pointsWritten += view->size();
+                profileJobEnd(profile, jobs[i].pointsWritten);
                 pipelines[i].reset();  // to free the point table and views (meshes, rasters)
-                sProgressBar.add();
+                if (useMemoryLimit)
+                    memoryBudget.release(jobMemory);
+                jobFinished(i);
             });
         }
     }
 
-    //std::cout << "starting to wait" << std::endl;
-
-    // while (p.tasksInQueue() + p.tasksInProgress())
-    // {
-    //     //std::cout << "progress: " << p.tasksInQueue() << " " << p.tasksInProgress() << " cnt " << cntPnt/1'000 << std::endl;
-    //     std::this_thread::sleep_for(500ms);
-    // }
+    if (progressJson)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (jobsDone < jobs.size())
+        {
+            jobDoneCondition.wait_for(lock, std::chrono::seconds(1));
+            lock.unlock();
+            writeProgressJson(jobs, startSteady, false);
+            lock.lock();
+        }
+    }
 
     p.join();
 
     sProgressBar.done();
 
+    if (progressJson)
+        writeProgressJson(jobs, startSteady, true);
+
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
     if (verbose)
     {
-        std::cout << "time " << duration.count()/1000. << " s" << std::endl;
+        double seconds = duration.count()/1000.;
+        point_count_t pointsRead = 0, pointsWritten = 0;
+        for (const JobProgress &job : jobs)
+        {
+            pointsRead += job.pointsRead;
+            pointsWritten += job.pointsWritten;
+        }
+        if (isStreaming)
+            std::cout << "points read " << pointsRead << " (" << (seconds > 0 ? pointsRead / seconds / 1'000'000 : 0) << "M/s)" << std::endl;
+        std::cout << "points written " << pointsWritten << std::endl;
+
+        int threadIndex = 0;
+        for (const auto &busy : threadBusyTime)
+            std::cout << "thread " << threadIndex++ << " utilization " << (seconds > 0 ? std::round(busy.second / seconds * 100) : 0) << "%" << std::endl;
+
+        std::cout << "time " << seconds << " s" << std::endl;
+    }
+}
+
+
+bool parseMemorySize(const std::string &str, uint64_t &bytes)
+{
+    size_t pos = 0;
+    double value;
+    try
+    {
+        value = std::stod(str, &pos);
     }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+    if (value <= 0)
+        return false;
+
+    std::string suffix = str.substr(pos);
+    double multiplier = 1;
+    if (suffix.empty())
+        multiplier = 1;
+    else if (suffix == "K" || suffix == "k")
+        multiplier = 1024.;
+    else if (suffix == "M" || suffix == "m")
+        multiplier = 1024. * 1024;
+    else if (suffix == "G" || suffix == "g")
+        multiplier = 1024. * 1024 * 1024;
+    else if (suffix == "T" || suffix == "t")
+        multiplier = 1024. * 1024 * 1024 * 1024;
+    else
+        return false;
+
+    bytes = (uint64_t)(value * multiplier);
+    return true;
 }
 
 
@@ -187,10 +574,22 @@ static GDALDatasetH rasterTilesToVrt(const std::vector<std::string> &inputFiles,
     return ds;
 }
 
-static bool rasterVrtToCog(GDALDatasetH ds, const std::string &outputFile)
+static bool rasterVrtToCog(GDALDatasetH ds, const std::string &outputFile, int numThreads)
 {
-    const char* args[] = { "-of", "COG", "-co", "COMPRESS=DEFLATE", NULL };
-    GDALTranslateOptions* psOptions = GDALTranslateOptionsNew((char**)args, NULL);
+    // blocks of the COG get compressed in parallel
+    std::string numThreadsOpt = "NUM_THREADS=" + std::to_string((std::max)(1, numThreads));
+    std::vector<const char*> args = { "-of", "COG", "-co", "COMPRESS=DEFLATE", "-co", numThreadsOpt.c_str() };
+
+    // if the source already has overviews (e.g. computed incrementally while the raster
+    // was being written), copy them instead of computing them again from full resolution data
+    if (GDALGetOverviewCount(GDALGetRasterBand(ds, 1)) > 0)
+    {
+        args.push_back("-co");
+        args.push_back("OVERVIEWS=FORCE_USE_EXISTING");
+    }
+    args.push_back(nullptr);
+
+    GDALTranslateOptions* psOptions = GDALTranslateOptionsNew((char**)args.data(), NULL);
 
     GDALDatasetH dsFinal = GDALTranslate(outputFile.c_str(), ds, psOptions, nullptr);
     GDALTranslateOptionsFree(psOptions);
@@ -200,8 +599,21 @@ static bool rasterVrtToCog(GDALDatasetH ds, const std::string &outputFile)
     return true;
 }
 
-bool rasterTilesToCog(const std::vector<std::string> &inputFiles, const std::string &outputFile)
+bool rasterToCog(const std::string &inputFile, const std::string &outputFile, int numThreads)
+{
+    GDALDatasetH ds = GDALOpen(inputFile.c_str(), GA_ReadOnly);
+    if (!ds)
+        return false;
+
+    bool ok = rasterVrtToCog(ds, outputFile, numThreads);
+    GDALClose(ds);
+    return ok;
+}
+
+bool rasterTilesToCog(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads)
 {
+    ProfileScope profileScope("rasterTilesToCog");
+
     std::string outputVrt = outputFile;
     assert(ends_with(outputVrt, ".tif"));
     outputVrt.erase(outputVrt.rfind(".tif"), 4);
@@ -212,7 +624,7 @@ bool rasterTilesToCog(const std::vector<std::string> &inputFiles, const std::str
     if (!ds)
         return false;
 
-    rasterVrtToCog(ds, outputFile);
+    rasterVrtToCog(ds, outputFile, numThreads);
     GDALClose(ds);
 
     std::filesystem::remove(outputVrt);
@@ -220,6 +632,63 @@ bool rasterTilesToCog(const std::vector<std::string> &inputFiles, const std::str
     return true;
 }
 
+// minimal number of points per job when splitting a single file into ranges of points
+#define MIN_POINT_RANGE_SIZE 1'000'000
+
+std::vector<std::pair<point_count_t, point_count_t>> pointRanges(const std::string &inputFile, point_count_t totalPoints, int max_threads, point_count_t rangeAlignment)
+{
+    std::vector<std::pair<point_count_t, point_count_t>> ranges;
+
+#ifdef PDAL_LAS_START
+    // only readers.las can start reading at an arbitrary point (COPC is better handled with spatial tiles)
+    if (ends_with(inputFile, ".copc.laz") || !(ends_with(inputFile, ".las") || ends_with(inputFile, ".laz")))
+        return ranges;
+
+    if (max_threads < 2 || rangeAlignment == 0)
+        return ranges;
+
+    point_count_t numRanges = (std::min)((point_count_t)max_threads, totalPoints / MIN_POINT_RANGE_SIZE);
+    if (numRanges < 2)
+        return ranges;
+
+    point_count_t rangeSize = (totalPoints + numRanges - 1) / numRanges;
+    rangeSize = (rangeSize + rangeAlignment - 1) / rangeAlignment * rangeAlignment;
+
+    for (point_count_t start = 0; start < totalPoints; start += rangeSize)
+    {
+        ranges.push_back({ start, (std::min)(rangeSize, totalPoints - start) });
+    }
+#else
+    // readers.las does not support "start" option in this version of PDAL
+    (void)inputFile;
+    (void)totalPoints;
+    (void)max_threads;
+    (void)rangeAlignment;
+#endif
+
+    return ranges;
+}
+
+pdal::Options pointRangeReaderOptions(const ParallelJobInfo &tile)
+{
+    pdal::Options opts;
+    if (tile.mode == ParallelJobInfo::PointRange)
+    {
+        opts.add(pdal::Option("start", tile.pointStart));
+        opts.add(pdal::Option("count", tile.pointCount));
+    }
+    return opts;
+}
+
+int64_t fileModificationTime(const std::string &filename)
+{
+    std::error_code ec;
+    fs::file_time_type t = fs::last_write_time(filename, ec);
+    if (ec)
+        return 0;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
 bool readerSupportsBounds(Stage &reader)
 {
     // these readers support "bounds" option with a 2D/3D bounding box, and based
@@ -301,12 +770,202 @@ pdal::Stage &makeReader(pdal::PipelineManager *manager, const std::string &input
     return reader;
 }
 
+int readerThreadsPerJob(size_t jobCount, int maxThreads)
+{
+    if (jobCount == 0 || maxThreads <= 1)
+        return 1;
+    size_t concurrentJobs = (std::min)(jobCount, (size_t)maxThreads);
+    return (std::max)(1, (int)(maxThreads / concurrentJobs));
+}
+
+std::vector<ParallelJobInfo> spatialTileJobs(const std::string &inputFile, const BOX2D &bounds, point_count_t totalPoints,
+                                             TileAlignment tileAlignment, double collarSize, const std::string &filterExpression,
+                                             const std::string &filterBounds, std::vector<point_count_t> &pipelineCosts)
+{
+    std::vector<ParallelJobInfo> jobs;
+
+    VirtualPointCloud vpc;
+    bool isVpc = isVpcFilename(inputFile);
+    if (isVpc && !vpc.read(inputFile))
+        return jobs;
+
+    if (tileAlignment.originX == -1)
+        tileAlignment.originX = bounds.minx;
+    if (tileAlignment.originY == -1)
+        tileAlignment.originY = bounds.miny;
+
+    Tiling t = tileAlignment.coverBounds(bounds);
+    double boundsArea = (bounds.maxx - bounds.minx) * (bounds.maxy - bounds.miny);
+
+    for (int iy = 0; iy < t.tileCountY; ++iy)
+    {
+        for (int ix = 0; ix < t.tileCountX; ++ix)
+        {
+            BOX2D tileBox = t.boxAt(ix, iy);
+
+            if (!filterBounds.empty() && !intersectionBox2D(tileBox, parseBounds(filterBounds).to2d()).valid())
+                continue;
+
+            ParallelJobInfo tile(ParallelJobInfo::Spatial, tileBox, filterExpression, filterBounds);
+
+            BOX2D boxWithCollar = tileBox;
+            boxWithCollar.grow(collarSize);
+
+            point_count_t cost;
+            if (isVpc)
+            {
+                for (size_t fileIndex : vpc.overlappingBox2D(boxWithCollar))
+                    tile.inputFilenames.push_back(vpc.files[fileIndex].filename);
+                if (tile.inputFilenames.empty())
+                    continue;   // no input files for this tile
+                cost = vpc.estimatedPointCount(boxWithCollar);
+            }
+            else
+            {
+                tile.inputFilenames.push_back(inputFile);
+                BOX2D readBox = intersectionBox2D(boxWithCollar, bounds);
+                double readArea = readBox.valid() ? (readBox.maxx - readBox.minx) * (readBox.maxy - readBox.miny) : 0;
+                cost = boundsArea > 0 ? (point_count_t)(totalPoints * readArea / boundsArea) : totalPoints;
+            }
+
+            // tiles are half-open boxes [min, max) so that points on the edges between tiles do not
+            // get written twice, but edges of the first and the last tiles are left open so that
+            // no points at the data bounds get lost
+            std::ostringstream expr;
+            expr << std::fixed;
+            std::string separator;
+            auto addCondition = [&expr, &separator](const std::string &condition, double value)
+            {
+                expr << separator << condition << value;
+                separator = " && ";
+            };
+            if (ix > 0)
+                addCondition("X >= ", tileBox.minx);
+            if (ix < t.tileCountX - 1)
+                addCondition("X < ", tileBox.maxx);
+            if (iy > 0)
+                addCondition("Y >= ", tileBox.miny);
+            if (iy < t.tileCountY - 1)
+                addCondition("Y < ", tileBox.maxy);
+            tile.tileCoreExpression = expr.str();
+
+            pipelineCosts.push_back(cost);
+            jobs.push_back(tile);
+        }
+    }
+    return jobs;
+}
+
+void CollarTiling::addArgs(pdal::ProgramArgs &programArgs)
+{
+    argTileSize = &programArgs.add("tile-size", "Size of a tile for parallel runs (VPC or COPC input is then processed in tiles)", tileAlignment.tileSize);
+    argTileOriginX = &programArgs.add("tile-origin-x", "X origin of a tile for parallel runs", tileAlignment.originX);
+    argTileOriginY = &programArgs.add("tile-origin-y", "Y origin of a tile for parallel runs", tileAlignment.originY);
+    argCollarSize = &programArgs.add("collar-size", "Size of the collar around tiles - points in the collar are used to process the tile, but not written", collarSize, 20.0);
+}
+
+bool CollarTiling::checkArgs()
+{
+    if (argTileSize->set() && tileAlignment.tileSize <= 0)
+    {
+        std::cerr << "tile-size must be positive" << std::endl;
+        return false;
+    }
+    if (collarSize < 0)
+    {
+        std::cerr << "collar-size must not be negative" << std::endl;
+        return false;
+    }
+    if (!argTileOriginX->set())
+        tileAlignment.originX = -1;
+    if (!argTileOriginY->set())
+        tileAlignment.originY = -1;
+    return true;
+}
+
+bool CollarTiling::isUsed(const std::string &inputFile) const
+{
+    return argTileSize->set() && (isVpcFilename(inputFile) || ends_with(inputFile, ".copc.laz"));
+}
+
+std::vector<ParallelJobInfo> CollarTiling::jobs(Alg &alg, const std::string &outputFile, const std::string &outputFormat,
+                                                std::vector<std::string> &tileOutputFiles) const
+{
+    // for /tmp/hello.vpc we will use /tmp/hello dir for all results
+    fs::path outputParentDir = fs::path(outputFile).parent_path();
+    fs::path outputSubdir = outputParentDir / fs::path(outputFile).stem();
+    fs::create_directories(outputSubdir);
+
+    std::vector<ParallelJobInfo> tiles = spatialTileJobs(alg.inputFile, alg.bounds.to2d(), alg.totalPoints, tileAlignment, collarSize,
+                                                         alg.filterExpression, alg.filterBounds, alg.pipelineCosts);
+    int readerThreads = readerThreadsPerJob(tiles.size(), alg.max_threads);
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+        ParallelJobInfo &tile = tiles[i];
+        tile.readerThreads = readerThreads;
+        tile.outputFilename = tileOutputFileName(outputFile, outputFormat, outputSubdir, "tile_" + std::to_string(i));
+        tileOutputFiles.push_back(tile.outputFilename);
+    }
+    return tiles;
+}
+
+pdal::Stage &makeTileReaders(pdal::PipelineManager *manager, const ParallelJobInfo &tile, double collarSize)
+{
+    BOX2D boxWithCollar = tile.box;
+    boxWithCollar.grow(collarSize);
+
+    std::vector<Stage*> readers;
+    for (const std::string &f : tile.inputFilenames)
+    {
+        Stage &reader = makeReader(manager, f);
+        if (readerSupportsBounds(reader))
+        {
+            // COPC/EPT readers only read the data of the tile with its collar
+            pdal::Options copc_opts;
+            copc_opts.add(pdal::Option("threads", tile.readerThreads));
+            copc_opts.add(pdal::Option("bounds", box_to_pdal_bounds(boxWithCollar)));
+            reader.addOptions(copc_opts);
+        }
+        readers.push_back(&reader);
+    }
+
+    Stage *last = readers[0];
+    if (readers.size() > 1)
+    {
+        last = &manager->makeFilter("filters.merge");
+        for (Stage *reader : readers)
+            last->setInput(*reader);
+    }
+
+    if (!allReadersSupportBounds(readers))
+    {
+        // other readers read whole files - only keep points of the tile with its collar
+        Options filter_opts;
+        filter_opts.add(pdal::Option("bounds", box_to_pdal_bounds(boxWithCollar)));
+        last = &makeFilter(manager, "filters.crop", *last, filter_opts);
+    }
+
+    if (!tile.filterBounds.empty())
+    {
+        Options filter_opts;
+        filter_opts.add(pdal::Option("bounds", tile.filterBounds));
+        last = &makeFilter(manager, "filters.crop", *last, filter_opts);
+    }
+
+    return *last;
+}
+
+pdal::Stage &makeFilter(pdal::PipelineManager *manager, const std::string &type, pdal::Stage &parent, pdal::Options options)
+{
+    return manager->makeFilter(type, profileProbe(manager, parent), options);
+}
+
 pdal::Stage &makeWriter(pdal::PipelineManager *manager, const std::string &outputFile, pdal::Stage *parent, pdal::Options options)
 {   
     pdal::Stage *writerPtr = nullptr;
     if (parent)
     {
-        writerPtr = &manager->makeWriter(outputFile, "", *parent);
+        writerPtr = &manager->makeWriter(outputFile, "", profileProbe(manager, *parent));
     }
     else
     {
@@ -328,8 +987,10 @@ pdal::Stage &makeWriter(pdal::PipelineManager *manager, const std::string &outpu
     return writer;
 }
 
-void buildOutput(std::string outputFile, std::vector<std::string> &tileOutputFiles)
+void buildOutput(std::string outputFile, std::vector<std::string> &tileOutputFiles, int numThreads)
 {
+    ProfileScope profileScope("buildOutput");
+
     std::vector<std::string> args;
     args.push_back("--output=" + outputFile);
     for (std::string f : tileOutputFiles)
@@ -340,10 +1001,26 @@ void buildOutput(std::string outputFile, std::vector<std::string> &tileOutputFil
         // now build a new output VPC
         buildVpc(args);
     }
+    else if (ends_with(outputFile, ".las") && concatenateLasFiles(tileOutputFiles, outputFile, numThreads))
+    {
+        // tiles had the same format, so their points could be just copied to the output file
+        removeFiles(tileOutputFiles, true);
+    }
+    else if (isLazFilename(outputFile) && concatenateLazFiles(tileOutputFiles, outputFile, numThreads))
+    {
+        // tiles were compressed by the parallel jobs, their compressed chunks could be just copied to the output file
+        removeFiles(tileOutputFiles, true);
+    }
+    else if (ends_with(outputFile, ".copc.laz") && buildCopcFromLasFiles(tileOutputFiles, outputFile, numThreads))
+    {
+        // COPC was built from the tiles without loading all points into memory
+        removeFiles(tileOutputFiles, true);
+    }
     else
     {
         // merge all the output files into a single file        
         Merge merge;
+        merge.directOutput = false;  // tiles could not be put together directly already
         // for copc set isStreaming to false
         if (ends_with(outputFile, ".copc.laz"))
         {
@@ -366,11 +1043,12 @@ std::string tileOutputFileName(const std::string &outputFile, const std::string
     // construct full output file name for the tile without extension
     const std::string fullFileNameWithoutExt = (outputSubdir / inputBasename).string();
 
-    // output is not a VPC, it will be merged later into a single file,
-    // use las to avoid zipping the file, it will be removed after merging
+    // output is not a VPC, it will be merged later into a single file - use las to avoid zipping
+    // the file, unless the output is LAZ: then the tiles get compressed in parallel by the jobs
+    // and their compressed chunks are put together at the end
     if (!isVpcFilename(outputFile))
     {
-        return fullFileNameWithoutExt + ".las";
+        return fullFileNameWithoutExt + (isLazFilename(outputFile) ? ".laz" : ".las");
     }
 
     // output is VPC, use specified output format
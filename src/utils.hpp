@@ -13,7 +13,12 @@
 #pragma once
 
 #include <pdal/PipelineManager.hpp>
+#include <pdal/util/ProgramArgs.hpp>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
+#include <thread>
 #include <filesystem>
 
 namespace fs = std::filesystem;
@@ -76,6 +81,7 @@ struct ParallelJobInfo
         Single,      //!< no parallelism
         FileBased,   //!< each input file processed separately
         Spatial,     //!< using tiles - "box" should be used
+        PointRange,  //!< range of points from a single file - "pointStart" and "pointCount" should be used
     } mode;
 
     ParallelJobInfo(ParallelMode m = Single): mode(m) {}
@@ -98,6 +104,18 @@ struct ParallelJobInfo
     // Format is "([xmin, xmax], [ymin, ymax])" or "([xmin, xmax], [ymin, ymax], [zmin, zmax])"
     std::string filterBounds;
 
+    // index of the first point and number of points to read (only used in PointRange mode)
+    point_count_t pointStart = 0;
+    point_count_t pointCount = 0;
+
+    // number of threads that readers of the job may use (e.g. for decompression in readers.copc),
+    // see readerThreadsPerJob()
+    int readerThreads = 1;
+
+    // PDAL expression that selects points of the tile box without its collar, so that each point
+    // is written by exactly one job (only used in Spatial mode by jobs from spatialTileJobs())
+    std::string tileCoreExpression;
+
     // modes of operation:
     // A. multi input without box  (LAS/LAZ)    -- per file strategy
     //    - all input files are processed, no filtering on bounding box
@@ -223,9 +241,72 @@ public:
 
 QuickInfo getQuickInfo(std::string inputFile);
 
+/**
+ * Lock to be held while creating PDAL stages from multiple threads (StageFactory and the plugin
+ * manager are not thread-safe). Only the creation needs it, the stages may run in parallel.
+ */
+std::mutex &stageCreationMutex();
+
 MetadataNode getReaderMetadata(std::string inputFile, MetadataNode *pointLayoutMeta = nullptr);
 
-void runPipelineParallel(point_count_t totalPoints, bool isStreaming, std::vector<std::unique_ptr<PipelineManager>>& pipelines, int max_threads, bool verbose);
+/**
+ * Same as getReaderMetadata(), but for LAS/LAZ/COPC files it only reads the header
+ * without preparing the whole reader, which is much cheaper. Can be called from multiple threads.
+ */
+MetadataNode getReaderHeaderMetadata(std::string inputFile, MetadataNode *pointLayoutMeta = nullptr);
+
+/**
+ * Runs pipelines in a thread pool. If estimated costs of pipelines are given (e.g. number of points),
+ * the pipelines are started from the most expensive ones, so that there are no big jobs left running
+ * at the end while other threads are idle. Costs are also used as the expected number of points
+ * of each job for progress reporting. With progressJson set, progress of the jobs is written every second
+ * as a line of JSON to stderr. If onJobFinished is set, it gets called with index of the pipeline from the worker
+ * thread whenever a job is finished (while other jobs may be still running).
+ * If memoryLimit (in bytes) and memoryPerPoint are set, non-streaming jobs are only started while
+ * the estimated memory of running jobs (expected points times memoryPerPoint) stays within the limit,
+ * so more small jobs than big ones run at the same time.
+ */
+void runPipelineParallel(point_count_t totalPoints, bool isStreaming, std::vector<std::unique_ptr<PipelineManager>>& pipelines, int max_threads, bool verbose,
+                         const std::vector<point_count_t> &pipelineCosts = std::vector<point_count_t>(), bool progressJson = false,
+                         const std::function<void(size_t)> &onJobFinished = nullptr, uint64_t memoryLimit = 0, uint64_t memoryPerPoint = 0);
+
+/**
+ * Parses memory size given by the user - number of bytes with an optional K, M, G or T suffix
+ * (e.g. "512M" or "16G"). Returns false if the string is not valid.
+ */
+bool parseMemorySize(const std::string &str, uint64_t &bytes);
+
+/**
+ * Processes outputs of finished jobs (e.g. appends them to the final output) one by one in a background
+ * thread, so that this can happen while other jobs are still running rather than all at the end.
+ * Items are processed in the order they were added. The processing function returns false on error.
+ */
+class OutputConsumer
+{
+public:
+    OutputConsumer(std::function<bool(const std::string &)> process);
+    ~OutputConsumer();
+
+    OutputConsumer(const OutputConsumer &other) = delete;
+    OutputConsumer& operator=(const OutputConsumer &other) = delete;
+
+    // can be called from any thread
+    void add(const std::string &item);
+
+    // waits until all items are processed - returns false if processing of any of them failed
+    bool finish();
+
+private:
+    void run();
+
+    std::function<bool(const std::string &)> m_process;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::string> m_queue;
+    bool m_finished = false;
+    bool m_failed = false;
+};
 
 std::string box_to_pdal_bounds(const BOX2D &box);
 
@@ -251,6 +332,20 @@ inline bool isVpcFilename(const std::string& filename)
     return ends_with(filename, ".vpc") || ends_with(filename, ".vpz");
 }
 
+/**
+ * Returns true for plain LAZ files (not COPC, which has its own structure).
+ */
+inline bool isLazFilename(const std::string& filename)
+{
+    return ends_with(filename, ".laz") && !ends_with(filename, ".copc.laz");
+}
+
+
+/**
+ * Returns last modification time of a local file (in platform specific units), or zero if it is not available.
+ */
+int64_t fileModificationTime(const std::string &filename);
+
 
 inline std::string join_strings(const std::vector<std::string>& list, char delimiter)
 {
@@ -265,22 +360,108 @@ inline std::string join_strings(const std::vector<std::string>& list, char delim
 }
 
 
-bool rasterTilesToCog(const std::vector<std::string> &inputFiles, const std::string &outputFile);
+/**
+ * Mosaics rasters and writes the result as COG. Blocks of the COG are compressed using numThreads threads.
+ */
+bool rasterTilesToCog(const std::vector<std::string> &inputFiles, const std::string &outputFile, int numThreads = 1);
+
+/**
+ * Converts a raster (e.g. a GeoTIFF) to COG. Blocks of the COG are compressed using numThreads threads.
+ * If the raster has overviews, they are used for the COG.
+ */
+bool rasterToCog(const std::string &inputFile, const std::string &outputFile, int numThreads = 1);
+
+/**
+ * Splits points of a single LAS/LAZ file into consecutive ranges (first point index + number of points)
+ * that can be read independently in parallel, using "start" and "count" options of readers.las.
+ * Sizes of ranges are multiples of rangeAlignment (except for the last range).
+ * Returns an empty list if the input can't be split or if it is too small to be worth splitting.
+ */
+std::vector<std::pair<point_count_t, point_count_t>> pointRanges(const std::string &inputFile, point_count_t totalPoints, int max_threads, point_count_t rangeAlignment = 1);
+
+/**
+ * Returns reader options to only read the range of points of the job (for jobs in PointRange mode).
+ */
+pdal::Options pointRangeReaderOptions(const ParallelJobInfo &tile);
 
 /**
  * Create reader stage with some default options.
  */
 pdal::Stage &makeReader( pdal::PipelineManager *manager, const std::string &inputFile, pdal::Options options = pdal::Options() );
 
+/**
+ * Create filter stage reading from the parent stage (with a probe between them when profiling).
+ */
+pdal::Stage &makeFilter(pdal::PipelineManager *manager, const std::string &type, pdal::Stage &parent, pdal::Options options = pdal::Options() );
+
 /**
  * Create writer stage with some default options.
  */
 pdal::Stage &makeWriter(pdal::PipelineManager *manager, const std::string &outputFile, pdal::Stage *parent, pdal::Options options = pdal::Options() );
 
+/**
+ * Returns how many threads readers of each job should use when there are jobCount jobs
+ * and maxThreads threads in total. With fewer jobs than threads (e.g. when "bounds" option
+ * selects only a few tiles), the threads that would be idle are split between readers,
+ * otherwise each reader uses a single thread as the jobs already keep all threads busy.
+ */
+int readerThreadsPerJob(size_t jobCount, int maxThreads);
+
+/**
+ * Creates jobs that process a VPC or a single COPC file in square tiles, for non-streaming algorithms
+ * that need points around each point too (e.g. ground classification or noise filtering). Each job reads
+ * points of its tile box grown by collarSize (from VPC files overlapping it, or using "bounds" of the COPC
+ * reader) to avoid edge effects, but it should only write points selected by tileCoreExpression.
+ * Estimated number of points read by each job is appended to pipelineCosts.
+ */
+std::vector<ParallelJobInfo> spatialTileJobs(const std::string &inputFile, const BOX2D &bounds, point_count_t totalPoints,
+                                             TileAlignment tileAlignment, double collarSize, const std::string &filterExpression,
+                                             const std::string &filterBounds, std::vector<point_count_t> &pipelineCosts);
+
+struct Alg;
+
+/**
+ * Arguments of algorithms that can process VPC or COPC input in tiles with a collar (see spatialTileJobs()):
+ * tile size, tile origin and collar size. Tiles are only used if the tile size is set.
+ */
+struct CollarTiling
+{
+    TileAlignment tileAlignment;
+    double collarSize = 20;  // size of the collar around tiles
+
+    pdal::Arg* argTileSize = nullptr;
+    pdal::Arg* argTileOriginX = nullptr;
+    pdal::Arg* argTileOriginY = nullptr;
+    pdal::Arg* argCollarSize = nullptr;
+
+    void addArgs(pdal::ProgramArgs &programArgs);
+
+    // evaluates whether values from user are correct, returns false if not
+    bool checkArgs();
+
+    // whether the input gets processed in tiles
+    bool isUsed(const std::string &inputFile) const;
+
+    /**
+     * Creates jobs from spatialTileJobs() for the algorithm's input, with output files of the given format
+     * in a subdirectory named after outputFile. The output files are also appended to tileOutputFiles.
+     */
+    std::vector<ParallelJobInfo> jobs(Alg &alg, const std::string &outputFile, const std::string &outputFormat,
+                                      std::vector<std::string> &tileOutputFiles) const;
+};
+
+/**
+ * Adds readers for a job from spatialTileJobs() that only read points of the tile box with its collar
+ * (and within the job's filter bounds). Returns the last stage to connect other stages to.
+ */
+pdal::Stage &makeTileReaders(pdal::PipelineManager *manager, const ParallelJobInfo &tile, double collarSize);
+
 /**
  * Handle saving output for multiple tiles if the output is VPC or the data need to be merged.
+ * If the output is LAS and the tiles are compatible LAS files, their points are concatenated
+ * directly using numThreads threads, otherwise they get merged with a PDAL pipeline.
  */
-void buildOutput(std::string outputFile, std::vector<std::string> &tileOutputFiles);
+void buildOutput(std::string outputFile, std::vector<std::string> &tileOutputFiles, int numThreads = 1);
 
 /**
  * Generate tile output file name based on outputFile and outputFormat.
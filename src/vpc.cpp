@@ -24,6 +24,7 @@ namespace fs = std::filesystem;
 #include <pdal/Polygon.hpp>
 #include <pdal/Stage.hpp>
 #include <pdal/util/ProgramArgs.hpp>
+#include <pdal/util/ThreadPool.hpp>
 
 #include "nlohmann/json.hpp"
 #include <zip.h>
@@ -40,6 +41,7 @@ using namespace pdal;
 void VirtualPointCloud::clear()
 {
     files.clear();
+    indexLevels.clear();
 }
 
 void VirtualPointCloud::dump()
@@ -57,6 +59,12 @@ bool VirtualPointCloud::read(std::string filename)
 {
     clear();
 
+    if (readCache(filename))
+    {
+        buildSpatialIndex();
+        return true;
+    }
+
     fs::path filenameParent = fs::path(filename).parent_path();
 
     json data;
@@ -234,6 +242,11 @@ bool VirtualPointCloud::read(std::string filename)
                 vpcf.overviewFilenames.push_back(ovFilename);
             }
 
+            if (f["properties"].contains("wrench:file_size"))
+                vpcf.fileSize = f["properties"]["wrench:file_size"].get<uint64_t>();
+            if (f["properties"].contains("wrench:file_mtime"))
+                vpcf.fileModificationTime = f["properties"]["wrench:file_mtime"].get<int64_t>();
+
             files.push_back(vpcf);
         }
     }
@@ -253,6 +266,8 @@ bool VirtualPointCloud::read(std::string filename)
         crsWkt = "_mix_";
     }
 
+    buildSpatialIndex();
+
     return true;
 }
 
@@ -368,6 +383,12 @@ bool VirtualPointCloud::write(std::string filename)
             props["pc:statistics"] = statsArray;
         }
 
+        if (f.fileSize != 0)
+        {
+            props["wrench:file_size"] = f.fileSize;
+            props["wrench:file_mtime"] = f.fileModificationTime;
+        }
+
         nlohmann::json links = json::array();
 
         nlohmann::json dataAsset = {
@@ -514,6 +535,27 @@ std::string dateTimeStringFromYearAndDay(int year, int dayOfYear)
 }
 
 
+// we can't use BOX2D::overlaps() for overview tiles as we don't want to include bboxes that only touch
+static bool overlapsOverviewTile(const BOX2D &tileBox, const BOX3D &fileBox)
+{
+    return tileBox.minx < fileBox.maxx &&
+           tileBox.maxx > fileBox.minx &&
+           tileBox.miny < fileBox.maxy &&
+           tileBox.maxy > fileBox.miny;
+}
+
+// whether the file's boundary was calculated from data (with --boundary) - otherwise
+// it is just the bounding box that gets written to VPC when there is no boundary
+static bool hasBoundaryPolygon(const VirtualPointCloud::File &f)
+{
+    if (f.boundaryWkt.empty())
+        return false;
+    const BOX2D box = f.bbox.to2d();
+    const double boxArea = (box.maxx - box.minx) * (box.maxy - box.miny);
+    const double boundaryArea = pdal::Polygon(f.boundaryWkt).area();
+    return std::abs(boxArea - boundaryArea) > 1e-6 * boxArea;
+}
+
 void buildVpc(std::vector<std::string> args)
 {
     std::string outputFile;
@@ -522,6 +564,8 @@ void buildVpc(std::vector<std::string> args)
     bool boundaries = false;
     bool stats = false;
     bool overview = false;
+    bool cache = false;
+    bool update = false;
     double overviewLength = 0.0;
     int max_threads = -1;
     bool verbose = false;
@@ -538,6 +582,8 @@ void buildVpc(std::vector<std::string> args)
     programArgs.add("overview-length",
         "Split overview into multiple tiles of specified maximum edge length in CRS units (implies --overview)",
         overviewLength);
+    programArgs.add("cache", "Write binary cache of the VPC (.idx file) for faster reading", cache);
+    programArgs.add("update", "Update existing output VPC: only files that are new or have changed get processed", update);
 
     pdal::Arg& argThreads = programArgs.add("threads", "Max number of concurrent threads for parallel runs", max_threads);
     programArgs.add("verbose", "Print extra debugging output", verbose);
@@ -600,60 +646,166 @@ void buildVpc(std::vector<std::string> args)
 
     // TODO: would be nice to support input directories too (recursive)
 
-    VirtualPointCloud vpc;
-
-    for (const std::string &inputFile : inputFiles)
+    // with --update, entries of the existing VPC are reused for files that have not changed
+    // since the VPC was built (same size and modification time) and that have all the requested data
+    VirtualPointCloud oldVpc;
+    std::map<std::string, size_t> oldFileIndex;
+    if (update)
     {
-        std::string inputFileAbsolute = inputFile;
-        if (!pdal::Utils::isRemote(inputFile) && !fs::path(inputFile).is_absolute())
+        std::string oldVpcFilename = isVpcFilename(outputFile) ? outputFile : outputFile + ".vpz";
+        if (fs::exists(oldVpcFilename))
         {
-            // convert to absolute path using the current path
-            inputFileAbsolute = fs::absolute(inputFile).string();
-        }
+            if (!oldVpc.read(oldVpcFilename))
+                return;
 
-        MetadataNode layout;
-        MetadataNode n;
-        try
-        {
-            n = getReaderMetadata(inputFileAbsolute, &layout);
+            for (size_t j = 0; j < oldVpc.files.size(); ++j)
+            {
+                const VirtualPointCloud::File &oldFile = oldVpc.files[j];
+                if (oldFile.fileSize == 0)
+                    continue;  // remote file or written by an older version
+                if (stats && oldFile.stats.empty())
+                    continue;
+                if (boundaries && !hasBoundaryPolygon(oldFile))
+                    continue;
+                oldFileIndex[fs::weakly_canonical(oldFile.filename).string()] = j;
+            }
         }
-        catch (std::exception &e)
+        else if (verbose)
         {
-            std::cerr << e.what() << std::endl;
-            return;
+            std::cout << "No existing VPC to update, building a new one: " << oldVpcFilename << std::endl;
         }
+    }
 
-        point_count_t cnt = n.findChild("count").value<point_count_t>();
-        BOX3D bbox(
-                n.findChild("minx").value<double>(),
-                n.findChild("miny").value<double>(),
-                n.findChild("minz").value<double>(),
-                n.findChild("maxx").value<double>(),
-                n.findChild("maxy").value<double>(),
-                n.findChild("maxz").value<double>()
-        );
+    VirtualPointCloud vpc;
+    vpc.files.resize(inputFiles.size());
 
-        std::string crsWkt = n.findChild("srs").findChild("compoundwkt").value();
+    // index of the file in the old VPC (or -1 if the file needs to be processed)
+    std::vector<int64_t> reusedFrom(inputFiles.size(), -1);
 
-        int dayOfYear = n.findChild("creation_doy").value<int>();
-        int year = n.findChild("creation_year").value<int>();
+    // reading of headers is mostly waiting for I/O (especially with files on network storage),
+    // so it is done in parallel - each job fills in its own entry in the list of files
+    std::vector<std::string> errors(inputFiles.size());
+    ProgressBar progressBar;
+    progressBar.init(inputFiles.size());
 
-        VirtualPointCloud::File f;
-        f.filename = inputFileAbsolute;
-        f.count = cnt;
-        f.bbox = bbox;
-        f.crsWkt = crsWkt;
-        f.datetime = dateTimeStringFromYearAndDay(year, dayOfYear);
+    pdal::ThreadPool pool((std::max)(1, (std::min)(max_threads, (int)inputFiles.size())));
+    for (size_t i = 0; i < inputFiles.size(); ++i)
+    {
+        pool.add([&inputFiles, &vpc, &oldVpc, &oldFileIndex, &reusedFrom, &errors, &progressBar, i]()
+        {
+            const std::string &inputFile = inputFiles[i];
+            std::string inputFileAbsolute = inputFile;
+            if (!pdal::Utils::isRemote(inputFile) && !fs::path(inputFile).is_absolute())
+            {
+                // convert to absolute path using the current path
+                inputFileAbsolute = fs::absolute(inputFile).string();
+            }
 
-        for (auto &dim : layout.children("dimensions"))
+            uint64_t fileSize = 0;
+            int64_t fileMTime = 0;
+            if (!pdal::Utils::isRemote(inputFileAbsolute))
+            {
+                std::error_code ec;
+                fileSize = fs::file_size(inputFileAbsolute, ec);
+                if (ec)
+                    fileSize = 0;
+                fileMTime = fileModificationTime(inputFileAbsolute);
+            }
+
+            if (fileSize != 0 && !oldFileIndex.empty())
+            {
+                auto it = oldFileIndex.find(fs::weakly_canonical(inputFileAbsolute).string());
+                if (it != oldFileIndex.end() &&
+                        oldVpc.files[it->second].fileSize == fileSize &&
+                        oldVpc.files[it->second].fileModificationTime == fileMTime)
+                {
+                    vpc.files[i] = oldVpc.files[it->second];
+                    vpc.files[i].filename = inputFileAbsolute;
+                    vpc.files[i].overviewFilenames.clear();  // overviews get assigned again later
+                    reusedFrom[i] = it->second;
+                    progressBar.add();
+                    return;
+                }
+            }
+
+            MetadataNode layout;
+            MetadataNode n;
+            try
+            {
+                n = getReaderHeaderMetadata(inputFileAbsolute, &layout);
+            }
+            catch (std::exception &e)
+            {
+                errors[i] = e.what();
+                progressBar.add();
+                return;
+            }
+
+            point_count_t cnt = n.findChild("count").value<point_count_t>();
+            BOX3D bbox(
+                    n.findChild("minx").value<double>(),
+                    n.findChild("miny").value<double>(),
+                    n.findChild("minz").value<double>(),
+                    n.findChild("maxx").value<double>(),
+                    n.findChild("maxy").value<double>(),
+                    n.findChild("maxz").value<double>()
+            );
+
+            std::string crsWkt = n.findChild("srs").findChild("compoundwkt").value();
+
+            int dayOfYear = n.findChild("creation_doy").value<int>();
+            int year = n.findChild("creation_year").value<int>();
+
+            VirtualPointCloud::File &f = vpc.files[i];
+            f.filename = inputFileAbsolute;
+            f.count = cnt;
+            f.bbox = bbox;
+            f.crsWkt = crsWkt;
+            f.datetime = dateTimeStringFromYearAndDay(year, dayOfYear);
+            f.fileSize = fileSize;
+            f.fileModificationTime = fileMTime;
+
+            for (auto &dim : layout.children("dimensions"))
+            {
+                f.schema.push_back(VirtualPointCloud::SchemaItem(
+                      dim.findChild("name").value(),
+                      dim.findChild("type").value(),
+                      dim.findChild("size").value<int>()));
+            }
+
+            progressBar.add();
+        });
+    }
+    pool.join();
+    progressBar.done();
+
+    for (const std::string &error : errors)
+    {
+        if (!error.empty())
         {
-            f.schema.push_back(VirtualPointCloud::SchemaItem(
-                  dim.findChild("name").value(),
-                  dim.findChild("type").value(),
-                  dim.findChild("size").value<int>()));
+            std::cerr << error << std::endl;
+            return;
         }
+    }
 
-        vpc.files.push_back(f);
+    vpc.buildSpatialIndex();
+
+    // data of reused entries that were not requested this time are dropped,
+    // to get the same output as when building the VPC from scratch
+    for (size_t i = 0; i < vpc.files.size(); ++i)
+    {
+        if (reusedFrom[i] == -1)
+            continue;
+        if (!boundaries)
+            vpc.files[i].boundaryWkt.clear();
+        if (!stats)
+            vpc.files[i].stats.clear();
+    }
+
+    if (update && verbose)
+    {
+        size_t numReused = std::count_if(reusedFrom.begin(), reusedFrom.end(), [](int64_t j) { return j != -1; });
+        std::cout << "reusing " << numReused << " of " << vpc.files.size() << " files from the existing VPC" << std::endl;
     }
 
     //
@@ -690,6 +842,7 @@ void buildVpc(std::vector<std::string> args)
         BOX2D bbox;
         std::string copcFilename;
         std::vector<std::string> tempFiles;
+        bool reused = false;  // existing overview file is up to date (with --update)
     };
     std::vector<OverviewTile> overviewTiles;
 
@@ -726,6 +879,55 @@ void buildVpc(std::vector<std::string> args)
                 }
             }
         }
+
+        if (update && !oldVpc.files.empty() && oldVpc.box3d().to2d() == totalBox)
+        {
+            // areas where files were added, removed or changed
+            std::vector<BOX2D> changedBoxes;
+            std::vector<bool> oldFileReused(oldVpc.files.size(), false);
+            for (size_t i = 0; i < vpc.files.size(); ++i)
+            {
+                if (reusedFrom[i] == -1)
+                    changedBoxes.push_back(vpc.files[i].bbox.to2d());
+                else
+                    oldFileReused[reusedFrom[i]] = true;
+            }
+            for (size_t j = 0; j < oldVpc.files.size(); ++j)
+            {
+                if (!oldFileReused[j])
+                    changedBoxes.push_back(oldVpc.files[j].bbox.to2d());
+            }
+
+            for (OverviewTile &tile : overviewTiles)
+            {
+                if (!fs::exists(tile.copcFilename))
+                    continue;
+
+                bool changed = false;
+                for (const BOX2D &box : changedBoxes)
+                    changed = changed || tile.bbox.overlaps(box);
+                if (changed)
+                    continue;
+
+                // the existing overview file must have been built from the same files
+                const std::string copcCanonical = fs::weakly_canonical(tile.copcFilename).string();
+                std::set<int64_t> oldTileFiles, newTileFiles;
+                for (size_t j = 0; j < oldVpc.files.size(); ++j)
+                {
+                    for (const std::string &ovFilename : oldVpc.files[j].overviewFilenames)
+                    {
+                        if (fs::weakly_canonical(ovFilename).string() == copcCanonical)
+                            oldTileFiles.insert(j);
+                    }
+                }
+                for (size_t i = 0; i < vpc.files.size(); ++i)
+                {
+                    if (overlapsOverviewTile(tile.bbox, vpc.files[i].bbox))
+                        newTileFiles.insert(reusedFrom[i]);
+                }
+                tile.reused = !oldTileFiles.empty() && oldTileFiles == newTileFiles;
+            }
+        }
     }
 
     if (boundaries || stats || overview)
@@ -733,15 +935,22 @@ void buildVpc(std::vector<std::string> args)
         std::map<std::string, Stage*> hexbinFilters, statsFilters;
         std::vector<std::unique_ptr<PipelineManager>> pipelines;
 
+        point_count_t pipelinesTotalPoints = 0;
         int overviewCounter = 0;
-        for (VirtualPointCloud::File &f : vpc.files)
+        for (size_t i = 0; i < vpc.files.size(); ++i)
         {
+            VirtualPointCloud::File &f = vpc.files[i];
+
+            // boundaries and stats of reused files are already known
+            const bool needsMetadata = (boundaries || stats) && reusedFrom[i] == -1;
+            const size_t numPipelinesBefore = pipelines.size();
+
             if (overview && multiOverview)
             {
                 // For multi-tile overview: one pipeline per (source file, tile) combination
                 for (OverviewTile &tile : overviewTiles)
                 {
-                    if (!tile.bbox.overlaps(f.bbox.to2d()))
+                    if (tile.reused || !tile.bbox.overlaps(f.bbox.to2d()))
                         continue;
 
                     std::unique_ptr<PipelineManager> manager( new PipelineManager );
@@ -762,7 +971,7 @@ void buildVpc(std::vector<std::string> args)
                 }
 
                 // Boundaries/stats for multi-overview still need a separate pipeline per file
-                if (boundaries || stats)
+                if (needsMetadata)
                 {
                     std::unique_ptr<PipelineManager> manager( new PipelineManager );
                     Stage* last = &makeReader(manager.get(), f.filename);
@@ -781,12 +990,12 @@ void buildVpc(std::vector<std::string> args)
                     pipelines.push_back(std::move(manager));
                 }
             }
-            else
+            else if (needsMetadata || (overview && !overviewTiles[0].reused))
             {
                 std::unique_ptr<PipelineManager> manager( new PipelineManager );
 
                 Stage* last = &makeReader(manager.get(), f.filename);
-                if (boundaries)
+                if (boundaries && needsMetadata)
                 {
                     pdal::Options hexbin_opts;
                     // TODO: any options?
@@ -794,7 +1003,7 @@ void buildVpc(std::vector<std::string> args)
                     hexbinFilters[f.filename] = last;
                 }
 
-                if (stats)
+                if (stats && needsMetadata)
                 {
                     pdal::Options stats_opts;
                     // TODO: any options?
@@ -802,7 +1011,7 @@ void buildVpc(std::vector<std::string> args)
                     statsFilters[f.filename] = last;
                 }
 
-                if (overview)
+                if (overview && !overviewTiles[0].reused)
                 {
                     // TODO: configurable method and step size?
                     pdal::Options decim_opts;
@@ -817,9 +1026,13 @@ void buildVpc(std::vector<std::string> args)
 
                 pipelines.push_back(std::move(manager));
             }
+
+            if (pipelines.size() > numPipelinesBefore)
+                pipelinesTotalPoints += f.count;
         }
 
-        runPipelineParallel(vpc.totalPoints(), true, pipelines, max_threads, verbose);
+        if (!pipelines.empty())
+            runPipelineParallel(pipelinesTotalPoints, true, pipelines, max_threads, verbose);
 
         if (overview)
         {
@@ -856,11 +1069,12 @@ void buildVpc(std::vector<std::string> args)
                 pipelinesCopcOverview.push_back(std::move(manager));
             }
 
-            if (verbose)
+            if (verbose && !pipelinesCopcOverview.empty())
             {
                 std::cout << "Indexing overview point cloud(s)..." << std::endl;
             }
-            runPipelineParallel(vpc.totalPoints()/1000, false, pipelinesCopcOverview, max_threads, verbose);
+            if (!pipelinesCopcOverview.empty())
+                runPipelineParallel(pipelinesTotalPoints/1000, false, pipelinesCopcOverview, max_threads, verbose);
 
             // delete tmp overviews
             for (const OverviewTile &tile : overviewTiles)
@@ -870,15 +1084,16 @@ void buildVpc(std::vector<std::string> args)
             }
         }
 
-        for (VirtualPointCloud::File &f : vpc.files)
+        for (size_t i = 0; i < vpc.files.size(); ++i)
         {
-            if (boundaries)
+            VirtualPointCloud::File &f = vpc.files[i];
+            if (boundaries && reusedFrom[i] == -1)
             {
                 pdal::Stage *hexbinFilter = hexbinFilters[f.filename];
                 std::string b = hexbinFilter->getMetadata().findChild("boundary").value();
                 f.boundaryWkt = b;
             }
-            if (stats)
+            if (stats && reusedFrom[i] == -1)
             {
                 pdal::Stage *statsFilter = statsFilters[f.filename];
                 MetadataNode m = statsFilter->getMetadata();
@@ -901,13 +1116,9 @@ void buildVpc(std::vector<std::string> args)
             {
                 for (const OverviewTile &tile : overviewTiles)
                 {
-                    if (tile.tempFiles.empty())
+                    if (tile.tempFiles.empty() && !tile.reused)
                         continue; // empty tile (no source files)
-                    // we can't use overlaps() here as we don't want to include bboxes that only touch
-                    if (tile.bbox.minx < f.bbox.maxx &&
-                            tile.bbox.maxx > f.bbox.minx &&
-                            tile.bbox.miny < f.bbox.maxy &&
-                            tile.bbox.maxy > f.bbox.miny)
+                    if (overlapsOverviewTile(tile.bbox, f.bbox))
                         f.overviewFilenames.push_back(tile.copcFilename);
                 }
             }
@@ -916,6 +1127,15 @@ void buildVpc(std::vector<std::string> args)
 
     vpc.write(outputFile);
 
+    if (cache)
+    {
+        // read the VPC back to have the file paths resolved the same way as when reading it later
+        std::string vpcFilename = isVpcFilename(outputFile) ? outputFile : outputFile + ".vpz";
+        VirtualPointCloud vpcWritten;
+        if (vpcWritten.read(vpcFilename))
+            vpcWritten.writeCache(vpcFilename);
+    }
+
     // TODO: for now hoping that all files have the same file type + CRS + point format + scaling
     // "dataformat_id"
     // "spatialreference"
@@ -954,13 +1174,119 @@ inline bool overlaps2(const BOX2D &a, const BOX2D &b)
             a.miny <= b.maxy && a.maxy > b.miny;
 }
 
-std::vector<VirtualPointCloud::File> VirtualPointCloud::overlappingBox2D(const BOX2D &box)
+// maximum number of children of a node in the spatial index
+#define INDEX_NODE_SIZE 16
+
+// sort-tile-recursive ordering: nodes are sorted by X into vertical slices
+// and then each slice is sorted by Y, so that consecutive nodes are close
+static void sortTileRecursive(std::vector<VirtualPointCloud::IndexNode> &nodes)
 {
-    std::vector<VirtualPointCloud::File> overlaps;
-    for (const File &f : files)
+    typedef VirtualPointCloud::IndexNode Node;
+
+    size_t numParents = (nodes.size() + INDEX_NODE_SIZE - 1) / INDEX_NODE_SIZE;
+    size_t numSlices = (size_t)std::ceil(std::sqrt((double)numParents));
+    size_t sliceSize = numSlices * INDEX_NODE_SIZE;
+
+    std::sort(nodes.begin(), nodes.end(), [](const Node &a, const Node &b)
+        { return a.box.minx + a.box.maxx < b.box.minx + b.box.maxx; });
+
+    for (size_t i = 0; i < nodes.size(); i += sliceSize)
     {
-        if (overlaps2(box, f.bbox.to2d()))
-            overlaps.push_back(f);
+        auto sliceEnd = nodes.begin() + (std::min)(i + sliceSize, nodes.size());
+        std::sort(nodes.begin() + i, sliceEnd, [](const Node &a, const Node &b)
+            { return a.box.miny + a.box.maxy < b.box.miny + b.box.maxy; });
     }
+}
+
+void VirtualPointCloud::buildSpatialIndex()
+{
+    indexLevels.clear();
+
+    std::vector<IndexNode> level;
+    level.reserve(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+        level.push_back(IndexNode{ files[i].bbox.to2d(), i, 0 });
+
+    while (true)
+    {
+        sortTileRecursive(level);
+        indexLevels.push_back(level);
+
+        if (level.size() <= INDEX_NODE_SIZE)
+            break;
+
+        // group consecutive nodes into parent nodes
+        std::vector<IndexNode> parentLevel;
+        for (size_t i = 0; i < level.size(); i += INDEX_NODE_SIZE)
+        {
+            IndexNode parent{ level[i].box, i, (std::min)((size_t)INDEX_NODE_SIZE, level.size() - i) };
+            for (size_t j = i + 1; j < i + parent.count; ++j)
+                parent.box.grow(level[j].box);
+            parentLevel.push_back(parent);
+        }
+        level = std::move(parentLevel);
+    }
+}
+
+std::vector<size_t> VirtualPointCloud::overlappingBox2D(const BOX2D &box) const
+{
+    std::vector<size_t> overlaps;
+
+    if (indexLevels.empty() || indexLevels[0].size() != files.size())
+    {
+        // spatial index is not available
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            if (overlaps2(box, files[i].bbox.to2d()))
+                overlaps.push_back(i);
+        }
+        return overlaps;
+    }
+
+    // nodes to visit as (level, index) pairs, starting with the root level
+    std::vector<std::pair<size_t, size_t>> nodesToVisit;
+    const size_t rootLevel = indexLevels.size() - 1;
+    for (size_t i = 0; i < indexLevels[rootLevel].size(); ++i)
+        nodesToVisit.push_back({ rootLevel, i });
+
+    while (!nodesToVisit.empty())
+    {
+        auto [levelIndex, nodeIndex] = nodesToVisit.back();
+        nodesToVisit.pop_back();
+
+        // a parent box contains boxes of all its children, so if it does not
+        // overlap, none of the children can overlap either
+        const IndexNode &node = indexLevels[levelIndex][nodeIndex];
+        if (!overlaps2(box, node.box))
+            continue;
+
+        if (levelIndex == 0)
+            overlaps.push_back(node.first);
+        else
+        {
+            for (size_t i = node.first; i < node.first + node.count; ++i)
+                nodesToVisit.push_back({ levelIndex - 1, i });
+        }
+    }
+
+    // keep the same order as in the list of files
+    std::sort(overlaps.begin(), overlaps.end());
     return overlaps;
 }
+
+point_count_t VirtualPointCloud::estimatedPointCount(const BOX2D &box) const
+{
+    double count = 0;
+    for (size_t fileIndex : overlappingBox2D(box))
+    {
+        const File &f = files[fileIndex];
+        const BOX2D fileBox = f.bbox.to2d();
+        const BOX2D isect = intersectionBox2D(box, fileBox);
+        const double fileArea = (fileBox.maxx - fileBox.minx) * (fileBox.maxy - fileBox.miny);
+        if (fileArea > 0 && isect.valid())
+            count += f.count * ((isect.maxx - isect.minx) * (isect.maxy - isect.miny) / fileArea);
+        else
+            count += f.count;
+    }
+    return (point_count_t)count;
+}
@@ -67,19 +67,50 @@ struct VirtualPointCloud
         // support for overview point clouds - a file may refer to one or more overview files
         // (when building VPC with overviews, multiple overview tiles may be created)
         std::vector<std::string> overviewFilenames;
+
+        // size and modification time of the file when it was added (only for local files, otherwise zero)
+        // so that "build_vpc --update" can detect files that have changed
+        uint64_t fileSize = 0;
+        int64_t fileModificationTime = 0;
+    };
+
+    //! Node of the spatial index: on the lowest level it refers to a single file,
+    //! on higher levels it covers a range of consecutive nodes of the level below
+    struct IndexNode
+    {
+        BOX2D box;
+        size_t first;  // index of the file (lowest level) or of the first child node
+        size_t count;  // number of child nodes (zero on the lowest level)
     };
 
     std::vector<File> files;
     std::string crsWkt;  // valid WKT for CRS of all files (or empty string if undefined, or "_mix_" if a mixture of CRS was seen)
 
+    // packed R-tree of files' 2D bounding boxes (the last level is the root level)
+    std::vector<std::vector<IndexNode>> indexLevels;
+
     void clear();
     void dump();
     bool read(std::string filename);
     bool write(std::string filename);
 
+    //! writes binary cache of the VPC next to it (filename + ".idx") that gets used by read()
+    //! as long as the VPC file does not change
+    bool writeCache(const std::string &filename) const;
+    //! reads the binary cache of the VPC - returns false if it does not exist or it is not valid
+    bool readCache(const std::string &filename);
+
     point_count_t totalPoints() const;
     BOX3D box3d() const;
 
-    //! returns files that have bounding box overlapping the given bounding box
-    std::vector<File> overlappingBox2D(const BOX2D &box);
+    //! builds spatial index of files - needs to be called whenever "files" get modified
+    //! (read() takes care of that)
+    void buildSpatialIndex();
+
+    //! returns indices of files that have bounding box overlapping the given bounding box
+    std::vector<size_t> overlappingBox2D(const BOX2D &box) const;
+
+    //! Returns estimated number of points within the given box, assuming that points
+    //! are evenly distributed within bounding boxes of files
+    point_count_t estimatedPointCount(const BOX2D &box) const;
 };
@@ -0,0 +1,361 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <set>
+namespace fs = std::filesystem;
+
+#include "vpc.hpp"
+#include "utils.hpp"
+
+// Binary cache of a parsed VPC file, stored next to the VPC as <name>.vpc.idx (or <name>.vpz.idx).
+//
+// The cache is only used if the path, size and modification time of the VPC file match
+// the values stored in the cache header. The layout is flat, so that it could be also
+// memory mapped - all records have fixed size and strings are referenced by offsets:
+//
+//   CacheHeader
+//   CacheFile[numFiles]
+//   CacheSchemaItem[numSchemaItems]
+//   CacheStatsItem[numStatsItems]
+//   CacheString[numOverviews]      (overview file names)
+//   char[stringsSize]              (all strings, CRS definitions are stored just once)
+//
+// All fields are 8 bytes long so there is no padding in the records.
+
+static const char CACHE_MAGIC[8] = { 'W', 'R', 'V', 'P', 'C', 'I', 'D', 'X' };
+static const uint64_t CACHE_VERSION = 2;
+static const uint64_t CACHE_BYTE_ORDER_MARK = 0x0102030405060708;
+
+struct CacheString
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct CacheHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t byteOrderMark;
+    uint64_t vpcFileSize;
+    int64_t vpcModificationTime;
+    CacheString vpcFilename;
+    CacheString crsWkt;
+    uint64_t numCrs;
+    uint64_t numFiles;
+    uint64_t numSchemaItems;
+    uint64_t numStatsItems;
+    uint64_t numOverviews;
+    uint64_t stringsSize;
+};
+
+struct CacheFile
+{
+    CacheString filename;
+    CacheString boundaryWkt;
+    CacheString crsWkt;
+    CacheString datetime;
+    uint64_t count;
+    double bbox[6];
+    uint64_t firstSchemaItem, numSchemaItems;
+    uint64_t firstStatsItem, numStatsItems;
+    uint64_t firstOverview, numOverviews;
+    uint64_t fileSize;
+    int64_t fileModificationTime;
+};
+
+struct CacheSchemaItem
+{
+    CacheString name;
+    CacheString type;
+    int64_t size;
+};
+
+struct CacheStatsItem
+{
+    CacheString name;
+    uint64_t position;
+    double average;
+    uint64_t count;
+    double maximum;
+    double minimum;
+    double stddev;
+    double variance;
+};
+
+
+static std::string cacheFilename(const std::string &filename)
+{
+    return filename + ".idx";
+}
+
+// returns absolute path with symlinks resolved (or empty string if the file does not exist)
+static std::string canonicalFilename(const std::string &filename)
+{
+    std::error_code ec;
+    fs::path p = fs::canonical(filename, ec);
+    return ec ? std::string() : p.string();
+}
+
+
+// collects strings for the cache, storing each distinct string just once
+struct CacheStringTable
+{
+    std::string data;
+    std::map<std::string, CacheString> refs;
+
+    CacheString add(const std::string &str)
+    {
+        auto it = refs.find(str);
+        if (it != refs.end())
+            return it->second;
+
+        CacheString ref{ data.size(), str.size() };
+        data += str;
+        refs[str] = ref;
+        return ref;
+    }
+};
+
+
+template<typename T>
+static void writeRecords(std::ofstream &out, const std::vector<T> &records)
+{
+    if (!records.empty())
+        out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+}
+
+template<typename T>
+static bool readRecords(const std::vector<char> &buffer, size_t &pos, uint64_t count, std::vector<T> &records)
+{
+    if (count > (buffer.size() - pos) / sizeof(T))
+        return false;
+    records.resize(count);
+    if (count)
+        std::memcpy(records.data(), buffer.data() + pos, count * sizeof(T));
+    pos += count * sizeof(T);
+    return true;
+}
+
+
+bool VirtualPointCloud::writeCache(const std::string &filename) const
+{
+    std::string vpcFilename = canonicalFilename(filename);
+    if (vpcFilename.empty())
+        return false;
+
+    std::error_code ec;
+    uint64_t vpcFileSize = fs::file_size(filename, ec);
+    if (ec)
+        return false;
+
+    CacheStringTable strings;
+
+    std::vector<CacheFile> cacheFiles;
+    std::vector<CacheSchemaItem> cacheSchema;
+    std::vector<CacheStatsItem> cacheStats;
+    std::vector<CacheString> cacheOverviews;
+    cacheFiles.reserve(files.size());
+
+    std::set<std::string> crsSet;
+    for (const File &f : files)
+    {
+        crsSet.insert(f.crsWkt);
+
+        CacheFile cf;
+        cf.filename = strings.add(f.filename);
+        cf.boundaryWkt = strings.add(f.boundaryWkt);
+        cf.crsWkt = strings.add(f.crsWkt);
+        cf.datetime = strings.add(f.datetime);
+        cf.count = f.count;
+        cf.bbox[0] = f.bbox.minx;
+        cf.bbox[1] = f.bbox.miny;
+        cf.bbox[2] = f.bbox.minz;
+        cf.bbox[3] = f.bbox.maxx;
+        cf.bbox[4] = f.bbox.maxy;
+        cf.bbox[5] = f.bbox.maxz;
+
+        cf.firstSchemaItem = cacheSchema.size();
+        cf.numSchemaItems = f.schema.size();
+        for (const SchemaItem &si : f.schema)
+            cacheSchema.push_back(CacheSchemaItem{ strings.add(si.name), strings.add(si.type), si.size });
+
+        cf.firstStatsItem = cacheStats.size();
+        cf.numStatsItems = f.stats.size();
+        for (const StatsItem &st : f.stats)
+        {
+            cacheStats.push_back(CacheStatsItem{ strings.add(st.name), st.position, st.average, st.count,
+                                                 st.maximum, st.minimum, st.stddev, st.variance });
+        }
+
+        cf.firstOverview = cacheOverviews.size();
+        cf.numOverviews = f.overviewFilenames.size();
+        for (const std::string &ov : f.overviewFilenames)
+            cacheOverviews.push_back(strings.add(ov));
+
+        cf.fileSize = f.fileSize;
+        cf.fileModificationTime = f.fileModificationTime;
+
+        cacheFiles.push_back(cf);
+    }
+
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.byteOrderMark = CACHE_BYTE_ORDER_MARK;
+    header.vpcFileSize = vpcFileSize;
+    header.vpcModificationTime = fileModificationTime(filename);
+    header.vpcFilename = strings.add(vpcFilename);
+    header.crsWkt = strings.add(crsWkt);
+    header.numCrs = crsSet.size();
+    header.numFiles = cacheFiles.size();
+    header.numSchemaItems = cacheSchema.size();
+    header.numStatsItems = cacheStats.size();
+    header.numOverviews = cacheOverviews.size();
+    header.stringsSize = strings.data.size();
+
+    std::ofstream out(cacheFilename(filename), std::ios::binary | std::ios::trunc);
+    if (!out.good())
+    {
+        std::cerr << "Failed to create VPC cache file: " << cacheFilename(filename) << std::endl;
+        return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeRecords(out, cacheFiles);
+    writeRecords(out, cacheSchema);
+    writeRecords(out, cacheStats);
+    writeRecords(out, cacheOverviews);
+    out.write(strings.data.data(), strings.data.size());
+
+    return out.good();
+}
+
+
+bool VirtualPointCloud::readCache(const std::string &filename)
+{
+    const std::string cacheFile = cacheFilename(filename);
+
+    std::error_code ec;
+    if (!fs::exists(cacheFile, ec))
+        return false;
+
+    uint64_t cacheFileSize = fs::file_size(cacheFile, ec);
+    if (ec || cacheFileSize < sizeof(CacheHeader))
+        return false;
+
+    std::vector<char> buffer(cacheFileSize);
+    {
+        std::ifstream in(cacheFile, std::ios::binary);
+        if (!in.read(buffer.data(), buffer.size()))
+            return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    size_t pos = sizeof(header);
+
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+            header.version != CACHE_VERSION ||
+            header.byteOrderMark != CACHE_BYTE_ORDER_MARK)
+        return false;
+
+    // the cache is only valid if the VPC file did not change since the cache was written
+    uint64_t vpcFileSize = fs::file_size(filename, ec);
+    if (ec || vpcFileSize != header.vpcFileSize ||
+            fileModificationTime(filename) != header.vpcModificationTime)
+        return false;
+
+    std::vector<CacheFile> cacheFiles;
+    std::vector<CacheSchemaItem> cacheSchema;
+    std::vector<CacheStatsItem> cacheStats;
+    std::vector<CacheString> cacheOverviews;
+    if (!readRecords(buffer, pos, header.numFiles, cacheFiles) ||
+            !readRecords(buffer, pos, header.numSchemaItems, cacheSchema) ||
+            !readRecords(buffer, pos, header.numStatsItems, cacheStats) ||
+            !readRecords(buffer, pos, header.numOverviews, cacheOverviews) ||
+            buffer.size() - pos != header.stringsSize)
+        return false;
+
+    const char *stringsData = buffer.data() + pos;
+    bool stringsValid = true;
+    auto str = [&](const CacheString &ref) -> std::string
+    {
+        if (ref.offset > header.stringsSize || ref.size > header.stringsSize - ref.offset)
+        {
+            stringsValid = false;
+            return std::string();
+        }
+        return std::string(stringsData + ref.offset, ref.size);
+    };
+
+    // relative paths in the VPC are resolved against its location, so the cache
+    // can't be used if the VPC was moved elsewhere (e.g. together with the cache)
+    if (str(header.vpcFilename) != canonicalFilename(filename))
+        return false;
+
+    std::vector<File> cachedFiles;
+    cachedFiles.reserve(cacheFiles.size());
+    for (const CacheFile &cf : cacheFiles)
+    {
+        if (cf.firstSchemaItem + cf.numSchemaItems > cacheSchema.size() ||
+                cf.firstStatsItem + cf.numStatsItems > cacheStats.size() ||
+                cf.firstOverview + cf.numOverviews > cacheOverviews.size())
+            return false;
+
+        File f;
+        f.filename = str(cf.filename);
+        f.count = cf.count;
+        f.boundaryWkt = str(cf.boundaryWkt);
+        f.bbox = BOX3D(cf.bbox[0], cf.bbox[1], cf.bbox[2], cf.bbox[3], cf.bbox[4], cf.bbox[5]);
+        f.crsWkt = str(cf.crsWkt);
+        f.datetime = str(cf.datetime);
+
+        for (uint64_t i = cf.firstSchemaItem; i < cf.firstSchemaItem + cf.numSchemaItems; ++i)
+        {
+            const CacheSchemaItem &si = cacheSchema[i];
+            f.schema.push_back(SchemaItem(str(si.name), str(si.type), (int)si.size));
+        }
+
+        for (uint64_t i = cf.firstStatsItem; i < cf.firstStatsItem + cf.numStatsItems; ++i)
+        {
+            const CacheStatsItem &st = cacheStats[i];
+            f.stats.push_back(StatsItem(str(st.name), (uint32_t)st.position, st.average, st.count,
+                                        st.maximum, st.minimum, st.stddev, st.variance));
+        }
+
+        for (uint64_t i = cf.firstOverview; i < cf.firstOverview + cf.numOverviews; ++i)
+            f.overviewFilenames.push_back(str(cacheOverviews[i]));
+
+        f.fileSize = cf.fileSize;
+        f.fileModificationTime = cf.fileModificationTime;
+
+        cachedFiles.push_back(std::move(f));
+    }
+
+    std::string cachedCrsWkt = str(header.crsWkt);
+    if (!stringsValid)
+        return false;
+
+    files = std::move(cachedFiles);
+    crsWkt = cachedCrsWkt;
+
+    if (header.numCrs != 1)
+        std::cerr << "found a mixture of multiple CRS in input files (" << header.numCrs << ")" << std::endl;
+
+    return true;
+}
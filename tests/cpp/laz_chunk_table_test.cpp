@@ -0,0 +1,105 @@
+/*****************************************************************************
+ *   Copyright (c) 2023, Lutra Consulting Ltd. and Hobu, Inc.                *
+ *                                                                           *
+ *   All rights reserved.                                                    *
+ *                                                                           *
+ *   This program is free software; you can redistribute it and/or modify    *
+ *   it under the terms of the GNU General Public License as published by    *
+ *   the Free Software Foundation; either version 3 of the License, or       *
+ *   (at your option) any later version.                                     *
+ *                                                                           *
+ ****************************************************************************/
+
+// Round-trip test of LAZ chunk table encoding (src/laz_chunk_table.hpp): a table is written,
+// read back and written again, and both the chunks and the encoded bytes must match.
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "laz_chunk_table.hpp"
+
+
+static int failures = 0;
+
+static void check(bool condition, const std::string &testName, const std::string &message)
+{
+    if (!condition)
+    {
+        std::cerr << "FAILED " << testName << ": " << message << std::endl;
+        ++failures;
+    }
+}
+
+static bool sameChunks(const std::vector<LazChunk> &a, const std::vector<LazChunk> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i].pointCount != b[i].pointCount || a[i].byteSize != b[i].byteSize)
+            return false;
+    }
+    return true;
+}
+
+static void testRoundTrip(const std::string &testName, const std::vector<LazChunk> &chunks)
+{
+    std::vector<char> table = encodeLazChunkTable(chunks);
+
+    std::vector<LazChunk> decoded;
+    check(decodeLazChunkTable(table, true, decoded), testName, "could not decode the table");
+    check(sameChunks(chunks, decoded), testName, "decoded chunks differ");
+
+    // writing the table read back must give the same bytes
+    std::vector<char> reencoded = encodeLazChunkTable(decoded);
+    check(table == reencoded, testName, "re-encoded table differs");
+
+    // tables of files with fixed chunk size only contain byte sizes of the chunks
+    std::vector<LazChunk> decodedFixed;
+    if (decodeLazChunkTable(table, false, decodedFixed))
+    {
+        for (const LazChunk &chunk : decodedFixed)
+            check(chunk.pointCount == 0, testName, "point count decoded from a fixed chunk size table");
+    }
+
+    // truncated table must not be accepted
+    if (!chunks.empty())
+    {
+        std::vector<LazChunk> decodedTruncated;
+        std::vector<char> truncated(table.begin(), table.begin() + 4);
+        check(!decodeLazChunkTable(truncated, true, decodedTruncated), testName, "truncated table was decoded");
+    }
+}
+
+int main()
+{
+    testRoundTrip("empty", {});
+
+    testRoundTrip("single chunk", { { 50000, 1234567 } });
+
+    // typical table: full chunks and a smaller last one, sizes vary a bit
+    std::vector<LazChunk> typical;
+    for (uint64_t i = 0; i < 100; ++i)
+        typical.push_back({ 50000, 800000 + (i * 7919) % 20000 });
+    typical.push_back({ 1234, 20000 });
+    testRoundTrip("typical", typical);
+
+    // concatenated files: chunk sizes jump between inputs of different density
+    std::vector<LazChunk> concatenated;
+    for (uint64_t i = 0; i < 1000; ++i)
+        concatenated.push_back({ i % 3 == 0 ? 1 : (uint64_t)50000 * (i % 5 + 1), 100 + (i * 104729) % 5000000 });
+    testRoundTrip("concatenated", concatenated);
+
+    // values up to the 32-bit limit of the table entries
+    testRoundTrip("large values", { { 0xFFFFFFFF, 0xFFFFFFFF }, { 1, 1 }, { 0x80000000, 0x7FFFFFFF }, { 0xFFFFFFFF, 0 } });
+
+    if (failures)
+    {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,47 @@
+import json
+import subprocess
+from pathlib import Path
+
+import pdal
+import utils
+
+
+def run_build_vpc(output_path: Path, input_files: list, threads: int) -> dict:
+    res = subprocess.run(
+        [
+            utils.pdal_wrench_path(),
+            "build_vpc",
+            f"--output={output_path.as_posix()}",
+            f"--threads={threads}",
+            *[f.as_posix() for f in input_files],
+        ],
+        check=True,
+    )
+
+    assert res.returncode == 0
+
+    with open(output_path, encoding="utf-8") as f:
+        return json.load(f)
+
+
+def test_build_vpc_parallel():
+    """Test that headers of input files read in parallel give the same VPC as reading them one by one"""
+
+    input_files = []
+    for i in range(1, 5):
+        input_files.append(utils.test_data_filepath(f"data_clipped{i}.laz"))
+        input_files.append(utils.test_data_filepath(f"data_clipped{i}.copc.laz"))
+        input_files.append(utils.test_data_filepath(f"data_hag_clipped{i}.las"))
+
+    serial_path = utils.test_data_output_filepath("serial.vpc", "build_vpc")
+    parallel_path = utils.test_data_output_filepath("parallel.vpc", "build_vpc")
+
+    serial_vpc = run_build_vpc(serial_path, input_files, 1)
+    parallel_vpc = run_build_vpc(parallel_path, input_files, 8)
+
+    assert len(parallel_vpc["features"]) == len(input_files)
+    assert parallel_vpc == serial_vpc
+
+    pipeline = pdal.Reader(filename=parallel_path.as_posix()).pipeline()
+
+    assert pipeline.execute() == 3 * 338163
@@ -182,3 +182,89 @@ def test_classify_ground_vpc_with_default_output_format():
         44.058912974549095,
         160.16,
     ]
+
+
+def test_classify_ground_vpc_with_memory_limit():
+    input_path = utils.test_data_filepath("data.vpc")
+
+    output_path = utils.test_data_output_filepath("classify-ground-memory-limit.las", "classify_ground")
+    profile_path = utils.test_data_output_filepath("classify-ground-memory-limit.json", "classify_ground")
+
+    # the limit is smaller than any job, so the jobs run one at a time
+    res = subprocess.run(
+        [
+            utils.pdal_wrench_path(),
+            "classify_ground",
+            f"--input={input_path.as_posix()}",
+            f"--output={output_path.as_posix()}",
+            "--memory-limit=1M",
+            "--threads=4",
+            "--verbose",
+            f"--profile={profile_path.as_posix()}",
+        ],
+        check=True,
+        capture_output=True,
+        text=True,
+    )
+
+    assert res.returncode == 0
+
+    assert "memory limit 1 MB" in res.stdout
+    assert "they will run alone" in res.stdout
+
+    assert output_path.exists()
+
+    pipeline = pdal.Reader(filename=output_path.as_posix()).pipeline()
+    number_of_points = pipeline.execute()
+
+    assert number_of_points == 338163
+
+    # even with more threads, no two jobs were running at the same time
+    with open(profile_path, encoding="utf-8") as f:
+        profile = json.load(f)
+
+    jobs = sorted(
+        (event for event in profile["traceEvents"] if event["cat"] == "pipeline" and event["name"].startswith("job")),
+        key=lambda event: event["ts"],
+    )
+
+    assert len(jobs) > 1
+
+    for previous, job in zip(jobs, jobs[1:]):
+        assert job["ts"] >= previous["ts"] + previous["dur"]
+
+
+@pytest.mark.parametrize(
+    "input_path,point_count",
+    [
+        (utils.test_data_filepath("stadium-utm.copc.laz"), 693895),
+        (utils.test_data_filepath("data.vpc"), 338163),
+    ],
+)
+def test_classify_ground_tiles(input_path: Path, point_count: int):
+    output_path = utils.test_data_output_filepath("classify-ground-tiles.las", "classify_ground")
+
+    res = subprocess.run(
+        [
+            utils.pdal_wrench_path(),
+            "classify_ground",
+            f"--input={input_path.as_posix()}",
+            f"--output={output_path.as_posix()}",
+            "--tile-size=100",
+            "--collar-size=20",
+        ],
+        check=True,
+    )
+
+    assert res.returncode == 0
+
+    assert output_path.exists()
+
+    # points in collars of tiles must not be written twice
+    pipeline = pdal.Reader(filename=output_path.as_posix()).pipeline()
+    number_of_points = pipeline.execute()
+
+    assert number_of_points == point_count
+
+    values = pipeline.arrays[0]["Classification"]
+    assert 2 in np.unique(values).tolist()  # some ground points were found
@@ -1,4 +1,5 @@
 import subprocess
+import typing
 from pathlib import Path
 
 import numpy as np
@@ -182,3 +183,43 @@ def test_filter_noise_statistical_remove_noise_points():
 
     noise_point = pipeline.arrays[0][(pipeline.arrays[0]["X"] == 494650.53) & (pipeline.arrays[0]["Y"] == 4878439.98)]
     assert noise_point.size == 0
+
+
+def test_filter_noise_radius_tiles():
+    """Test filter noise function with radius on copc processed in tiles with a collar"""
+
+    input_path = utils.test_data_filepath("stadium-utm.copc.laz")
+
+    def run_filter_noise(output_path: Path, extra_args: typing.List[str]) -> np.ndarray:
+        res = subprocess.run(
+            [
+                utils.pdal_wrench_path(),
+                "filter_noise",
+                f"--input={input_path.as_posix()}",
+                f"--output={output_path.as_posix()}",
+                "--algorithm=radius",
+                *extra_args,
+            ],
+            check=True,
+        )
+
+        assert res.returncode == 0
+
+        assert output_path.exists()
+
+        pipeline = pdal.Reader(filename=output_path.as_posix()).pipeline()
+        pipeline.execute()
+        return pipeline.arrays[0]["Classification"]
+
+    values = run_filter_noise(utils.test_data_output_filepath("filter_noise_radius.las", "filter_noise"), [])
+    tile_values = run_filter_noise(
+        utils.test_data_output_filepath("filter_noise_radius_tiles.las", "filter_noise"),
+        ["--tile-size=100", "--collar-size=20"],
+    )
+
+    # points in collars of tiles must not be written twice
+    assert tile_values.size == 693895
+
+    # the radius algorithm only looks at neighbors within the collar, so tiles give the same result
+    assert 7 in np.unique(tile_values).tolist()
+    assert np.count_nonzero(tile_values == 7) == np.count_nonzero(values == 7)
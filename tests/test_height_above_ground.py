@@ -1,7 +1,9 @@
 import itertools
 import subprocess
+import typing
 from pathlib import Path
 
+import numpy as np
 import pdal
 import pytest
 import utils
@@ -126,3 +128,48 @@ def test_run_with_bad_algorithms():
 
     assert res.returncode == 0
     assert f"unknown algorithm: {unknown_algorithm}" in res.stderr
+
+
+def test_hag_tiles():
+    """Test height above ground on COPC input processed in tiles with a collar."""
+
+    input_path = utils.test_data_filepath("stadium-utm.copc.laz")
+
+    def run_hag(output_path: Path, extra_args: typing.List[str]) -> np.ndarray:
+        res = subprocess.run(
+            [
+                utils.pdal_wrench_path(),
+                "height_above_ground",
+                f"--input={input_path.as_posix()}",
+                f"--output={output_path.as_posix()}",
+                "--algorithm=nn",
+                "--replace-z=false",
+                *extra_args,
+            ],
+            check=True,
+        )
+
+        assert res.returncode == 0
+
+        assert output_path.exists()
+
+        pipeline = pdal.Reader(filename=output_path.as_posix(), use_eb_vlr=True).pipeline()
+        pipeline.execute()
+        points = pipeline.arrays[0]
+
+        # tiles write points in a different order - sort them by their coordinates
+        order = np.lexsort((points["Z"], points["Y"], points["X"]))
+        return points["HeightAboveGround"][order]
+
+    values = run_hag(utils.test_data_output_filepath("stadium-utm-untiled.las", "height_above_ground"), [])
+    tile_values = run_hag(
+        utils.test_data_output_filepath("stadium-utm-tiles.las", "height_above_ground"),
+        ["--tile-size=100", "--collar-size=20"],
+    )
+
+    # points in collars of tiles must not be written twice
+    assert tile_values.size == 693895
+
+    # nearest ground points are almost always within the collar, so tiles give the same heights
+    same = np.isclose(tile_values, values, atol=0.01)
+    assert np.count_nonzero(same) >= 0.999 * values.size
@@ -1,3 +1,4 @@
+import struct
 import subprocess
 import typing
 from pathlib import Path
@@ -11,6 +12,7 @@ import utils
     "output_path",
     [
         (utils.test_data_output_filepath("data_merged.las", "merge")),
+        (utils.test_data_output_filepath("data_merged.laz", "merge")),
         (utils.test_data_output_filepath("data_merged.copc.laz", "merge")),
     ],
 )
@@ -111,3 +113,99 @@ def test_merge_with_extra_attribute():
     dimensions = pipeline.arrays[0].dtype.names
 
     assert "HeightAboveGround" in dimensions
+
+
+def read_copc_hierarchy(copc_path: Path) -> typing.Dict[typing.Tuple[int, int, int, int], int]:
+    """Return point counts of nodes in hierarchy of a COPC file (keyed by depth, x, y, z)"""
+
+    with open(copc_path, "rb") as f:
+        data = f.read()
+
+    # COPC info VLR is the first VLR after the 375 bytes long header
+    copc_info = data[375 + 54 : 375 + 54 + 160]
+    root_hier_offset, root_hier_size = struct.unpack_from("<QQ", copc_info, 40)
+
+    nodes = {}
+    for offset in range(root_hier_offset, root_hier_offset + root_hier_size, 32):
+        d, x, y, z, _, _, point_count = struct.unpack_from("<iiiiQii", data, offset)
+        nodes[(d, x, y, z)] = point_count
+
+    return nodes
+
+
+def check_copc_output(output_path: Path, expected_points: int) -> typing.Dict[typing.Tuple[int, int, int, int], int]:
+    """Check that COPC file can be read by readers.copc and that its hierarchy is consistent"""
+
+    pipeline = pdal.Reader.copc(filename=output_path.as_posix()).pipeline()
+
+    assert pipeline.execute() == expected_points
+
+    nodes = read_copc_hierarchy(output_path)
+
+    assert (0, 0, 0, 0) in nodes
+    assert sum(count for count in nodes.values() if count > 0) == expected_points
+
+    # all nodes have their parent in the hierarchy
+    for d, x, y, z in nodes:
+        if d > 0:
+            assert (d - 1, x >> 1, y >> 1, z >> 1) in nodes
+
+    return nodes
+
+
+def test_merge_to_copc_hierarchy():
+    """Test COPC output built directly from LAS files"""
+
+    files = [utils.test_data_filepath(f"data_hag_clipped{i}.las") for i in range(1, 5)]
+
+    output_path = utils.test_data_output_filepath("data_merged_hag.copc.laz", "merge")
+
+    res = subprocess.run(
+        [
+            utils.pdal_wrench_path(),
+            "merge",
+            f"--output={output_path.as_posix()}",
+            *[f.as_posix() for f in files],
+        ],
+        check=True,
+    )
+
+    assert res.returncode == 0
+
+    nodes = check_copc_output(output_path, 338163)
+
+    assert len(nodes) > 1
+
+
+def test_merge_to_copc_dense_cluster():
+    """Test COPC output of points at the same location, which do not fit into a single node"""
+
+    input_path = utils.test_data_output_filepath("data_same_location.las", "merge")
+
+    pipeline = pdal.Pipeline()
+    for i in range(1, 5):
+        pipeline |= pdal.Reader.las(filename=utils.test_data_filepath(f"data_hag_clipped{i}.las").as_posix())
+    pipeline |= pdal.Filter.merge()
+    pipeline |= pdal.Filter.assign(value=["X = 500000", "Y = 5000000", "Z = 100"])
+    pipeline |= pdal.Writer.las(filename=input_path.as_posix(), extra_dims="all", forward="all")
+    pipeline.execute()
+
+    output_path = utils.test_data_output_filepath("data_same_location.copc.laz", "merge")
+
+    res = subprocess.run(
+        [
+            utils.pdal_wrench_path(),
+            "merge",
+            f"--output={output_path.as_posix()}",
+            input_path.as_posix(),
+        ],
+        check=True,
+    )
+
+    assert res.returncode == 0
+
+    nodes = check_copc_output(output_path, 338163)
+
+    # the points had to go below the usual max depth of the octree, no node is larger than a chunk
+    assert max(d for d, _, _, _ in nodes) > 20
+    assert max(nodes.values()) <= 50000
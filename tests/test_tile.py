@@ -0,0 +1,157 @@
+import struct
+import subprocess
+from pathlib import Path
+
+import numpy as np
+import pdal
+import pytest
+import utils
+
+# bounds in tile headers (with the dimension of their scale)
+HEADER_BOUNDS = {
+    "minx": "x",
+    "miny": "y",
+    "minz": "z",
+    "maxx": "x",
+    "maxy": "y",
+    "maxz": "z",
+}
+
+# other header values that must be the same in tiles written in different ways
+HEADER_KEYS = [
+    "scale_x",
+    "scale_y",
+    "scale_z",
+    "offset_x",
+    "offset_y",
+    "offset_z",
+    "minor_version",
+    "dataformat_id",
+]
+
+
+def run_tile(input_path: Path, output_dir: Path, extra_args: list) -> str:
+    res = subprocess.run(
+        [
+            utils.pdal_wrench_path(),
+            "tile",
+            "--length=100",
+            f"--output={output_dir.as_posix()}",
+            input_path.as_posix(),
+        ]
+        + extra_args,
+        check=True,
+        capture_output=True,
+        text=True,
+    )
+
+    assert res.returncode == 0
+
+    return res.stdout
+
+
+def read_tiles(output_dir: Path) -> dict:
+    """Return header metadata and points (sorted, as tiles written in different ways have different order) of tiles"""
+    tiles = {}
+    for tile in output_dir.glob("*.las"):
+        pipeline = pdal.Reader(filename=tile.as_posix()).pipeline()
+        pipeline.execute()
+        tiles[tile.name] = (pipeline.metadata["metadata"]["readers.las"], np.sort(pipeline.arrays[0]))
+    return tiles
+
+
+def check_same_tiles(input_path: Path, point_count: int, output_name: str, extra_args: list) -> dict:
+    """Check that tiling with extra arguments writes the same tiles as the default tiling"""
+
+    default_dir = utils.test_data_output_filepath(f"{output_name}-default", "tile")
+    output_dir = utils.test_data_output_filepath(output_name, "tile")
+
+    run_tile(input_path, default_dir, [])
+    run_tile(input_path, output_dir, extra_args)
+
+    default_tiles = read_tiles(default_dir)
+    tiles = read_tiles(output_dir)
+
+    assert len(tiles) > 1
+    assert tiles.keys() == default_tiles.keys()
+    assert sum(points.size for _, points in tiles.values()) == point_count
+
+    for name, (metadata, points) in tiles.items():
+        default_metadata, default_points = default_tiles[name]
+
+        for key in HEADER_KEYS:
+            assert metadata[key] == default_metadata[key], f"{name}: {key}"
+
+        for key, axis in HEADER_BOUNDS.items():
+            scale = default_metadata[f"scale_{axis}"]
+            assert metadata[key] == pytest.approx(default_metadata[key], abs=scale), f"{name}: {key}"
+
+        assert points.dtype == default_points.dtype
+        assert points.size == default_points.size
+
+        # compare all dimensions of a sample of points
+        step = max(1, points.size // 100)
+        assert np.array_equal(points[::step], default_points[::step]), name
+
+    return tiles
+
+
+@pytest.mark.parametrize(
+    "input_path,point_count",
+    [
+        (utils.test_data_filepath("stadium-utm.laz"), 693895),
+    ],
+)
+def test_tile_single_pass(input_path: Path, point_count: int):
+    """Test that single pass tiling writes the same tiles as the two pass tiling"""
+
+    tiles = check_same_tiles(input_path, point_count, "single-pass", ["--single_pass"])
+
+    metadata, _ = next(iter(tiles.values()))
+    assert metadata["minor_version"] == 4
+    assert metadata["dataformat_id"] in (6, 7, 8)
+
+
+@pytest.mark.parametrize(
+    "input_path,point_count",
+    [
+        (utils.test_data_filepath("stadium-utm.laz"), 693895),
+    ],
+)
+def test_tile_compact_temp(input_path: Path, point_count: int):
+    """Test that tiling with compact temporary files writes the same tiles"""
+
+    check_same_tiles(input_path, point_count, "compact-temp", ["--compact_temp"])
+
+
+def test_tile_single_pass_with_evlrs():
+    """Test that single pass tiling falls back to regular temporary files when tiles need extended VLRs"""
+
+    input_path = utils.test_data_filepath("stadium-utm.laz")
+    output_dir = utils.test_data_output_filepath("single-pass-evlrs", "tile")
+
+    # WKT of the CRS is too long for a regular VLR, so writers.las puts it into an extended VLR
+    long_name = "UTM zone 10N " + "x" * 70000
+    wkt = (
+        f'PROJCS["{long_name}",GEOGCS["WGS 84",DATUM["WGS_1984",SPHEROID["WGS 84",6378137,298.257223563]],'
+        'PRIMEM["Greenwich",0],UNIT["degree",0.0174532925199433]],PROJECTION["Transverse_Mercator"],'
+        'PARAMETER["latitude_of_origin",0],PARAMETER["central_meridian",-123],PARAMETER["scale_factor",0.9996],'
+        'PARAMETER["false_easting",500000],PARAMETER["false_northing",0],UNIT["metre",1]]'
+    )
+
+    stdout = run_tile(input_path, output_dir, ["--single_pass", f"--a_srs={wkt}"])
+
+    tiles = list(output_dir.glob("*.las"))
+    assert len(tiles) > 1
+
+    with open(tiles[0], "rb") as f:
+        header = f.read(375)
+    (evlr_count,) = struct.unpack_from("<I", header, 243)
+    if evlr_count == 0:
+        pytest.skip("writers.las did not write the CRS as an extended VLR")
+
+    assert "Tiles need extended VLRs, using two passes." in stdout
+    assert "Temp files:       regular" in stdout
+
+    point_count = sum(pdal.Reader(filename=tile.as_posix()).pipeline().execute() for tile in tiles)
+    assert point_count == 693895
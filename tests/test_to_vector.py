@@ -46,3 +46,34 @@ def test_to_vector(input_path: Path, gpkg_file: Path, point_count: int):
     assert layer
     assert layer.GetName() == "points"
     assert layer.GetFeatureCount() == point_count
+
+
+def test_to_vector_vpc_shapefile():
+    """Test to_vector with VPC input and output format where the layer is named after the file"""
+
+    shp_file = utils.test_data_output_filepath("points-vpc.shp", "to_vector")
+    for f in shp_file.parent.glob(f"{shp_file.stem}.*"):
+        f.unlink()
+
+    res = subprocess.run(
+        [
+            utils.pdal_wrench_path(),
+            "to_vector",
+            f"--output={shp_file.as_posix()}",
+            f"--input={utils.test_data_filepath('data.vpc').as_posix()}",
+        ],
+        check=True,
+    )
+
+    assert res.returncode == 0
+
+    ds: ogr.DataSource = ogr.Open(shp_file.as_posix())
+
+    assert ds
+    assert ds.GetLayerCount() == 1
+
+    layer: ogr.Layer = ds.GetLayer(0)
+
+    assert layer
+    assert layer.GetName() == "points-vpc"
+    assert layer.GetFeatureCount() == 338163
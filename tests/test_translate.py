@@ -1,3 +1,4 @@
+import json
 import subprocess
 from pathlib import Path
 
@@ -165,3 +166,41 @@ def test_translate_with_transform_laz():
     assert first_point_output["X"] == 494576.35000000003
     assert first_point_output["Y"] == 4878552.03
     assert first_point_output["Z"] == 427.45
+
+
+def test_translate_profile():
+    """Test that profiling keeps the output intact and measures each stage"""
+
+    input_path = utils.test_data_filepath("stadium-utm.laz")
+    output_path = utils.test_data_output_filepath("translate-profile.las", "translate")
+    profile_path = utils.test_data_output_filepath("translate-profile.json", "translate")
+
+    res = subprocess.run(
+        [
+            utils.pdal_wrench_path(),
+            "translate",
+            f"--input={input_path.as_posix()}",
+            f"--output={output_path.as_posix()}",
+            "--filter=Classification == 2",
+            f"--profile={profile_path.as_posix()}",
+        ],
+        check=True,
+    )
+
+    assert res.returncode == 0
+
+    pipeline = pdal.Reader(filename=output_path.as_posix()).pipeline()
+    point_count = pipeline.execute()
+    assert 0 < point_count < 693895
+
+    with open(profile_path, encoding="utf-8") as f:
+        profile = json.load(f)
+
+    pipelines = [event for event in profile["traceEvents"] if event["cat"] == "pipeline"]
+    assert len(pipelines) > 0
+
+    stages = pipelines[0]["args"]["stages"]
+    assert stages[0]["name"] == "readers.las"
+    assert "filters.expression" in stages[1]["name"]
+    assert stages[-1]["name"].startswith("writers.las")
+    assert sum(p["args"]["stages"][-1]["points"] for p in pipelines) == point_count